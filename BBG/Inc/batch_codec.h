@@ -0,0 +1,64 @@
+/**
+ * @file batch_codec.h
+ * @author Leah
+ * @brief Delta-encoded batch frames, for gateways on constrained uplinks
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include "gps_msg.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATCH_HDR_LEN (1 + 2 + 4 + 2 + 4) // [type][body length u16][first seq u32][count u16][lot table version u32]
+#define BATCH_MAX_EVENTS 256               // Max events in a batch frame
+#define BATCH_EVENT_MAX_LEN (1 + 5 * 5)    // Header byte and 5 varints at most
+
+/**
+ * @brief Batch frame being encoded
+ *
+ * Each event is a header byte (bits 0-1: message type, bit 2: a lot ID
+ * follows), then varints of the zigzag-encoded differences from the previous
+ * event of the license ID, the timestamp, and the bit patterns of the latitude
+ * and longitude, then the lot ID as a varint if there's one. Consecutive
+ * events share most of their bits, so an event takes about 10 bytes instead
+ * of the 22 of a DATA frame.
+ */
+typedef struct
+{
+    uint8_t *frame;                    // Start of the frame
+    uint8_t *p;                        // End of the encoded events
+    uint16_t count;                    // Events encoded
+    uint32_t license;                  // Previous event's fields
+    uint32_t utc;
+    uint32_t lat;
+    uint32_t lon;
+} batch_enc_t;
+
+/**
+ * @brief Starts a batch frame
+ *
+ * @param e Encoder
+ * @param out Output buffer, BATCH_HDR_LEN + BATCH_MAX_EVENTS * BATCH_EVENT_MAX_LEN bytes at most
+ * @param seq Sequence number of the first event
+ * @param lots_version Version of the lot table the events' lots are resolved with
+ */
+void batch_begin(batch_enc_t *e, uint8_t *out, uint32_t seq, uint32_t lots_version);
+
+/**
+ * @brief Appends an event, up to BATCH_MAX_EVENTS
+ *
+ * @param e Encoder
+ * @param msg Message
+ * @param lot Lot ID of a resolved START, 0 otherwise
+ */
+void batch_add(batch_enc_t *e, const gps_msg_t *msg, uint32_t lot);
+
+/**
+ * @brief Completes the frame header
+ *
+ * @param e Encoder
+ * @return size_t Frame length
+ */
+size_t batch_finish(batch_enc_t *e);
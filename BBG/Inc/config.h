@@ -7,6 +7,9 @@
  */
 #pragma once
 
+#include <signal.h>
+#include <syslog.h>
+
 #define DEFAULT_I2C_BUS "/dev/i2c-1"
 #define DEFAULT_I2C_ADDR 0x10
 #define DEFAULT_SERVER_IP "192.168.1.71"
@@ -14,13 +17,62 @@
 #define DEFAULT_LOG_PATH "/var/log/parksys/parksys.log"
 #define DEFAULT_SERVICE_NAME "parksys.service"
 #define DEFAULT_SERVICE_PATH "/etc/systemd/system/parksys.service"
+#define DEFAULT_SPOOL_PATH "/var/lib/parksys/spool"
+#define DEFAULT_SPOOL_SIZE 65536
+#define DEFAULT_BATCH_MAX 256
+#define DEFAULT_BATCH_DELAY_MS 0
+#define DEFAULT_MODE MODE_FORK
+#define DEFAULT_I2C_POLL_MS 5
+#define DEFAULT_CONNECT_TIMEOUT_MS 3000
+#define DEFAULT_ACK_WINDOW 1024
+#define DEFAULT_I2C_BATCH 8
+#define DEFAULT_SOURCE SOURCE_I2C
+#define DEFAULT_SIM_VEHICLES 1000
+#define DEFAULT_LOG_LEVEL LOG_INFO
+#define DEFAULT_EDGE_LOTS 1
+#define DEFAULT_LOTS_PATH "/var/lib/parksys/lots"
+#define DEFAULT_COMPRESS 0
+#define DEFAULT_FAILOVER_MS 2000
+#define DEFAULT_METRICS_PATH "/run/parksys.metrics"
 #define CONFIG_PATH "/etc/parksys/parksys.config"
 
 #define MIN_PORT 1024
 #define MAX_PORT 65535
 #define MIN_I2C_ADDR 0x08
 #define MAX_I2C_ADDR 0x77
+#define MIN_SPOOL_SIZE 16
+#define MAX_SPOOL_SIZE (1 << 24)
+#define MAX_BATCH_MAX 4096
+#define MAX_BATCH_DELAY_MS 1000
+#define MIN_I2C_POLL_MS 1
+#define MAX_I2C_POLL_MS 1000
+#define MIN_CONNECT_TIMEOUT_MS 100
+#define MAX_CONNECT_TIMEOUT_MS 60000
+#define MAX_ACK_WINDOW 65536
+#define MAX_I2C_BATCH 32
+#define MAX_SIM_VEHICLES 1000000
+#define MAX_I2C_TARGETS 64
+#define MAX_SERVERS 16
+#define MIN_FAILOVER_MS 100
+#define MAX_FAILOVER_MS 60000
+
+#define MODE_FORK 0                    // Separate I2C and ETH processes
+#define MODE_SINGLE 1                  // One process with an event loop
+
+#define SOURCE_I2C 0                   // Messages from the STM32
+#define SOURCE_REPLAY 1                // Messages from a capture file
+#define SOURCE_SIM 2                   // Simulated messages
+
 
+typedef struct {
+    char bus[32];            // path to i2c device, e.g. "/dev/i2c-1"
+    int  addr;               // i2c slave address, e.g. 0x10
+} i2c_target_t;
+
+typedef struct {
+    char ip[64];             // Server IP address, e.g. "192.168.1.100"
+    int  port;               // Server port, e.g. 12345
+} server_addr_t;
 
 typedef struct {
     char i2c_bus[32];        // path to i2c device, e.g. "/dev/i2c-1"
@@ -30,13 +82,85 @@ typedef struct {
     char log_path[512];      // Path to log file
     char service_name[64];  // Systemd service name
     char service_path[512];  // Path to systemd service file
+    char spool_path[512];    // Path to the outgoing messages spool file
+    int  spool_size;         // Spool capacity in messages (rounded up to a power of 2)
+    int  batch_max;          // Max messages sent to the server in one write
+    int  batch_delay_ms;     // Max time to hold back a partial batch, 0 sends right away
+    int  mode;               // MODE_FORK or MODE_SINGLE
+    int  i2c_poll_ms;        // I2C polling period in single process mode
+    int  connect_timeout_ms; // Max time for a connection to the server to complete
+    unsigned int gateway_id; // Identifies this gateway to the server
+    int  ack_window;         // Max messages sent and not acknowledged yet
+    int  i2c_batch;          // Records per I2C frame, as built into the STM32 firmware
+    i2c_target_t i2c_targets[MAX_I2C_TARGETS]; // STM32s to poll, i2c_bus/i2c_addr if none is listed
+    int  i2c_target_count;
+    int  source;             // SOURCE_I2C, SOURCE_REPLAY or SOURCE_SIM
+    char replay_path[512];   // Capture file replayed by SOURCE_REPLAY
+    int  source_realtime;    // 1 to replay or simulate at 1x speed, 0 for max speed
+    int  sim_vehicles;       // Vehicles simulated by SOURCE_SIM
+    int  log_level;          // Lowest syslog priority logged, e.g. LOG_INFO
+    int  edge_lots;          // 1 to resolve the lot of START messages on the gateway
+    char lots_path[512];     // Cache of the server's lot table, "none" for memory only
+    int  compress;           // 1 to send delta-encoded batch frames
+    server_addr_t servers[MAX_SERVERS]; // Servers vehicles are spread over, server_ip/server_port if none is listed
+    int  server_count;
+    int  failover_ms;        // Time a server may be unreachable before its vehicles go to other servers
+    char metrics_path[512];  // Unix socket the metrics are read from, "none" for no socket
 } Config;
 
 /**
- * @brief Loads or creates the config file and fills the Config struct.
- *        If the file does not exist, it is created with default values.
+ * @brief Loads the config file and fills the Config struct.
+ *        Settings missing from the file get default values.
  *
  * @param cfg Pointer to Config struct to populate
+ * @param path Config file, CONFIG_PATH for the installed daemon
+ * @return 0 on success, -1 on failure
+ */
+int load_config(Config *cfg, const char *path);
+
+/**
+ * @brief Reloads the config file into the running config
+ *
+ * Settings the processes are built around (the spool, mode, source, gateway
+ * ID, lot table and paths) keep their running values, with a warning if they
+ * changed. The new log_level applies right away.
+ *
+ * @param cfg Running config, unchanged on failure
  * @return 0 on success, -1 on failure
  */
-int load_config(Config *cfg);
+int reload_config(Config *cfg);
+
+/**
+ * @brief Makes SIGHUP request a reload of the config file
+ *
+ * The handler only records the request, which is taken with config_reload_requested().
+ * Blocking calls it interrupts fail with EINTR.
+ *
+ * @param path Config file reload_config() reads
+ */
+void config_catch_reload(const char *path);
+
+/**
+ * @brief Blocks SIGHUP in the calling thread and the threads it creates,
+ *        so that reload requests are only taken at safe points
+ */
+void config_block_reload(void);
+
+/**
+ * @brief Signal mask for ppoll() and epoll_pwait() that lets a reload request interrupt the wait
+ *
+ * @return const sigset_t* The calling thread's mask without SIGHUP
+ */
+const sigset_t *config_wait_mask(void);
+
+/**
+ * @brief Tells if a reload was requested since the last call, taking a pending SIGHUP
+ *
+ * @return int 1 if one was, 0 otherwise
+ */
+int config_reload_requested(void);
+
+/**
+ * @brief Waits for a reload request, with SIGHUP blocked
+ */
+void config_wait_reload(void);
@@ -8,11 +8,12 @@
 #pragma once
 
 #include "config.h"
+#include "spool.h"
 
 /**
  * @brief Runs the ETH process loop.
  *
- * @param read_fd Read-end of the IPC pipe
- * @param cfg Pointer to config 
+ * @param spool Spool to drain messages from
+ * @param cfg Pointer to config, updated in place when SIGHUP reloads it
  */
-void run_eth_process(int read_fd, const Config *cfg);
\ No newline at end of file
+void run_eth_process(spool_t *spool, Config *cfg);
\ No newline at end of file
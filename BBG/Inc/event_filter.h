@@ -0,0 +1,66 @@
+/**
+ * @file event_filter.h
+ * @author Leah
+ * @brief Per-vehicle START/STOP state, to drop repeated events before they're spooled
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include "gps_msg.h"
+#include <stdint.h>
+
+#define FILTER_WAYS 4                  // Vehicles per bucket
+#define FILTER_BUCKET_BITS 14          // log2 of the number of buckets
+#define FILTER_BUCKETS (1 << FILTER_BUCKET_BITS) // 16384 buckets, so 65536 vehicles tracked
+
+#define FILTER_PASS 0                  // Expected transition, or a vehicle not seen before
+#define FILTER_DUPLICATE 1             // Same type and time as the vehicle's last event: drop it
+#define FILTER_UNEXPECTED 2            // START while parked or STOP while not: a lost event, send it anyway
+#define FILTER_OUT_OF_ORDER 3          // Older than the vehicle's last event, e.g. after an STM32 reboot: send it anyway
+
+/**
+ * @brief Last spooled event of a vehicle
+ */
+typedef struct
+{
+    uint32_t license_id;               // 0 for a free entry
+    uint32_t utc_sec;                  // Time of the event
+    uint8_t msg_type;                  // MSGT_START or MSGT_STOP
+} filter_entry_t;
+
+/**
+ * @brief Last event of the most recently seen vehicles
+ *
+ * A vehicle's events alternate between START and STOP with increasing times.
+ * An event repeating the last one, same type at the same time, is a frame the
+ * STM32 sent again or the gateway read again, and would open a second parking
+ * session on the server. An older event isn't dropped: an STM32 that rebooted
+ * starts its clock over, and its events must still get through. Once spooled,
+ * it replaces the vehicle's last event like any other. Each license ID hashes
+ * to a bucket of FILTER_WAYS entries. A full bucket forgets its vehicle with
+ * the oldest event, whose next event then passes like a new vehicle's.
+ */
+typedef struct
+{
+    filter_entry_t entries[FILTER_BUCKETS][FILTER_WAYS];
+} event_filter_t;
+
+/**
+ * @brief Classifies a START/STOP message against its vehicle's last event
+ *
+ * Doesn't record it: that's event_filter_commit()'s job once it's spooled.
+ *
+ * @param f Filter
+ * @param msg START/STOP message
+ * @return int FILTER_PASS, FILTER_DUPLICATE, FILTER_UNEXPECTED or FILTER_OUT_OF_ORDER
+ */
+int event_filter_check(const event_filter_t *f, const gps_msg_t *msg);
+
+/**
+ * @brief Records a spooled message as its vehicle's last event
+ *
+ * @param f Filter
+ * @param msg START/STOP message
+ */
+void event_filter_commit(event_filter_t *f, const gps_msg_t *msg);
@@ -0,0 +1,23 @@
+/**
+ * @file event_loop.h
+ * @author Leah
+ * @brief Single process event loop for parksys, handling both I2C and ETH
+ * @date 2026-10-19
+ * 
+ */
+#pragma once
+
+#include "config.h"
+#include "spool.h"
+
+/**
+ * @brief Runs the I2C and ETH sides in one process, on an epoll event loop.
+ *
+ * The I2C bus is polled on a timerfd, the server connection is non-blocking
+ * and reconnects with exponential backoff, and messages are written whenever
+ * the socket is writable. Neither side ever waits for the other.
+ *
+ * @param spool Spool buffering messages between the two sides
+ * @param cfg Pointer to config, updated in place when SIGHUP reloads it
+ */
+void run_event_loop(spool_t *spool, Config *cfg);
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #define MIN_LICENSE 1000000            // Min lisence plate ID
 
@@ -34,10 +36,25 @@ typedef struct __attribute__((packed))
 
 #define MSG_LEN sizeof(gps_msg_t)
 
+#define FRAME_HDR_LEN 1                // I2C frame header: number of records in use
+#define FRAME_LEN(n) (FRAME_HDR_LEN + (n) * MSG_LEN) // I2C frame of n records, unused ones zeroed
+
 /**
  * @brief Converts message type value to string
  * 
  * @param t Message type
  * @return const char* String representation of message type
  */
-const char *type_str(uint8_t t);
\ No newline at end of file
+const char *type_str(uint8_t t);
+
+/**
+ * @brief Checks that a message's fields are in range: message type, license ID,
+ *        coordinates (NaN included) and time
+ * 
+ * @param msg Message
+ * @param now Current time, messages from after it are invalid
+ * @param why Set to the reason a message is invalid, e.g. "invalid license_id 12"
+ * @param len Size of why
+ * @return int 1 if the message is valid, 0 otherwise
+ */
+int gps_msg_check(const gps_msg_t *msg, time_t now, char *why, size_t len);
\ No newline at end of file
@@ -1,19 +1,69 @@
 /**
  * @file i2c_process.h
  * @author Leah
- * @brief Multiprocessing I2C communication for parksys
+ * @brief I2C message source for parksys
  * @date 2025-07-15
- * 
+ *
  */
 #pragma once
 
 #include "config.h"
+#include "event_filter.h"
+#include "log_limit.h"
+#include "metrics.h"
+#include "source.h"
+#include "spool.h"
+#include <pthread.h>
+
+/**
+ * @brief One STM32 on a bus
+ */
+typedef struct
+{
+    char name[48];                     // "<bus>@0x<addr>", for logs
+    int addr;                          // Slave address
+    source_stats_t stats;
+    metrics_source_t *metrics;         // Shared counters, never reset
+    event_filter_t *filter;            // Vehicle states, shared by all devices
+    log_limit_t error_limit;           // Failed reads
+    log_limit_t invalid_limit;         // Invalid messages and frames
+    log_limit_t repeat_limit;          // Duplicate, unexpected and out of order events
+    log_limit_t dropped_limit;         // Messages dropped on a full spool
+} i2c_device_t;
 
 /**
- * @brief Runs the I2C process loop.
+ * @brief Opens an I2C bus, making sure it supports the transfers frames are read with
  *
- * @param write_fd Write-end of the IPC pipe (for sending START/STOP messages)
+ * @param bus Path to the bus, e.g. "/dev/i2c-1"
+ * @return int fd if successful, -1 otherwise
+ */
+int i2c_open(const char *bus);
+
+/**
+ * @brief Reads one frame of up to i2c_batch messages from a device, spooling
+ *        its START/STOP messages
+ *
+ * Duplicate events are dropped by the device's filter, which is only used
+ * under push_lock.
+ *
+ * @param fd I2C bus from i2c_open()
+ * @param dev Device to read from, its statistics count the frame and its messages
  * @param cfg Pointer to config containing I2C settings
+ * @param spool Spool to append START/STOP messages to
+ * @param push_lock Held while spooling when other threads spool too, NULL otherwise
+ * @return int Number of messages in the frame, -1 on a bus error or a bad
+ *             frame worth backing off from
  */
-void run_i2c_process(int write_fd, const Config *cfg);
+int i2c_read_frame(int fd, i2c_device_t *dev, const Config *cfg, spool_t *spool,
+                   pthread_mutex_t *push_lock);
 
+/**
+ * @brief Opens the I2C source, polling every configured STM32
+ *
+ * Devices are grouped by bus. In the source process each bus gets its own
+ * thread, which reads a frame from each of its devices in turn.
+ *
+ * @param src Source with cfg set
+ * @return int 0 on success, -1 on failure
+ */
+int i2c_source_open(source_t *src);
@@ -0,0 +1,52 @@
+/**
+ * @file log_limit.h
+ * @author Leah
+ * @brief Rate limited syslog output, for messages that may repeat many times a second
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define LOG_LIMIT_BURST 5             // Messages a category may log per interval
+#define LOG_LIMIT_INTERVAL_MS 60000   // Rate limiting interval
+
+/**
+ * @brief Rate limit of one category of messages
+ */
+typedef struct
+{
+    const char *what;                  // Category, for the suppressed messages report
+    int64_t window_ms;                 // Start of the current interval
+    unsigned int logged;               // Messages logged in the current interval
+    unsigned long suppressed;          // Messages dropped in the current interval
+    int priority;                      // syslog priority of the last one dropped
+} log_limit_t;
+
+#define LOG_LIMIT_INIT(what) { (what), 0, 0, 0, 0 }
+
+/**
+ * @brief Logs a message unless its category already logged LOG_LIMIT_BURST
+ *        messages in the current interval
+ *
+ * The first message of a new interval is preceded by the number of messages
+ * suppressed in the previous one.
+ *
+ * @param lim Category
+ * @param priority syslog priority
+ * @param fmt printf format
+ * @return int 1 if the message was logged, 0 if it was suppressed
+ */
+int log_limited(log_limit_t *lim, int priority, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Logs the number of messages suppressed in an interval that ended
+ *
+ * Call it periodically: otherwise the count is only logged with the
+ * category's next message, which may never come.
+ *
+ * @param lim Category
+ */
+void log_limit_flush(log_limit_t *lim);
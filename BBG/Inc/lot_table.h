@@ -0,0 +1,61 @@
+/**
+ * @file lot_table.h
+ * @author Leah
+ * @brief Local copy of the server's lot table, for resolving START messages on the gateway
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOT_TABLE_MAX 4096             // Max lots in a table
+#define LOT_TABLE_HDR_LEN (4 + 4)      // [version u32][count u32]
+#define LOT_TABLE_LEN(n) (LOT_TABLE_HDR_LEN + (size_t)(n) * 12) // Header, then lat, lon and id arrays
+
+/**
+ * @brief Lot coordinates as published by the server
+ *
+ * Stored as separate arrays rather than an array of structs, so the nearest
+ * lot search loads 4 latitudes or longitudes at a time.
+ * The version is a hash of the table's content, 0 when there's no table.
+ */
+typedef struct
+{
+    uint32_t version;
+    uint32_t count;
+    float *lat;                        // Latitude of each lot
+    float *lon;                        // Longitude of each lot
+    uint32_t *id;                      // ID of each lot
+    uint8_t *raw;                      // Table as received, the arrays point into it
+} lot_table_t;
+
+/**
+ * @brief Initializes an empty table, then loads the cached one if there's any
+ *
+ * @param t Table
+ * @param path Cache file, "none" for no cache
+ */
+void lot_table_init(lot_table_t *t, const char *path);
+
+/**
+ * @brief Replaces the table with one received from the server, and caches it
+ *
+ * @param t Table
+ * @param buf Table as sent by the server: LOT_TABLE_LEN(count) bytes
+ * @param len Bytes in buf
+ * @param path Cache file, "none" for no cache
+ * @return int 0 on success, -1 if the table is malformed or memory ran out
+ */
+int lot_table_set(lot_table_t *t, const uint8_t *buf, size_t len, const char *path);
+
+/**
+ * @brief Finds the lot closest to a location, the way the server measures distance
+ *
+ * @param t Table
+ * @param latitude Latitude of the vehicle
+ * @param longitude Longitude of the vehicle
+ * @return uint32_t Lot ID, 0 if the table is empty
+ */
+uint32_t lot_table_nearest(const lot_table_t *t, float latitude, float longitude);
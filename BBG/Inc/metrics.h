@@ -0,0 +1,131 @@
+/**
+ * @file metrics.h
+ * @author Leah
+ * @brief Counters shared by the processes, exported in the Prometheus text format
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include "config.h"
+#include "router.h"
+#include "sender.h"
+#include "spool.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define METRICS_ERRNOS 8          // Read errors kept apart: EAGAIN, EINTR, EBUSY, ETIMEDOUT, EIO, ENXIO, EREMOTEIO, other
+#define METRICS_LATENCY_BUCKETS 16 // Ack latency buckets: up to 1 ms, 2 ms, 4 ms, ... 16384 ms, more
+
+typedef _Atomic uint64_t metric_t;
+
+/**
+ * @brief Counters of one message source: an STM32, or the replay or simulation
+ */
+typedef struct
+{
+    char name[48];                     // Same as in the logs
+    metric_t frames;                   // Frames read
+    metric_t starts;                   // START messages spooled
+    metric_t stops;                    // STOP messages spooled
+    metric_t idle;                     // IDLE messages
+    metric_t invalid;                  // Invalid messages and frames
+    metric_t dropped;                  // Messages dropped on a full spool
+    metric_t duplicates;               // START/STOP messages dropped as repeats
+    metric_t unexpected;               // START while parked or STOP while not, spooled anyway
+    metric_t out_of_order;             // START/STOP messages older than their vehicle's last, spooled anyway
+    metric_t errors[METRICS_ERRNOS];   // Failed reads by errno
+} metrics_source_t;
+
+/**
+ * @brief Counters of both processes, in a mapping shared through fork()
+ *
+ * Every counter has a single writer: a source's counters belong to the thread
+ * polling it, the others to the ETH side. So updates are a relaxed load and
+ * store, without locks or read-modify-write instructions, and readers in any
+ * process see whole values.
+ */
+typedef struct
+{
+    _Atomic int source_count;          // Sources in use, the first ones
+    metrics_source_t sources[MAX_I2C_TARGETS];
+
+    metric_t sent_msgs;                // Messages framed for a server, resent ones included
+    metric_t sent_bytes;               // Bytes of their frames
+    metric_t acked_msgs;               // Messages acknowledged by a server
+    metric_t batches[HIST_BUCKETS];    // Batches by size, bucket i holds sizes [2^i, 2^(i+1))
+    metric_t acks[METRICS_LATENCY_BUCKETS]; // Batches by time from framing to acknowledgement
+    metric_t ack_ms;                   // Sum of those times
+    metric_t moved_msgs;               // Messages moved to another server by failovers and reloads
+    metric_t lot_table_errors;         // Lot tables from a server that could not be applied
+} metrics_t;
+
+/**
+ * @brief Adds to a counter. Only its writer may call this.
+ *
+ * @param m Counter
+ * @param n Amount
+ */
+static inline void metric_add(metric_t *m, uint64_t n)
+{
+    atomic_store_explicit(m, atomic_load_explicit(m, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ * @brief Maps the shared counters. Must be called before fork().
+ *
+ * Until then, or if mapping fails, the counters are private to the process.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int metrics_open(void);
+
+/**
+ * @brief The counters
+ *
+ * @return metrics_t* Counters, never NULL
+ */
+metrics_t *metrics(void);
+
+/**
+ * @brief Sets the number of sources and resets their counters, for a source being opened
+ *
+ * @param count Number of sources, up to MAX_I2C_TARGETS
+ * @return metrics_source_t* First source, to be named by the caller
+ */
+metrics_source_t *metrics_sources(int count);
+
+/**
+ * @brief Counts a failed read
+ *
+ * @param src Counters of the source
+ * @param err errno of the failure
+ */
+void metrics_read_error(metrics_source_t *src, int err);
+
+/**
+ * @brief Counts the acknowledgement of a batch
+ *
+ * @param ms Time from framing to acknowledgement
+ */
+void metrics_ack_latency(int64_t ms);
+
+/**
+ * @brief Creates the socket the metrics are read from
+ *
+ * A client that connects gets the metrics in the Prometheus text format,
+ * then the connection is closed.
+ *
+ * @param path Socket path, "none" for no socket
+ * @return int Listening socket, -1 if there's none
+ */
+int metrics_listen(const char *path);
+
+/**
+ * @brief Writes the metrics to every pending client of the socket
+ *
+ * @param fd Listening socket from metrics_listen()
+ * @param r Router, for the state of each server
+ * @param spool Spool, for its depth
+ */
+void metrics_serve(int fd, const router_t *r, spool_t *spool);
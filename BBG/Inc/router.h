@@ -0,0 +1,128 @@
+/**
+ * @file router.h
+ * @author Leah
+ * @brief Spreads spooled messages over the servers by license ID, with failover
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include "config.h"
+#include "sender.h"
+#include "spool.h"
+#include <stdint.h>
+
+#define RING_POINTS 64      // Points of each server on the hash ring
+
+typedef struct
+{
+    uint32_t hash;                     // Position on the ring
+    int link;                          // Server owning the arc that ends here
+} ring_point_t;
+
+/**
+ * @brief Routes spooled messages to one sender per server
+ *
+ * Each message goes to the server owning its license ID on a consistent hash
+ * ring, so a vehicle's START and STOP messages reach the same server, and
+ * adding or removing a server moves only the vehicles of its share of the ring.
+ * A server that's been unreachable for failover_ms stops owning vehicles: its
+ * queued messages and new ones go to the next reachable server on the ring,
+ * until it's reachable again.
+ */
+typedef struct
+{
+    const Config *cfg;
+    spool_t *spool;
+    sender_shared_t shared;
+    sender_t links[MAX_SERVERS];       // One sender per configured server, then removed ones draining
+    int count;
+    int configured;                    // Links of configured servers, the ones on the ring
+    int healthy[MAX_SERVERS];          // Reachability of each server when routing last
+    int closed[MAX_SERVERS];           // Removed server done draining, left SENDER_DOWN
+    ring_point_t ring[MAX_SERVERS * RING_POINTS]; // Sorted by hash
+    int ring_len;
+    uint32_t routed;                   // Spool position of the next message to route
+} router_t;
+
+/**
+ * @brief Initializes the senders of the configured servers and the hash ring
+ *
+ * With one server, messages are numbered by their spool position under the
+ * spool's epoch, so they keep their sequence numbers across restarts. With
+ * more, each server numbers its own messages under a random epoch drawn here.
+ *
+ * @param r Router
+ * @param spool Spool to send from
+ * @param cfg Pointer to config
+ * @return int 0 on success, -1 on failure
+ */
+int router_init(router_t *r, spool_t *spool, const Config *cfg);
+
+/**
+ * @brief Applies a reloaded config, already stored where router_init() was pointed
+ *
+ * Servers still listed keep their connection, queue and numbering, with the
+ * new batching parameters. Listed servers that are new get a sender under a
+ * random epoch. Servers no longer listed get no more messages: connected ones
+ * drain their queues, which move to the servers owning their vehicles now if
+ * they disconnect, and the others' queues move right away. Senders move
+ * between links, so their sockets must be watched anew.
+ *
+ * @param r Router
+ * @return int 0 on success, -1 on failure
+ */
+int router_reload(router_t *r);
+
+/**
+ * @brief Queues the newly spooled messages for their servers, and fails over
+ *        the servers that became unreachable
+ *
+ * @param r Router
+ */
+void router_route(router_t *r);
+
+/**
+ * @brief Flushes the senders of connected servers
+ *
+ * @param r Router
+ */
+void router_flush(router_t *r);
+
+/**
+ * @brief Handles whatever became due by router_deadline_ms()
+ *
+ * Connects, fails connections that timed out, and fails over unreachable
+ * servers. Held batches and failed over messages need a router_flush().
+ *
+ * @param r Router
+ */
+void router_on_timeout(router_t *r);
+
+/**
+ * @brief Tells if a sender would send more messages if they were spooled
+ *
+ * @param r Router
+ * @param have Set to the number of spooled messages the router already knows about
+ * @return int 1 if one would, 0 otherwise
+ */
+int router_wants_messages(const router_t *r, uint32_t *have);
+
+/**
+ * @brief When router_on_timeout() or router_flush() is due next
+ *
+ * That's the earliest sender_deadline_ms(), or the time a disconnected
+ * server becomes unreachable.
+ *
+ * @param r Router
+ * @return int64_t Monotonic time in milliseconds, -1 if there's nothing to wait for
+ */
+int64_t router_deadline_ms(const router_t *r);
+
+/**
+ * @brief Time left until router_deadline_ms()
+ *
+ * @param r Router
+ * @return int Milliseconds, 0 if already due, -1 if there's nothing to wait for
+ */
+int router_timeout_ms(const router_t *r);
@@ -0,0 +1,295 @@
+/**
+ * @file sender.h
+ * @author Leah
+ * @brief Non-blocking delivery of spooled messages to the server
+ * @date 2026-10-19
+ * 
+ */
+#pragma once
+
+#include "config.h"
+#include "lot_table.h"
+#include "spool.h"
+#include <stdint.h>
+#include <time.h>
+
+#define HIST_BUCKETS 13     // Batch size histogram buckets: 1, 2-3, 4-7, ... 4096
+#define HIST_PERIOD 60      // Seconds between batch statistics reports
+
+#define BACKOFF_MIN_MS 250  // First reconnection delay
+#define BACKOFF_MAX_MS 30000 // Reconnection delay cap, before jitter
+#define ACK_TIMEOUT_MS 30000 // Max wait for the server to acknowledge anything in flight
+#define SENDER_TIMES 64     // Batches in flight whose framing time is kept, for the ack latency
+
+#define FRAME_DATA 0xA5     // [type][seq u32][gps_msg_t], gateway to server
+#define FRAME_ACK 0xA6      // [type][next seq u32], server to gateway
+#define FRAME_HELLO 0xA7    // [type][gateway id u32][spool epoch u32], gateway to server
+#define FRAME_DATA_LOT 0xA8 // [type][seq u32][gps_msg_t][lot id u32][lot table version u32], gateway to server
+#define FRAME_LOTS_REQ 0xA9 // [type][lot table version u32], gateway to server
+#define FRAME_LOTS 0xAA     // [type][lot table], server to gateway
+#define FRAME_BATCH 0xAB    // [type][body length u16][first seq u32][count u16][lot table version u32][events], see batch_codec.h
+
+#define DATA_FRAME_LEN (1 + 4 + MSG_LEN)
+#define DATA_LOT_FRAME_LEN (DATA_FRAME_LEN + 4 + 4)
+#define ACK_FRAME_LEN (1 + 4)
+#define HELLO_FRAME_LEN (1 + 4 + 4)
+#define LOTS_REQ_FRAME_LEN (1 + 4)
+#define IN_BUF_LEN (1 + LOT_TABLE_LEN(LOT_TABLE_MAX)) // Room for the largest frame from the server
+
+// Room for a hello, a lot table request and a full batch, DATA_LOT frames
+// being larger than encoded events with their share of a batch frame header
+#define OUT_BUF_LEN(batch_max) (HELLO_FRAME_LEN + LOTS_REQ_FRAME_LEN + (size_t)(batch_max) * DATA_LOT_FRAME_LEN)
+
+typedef struct
+{
+    uint64_t batches;                  // Batches sent
+    uint64_t msgs;                     // Messages sent
+    uint64_t bytes;                    // Bytes of their frames
+    uint64_t hist[HIST_BUCKETS];       // Batches by size, bucket i holds sizes [2^i, 2^(i+1))
+    time_t last_report;                // Time of the last report
+} batch_stats_t;
+
+typedef enum
+{
+    SENDER_DOWN,                       // No socket, waiting for retry_at_ms
+    SENDER_CONNECTING,                 // Non-blocking connect in progress
+    SENDER_UP                          // Connected
+} sender_state_t;
+
+typedef enum
+{
+    FLUSH_DONE,                        // Nothing more to send until new messages or acks arrive
+    FLUSH_HOLD,                        // Holding a partial batch back until batch_delay_ms passed
+    FLUSH_BLOCKED,                     // Socket buffer is full, wait for writability
+    FLUSH_FAILED                       // Connection lost, reconnection scheduled
+} flush_result_t;
+
+/**
+ * @brief State shared by the senders of all servers
+ *
+ * Messages stay in the spool in arrival order, while each sender goes through
+ * the ones routed to it. The per-slot arrays chain them into one queue per
+ * server, and tell which messages can be released from the spool tail.
+ */
+typedef struct
+{
+    uint32_t *chain;                   // Per spool slot: position of the next message queued for the same server
+    uint8_t *acked;                    // Per spool slot: acknowledged by its server, until released
+    lot_table_t lots;                  // Lot table START messages are resolved with, if edge_lots
+    batch_stats_t stats;
+} sender_shared_t;
+
+/**
+ * @brief Delivers the spooled messages routed to one server over the acknowledged protocol
+ * 
+ * Messages are queued in the order they're routed to the server, sent as data
+ * frames numbered by their place in that queue, and stay in the spool until
+ * the server acknowledges them. Up to ack_window messages may be in flight;
+ * after a reconnection everything unacknowledged is resent.
+ */
+typedef struct
+{
+    const Config *cfg;
+    server_addr_t server;              // Server to deliver to
+    spool_t *spool;
+    sender_shared_t *shared;
+    uint32_t epoch;                    // Epoch of the sequence numbers, sent in the hello
+    int fd;                            // Socket, -1 when SENDER_DOWN
+    sender_state_t state;
+    int backoff_ms;                    // Backoff of the next failure, doubled on each one
+    int64_t retry_at_ms;               // SENDER_DOWN: monotonic time of the next attempt
+                                       // SENDER_CONNECTING: connection deadline
+    int64_t down_since_ms;             // When the sender was last connected, or initialized
+    unsigned int seed;                 // Jitter random state
+    uint32_t head;                     // Spool position of the oldest queued message
+    uint32_t last;                     // Spool position of the newest queued message
+    uint32_t next;                     // Spool position of the next message to frame
+    uint32_t queued;                   // Messages queued, acknowledged ones are dequeued
+    uint32_t in_flight;                // Queued messages already framed
+    uint32_t head_seq;                 // Sequence number of the oldest queued message
+    uint8_t *out;                      // Frames waiting to be written
+    size_t out_cap;                    // Size of out
+    size_t out_len;                    // Bytes in out
+    size_t out_off;                    // Bytes of out already written
+    uint8_t *in;                       // Received bytes, not parsed yet
+    size_t in_len;                     // Bytes in in
+    int blocked;                       // Last write stopped on a full socket buffer
+    int64_t hold_until_ms;             // End of the partial batch hold, 0 if not holding
+    int64_t ack_deadline_ms;           // When in-flight messages must be acknowledged by, 0 if none
+    uint32_t times_seq[SENDER_TIMES];  // Ring of the batches in flight: sequence number after each
+    int64_t times_ms[SENDER_TIMES];    // and when it was framed
+    uint32_t times_head;               // Oldest batch in the ring
+    uint32_t times_len;                // Batches in the ring, later ones aren't timed
+    uint64_t connects;                 // Connections established
+    uint64_t failures;                 // Connections and connection attempts failed
+} sender_t;
+
+/**
+ * @brief Allocates the state shared by the senders and loads the cached lot table
+ *
+ * @param sh Shared state
+ * @param spool Spool the senders send from
+ * @param cfg Pointer to config
+ * @return int 0 on success, -1 on failure
+ */
+int sender_shared_init(sender_shared_t *sh, spool_t *spool, const Config *cfg);
+
+/**
+ * @brief Initializes a disconnected sender with an empty queue, that may connect right away
+ *
+ * @param s Sender
+ * @param spool Spool to send from
+ * @param cfg Pointer to config
+ * @param server Server to deliver to
+ * @param shared State shared with the senders of the other servers
+ * @param epoch Epoch of the sequence numbers
+ * @param first_seq Sequence number of the first message queued
+ * @return int 0 on success, -1 on failure
+ */
+int sender_init(sender_t *s, spool_t *spool, const Config *cfg, const server_addr_t *server,
+                sender_shared_t *shared, uint32_t epoch, uint32_t first_seq);
+
+/**
+ * @brief Applies a reloaded config, growing the output buffer for a larger batch_max
+ *
+ * @param s Sender
+ * @return int 0 on success, -1 on failure
+ */
+int sender_reload(sender_t *s);
+
+/**
+ * @brief Closes the connection and frees the buffers of a sender whose queue was dropped
+ *
+ * @param s Sender
+ */
+void sender_close(sender_t *s);
+
+/**
+ * @brief Queues a spooled message for the server
+ *
+ * @param s Sender
+ * @param pos Spool position of the message
+ */
+void sender_enqueue(sender_t *s, uint32_t pos);
+
+/**
+ * @brief Empties the queue, so its messages can be queued for other servers
+ *
+ * Sequence numbers continue after the dropped messages, which the server
+ * will never receive.
+ *
+ * @param s Sender that isn't SENDER_UP
+ * @param pos Set to the spool position of the oldest dropped message
+ * @return uint32_t Number of dropped messages, chained from pos
+ */
+uint32_t sender_drop_queue(sender_t *s, uint32_t *pos);
+
+/**
+ * @brief Tells if the server counts as reachable: it's connected, or lost for less than failover_ms
+ *
+ * @param s Sender
+ * @param now Monotonic time in milliseconds
+ * @return int 1 if it does, 0 otherwise
+ */
+int sender_healthy(const sender_t *s, int64_t now);
+
+/**
+ * @brief Starts a non-blocking connection to the server
+ *
+ * On success the sender is SENDER_CONNECTING (or SENDER_UP if the connection
+ * completed right away), and must fail if it isn't writable by the connection
+ * deadline. On failure it's SENDER_DOWN with a retry scheduled.
+ *
+ * @param s Sender in SENDER_DOWN state
+ * @return int 0 on success, -1 on failure
+ */
+int sender_connect(sender_t *s);
+
+/**
+ * @brief Completes a connection once its socket became writable
+ *
+ * @param s Sender in SENDER_CONNECTING state
+ * @return int 0 if connected, -1 if the connection failed and a retry was scheduled
+ */
+int sender_finish_connect(sender_t *s);
+
+/**
+ * @brief Writes queued messages without blocking, up to batch_max per write
+ *
+ * @param s Sender in SENDER_UP state
+ * @return flush_result_t Why it stopped
+ */
+flush_result_t sender_flush(sender_t *s);
+
+/**
+ * @brief Reads acknowledgements, releasing acknowledged messages from the spool
+ *        once all messages before them are too, and lot tables
+ *
+ * @param s Sender in SENDER_UP state, with a readable socket
+ * @return int 0 on success, -1 if the connection failed and a retry was scheduled
+ */
+int sender_receive(sender_t *s);
+
+/**
+ * @brief Handles an expired sender_timeout_ms()
+ *
+ * Connects when a reconnection is due, and fails a connection that wasn't
+ * established or didn't acknowledge in time. A held batch needs a sender_flush().
+ *
+ * @param s Sender
+ */
+void sender_on_timeout(sender_t *s);
+
+/**
+ * @brief Tells if the sender would send more messages if they were queued
+ *
+ * @param s Sender
+ * @return int 1 if it would, 0 otherwise
+ */
+int sender_wants_messages(const sender_t *s);
+
+/**
+ * @brief Drops the connection and schedules a reconnection with exponential backoff
+ * 
+ * The delay is drawn at random from the upper half of the current backoff, so
+ * gateways that lost the server together don't all come back at the same time.
+ *
+ * @param s Sender
+ * @param what Reason, for the log
+ */
+void sender_fail(sender_t *s, const char *what);
+
+/**
+ * @brief When sender_on_timeout() or sender_flush() is due next
+ * 
+ * That's the next reconnection attempt, the connection deadline, the end of
+ * a held batch or the acknowledgement deadline.
+ * 
+ * @param s Sender
+ * @return int64_t Monotonic time in milliseconds, -1 if there's nothing to wait for
+ */
+int64_t sender_deadline_ms(const sender_t *s);
+
+/**
+ * @brief Time left until sender_deadline_ms()
+ * 
+ * @param s Sender
+ * @return int Milliseconds, 0 if already due, -1 if there's nothing to wait for
+ */
+int sender_timeout_ms(const sender_t *s);
+
+/**
+ * @brief Adds a batch to the statistics and logs them periodically
+ *
+ * @param stats Statistics
+ * @param count Batch size
+ * @param bytes Bytes of the batch's frames
+ */
+void batch_stats_record(batch_stats_t *stats, uint32_t count, size_t bytes);
+
+/**
+ * @brief Monotonic clock in milliseconds
+ *
+ * @return int64_t Milliseconds
+ */
+int64_t monotonic_ms(void);
@@ -0,0 +1,177 @@
+/**
+ * @file source.h
+ * @author Leah
+ * @brief Where START/STOP messages come from: I2C, a capture replay or a simulation
+ * @date 2026-10-19
+ *
+ */
+#pragma once
+
+#include "config.h"
+#include "event_filter.h"
+#include "gps_msg.h"
+#include "metrics.h"
+#include "spool.h"
+#include <stdint.h>
+
+#define SOURCE_IDLE_MS 1000 // Sleep of a finished source in the source process
+#define SOURCE_REPORT_MS 60000 // Period of the source statistics report
+
+/**
+ * @brief What a source read since the last report, logged instead of each message
+ */
+typedef struct
+{
+    uint64_t frames;                   // Frames read
+    uint64_t starts;                   // START messages spooled
+    uint64_t stops;                    // STOP messages spooled
+    uint64_t idle;                     // IDLE messages
+    uint64_t invalid;                  // Invalid messages and frames
+    uint64_t errors;                   // Failed reads
+    uint64_t dropped;                  // Messages dropped on a full spool
+    uint64_t duplicates;               // START/STOP messages dropped as repeats
+    uint64_t unexpected;               // START while parked or STOP while not, spooled anyway
+    uint64_t out_of_order;             // START/STOP messages older than their vehicle's last, spooled anyway
+    int64_t last_report_ms;            // Time of the last report
+} source_stats_t;
+
+typedef struct source source_t;
+
+/**
+ * @brief Message source
+ *
+ * SOURCE_I2C reads frames from every STM32 through read(). The other sources
+ * generate messages through next(), each due at some time since the source was
+ * opened, and are read in frames of up to i2c_batch messages as well.
+ */
+struct source
+{
+    const Config *cfg;
+
+    /**
+     * @brief Reads a frame from each device, replacing the generated source read
+     *
+     * @param src Source
+     * @param spool Spool to append START/STOP messages to
+     * @return int Number of messages read, -1 on an error worth backing off from
+     */
+    int (*read)(source_t *src, spool_t *spool);
+
+    /**
+     * @brief Replaces the source process loop, returns when a reload is requested
+     *
+     * @param src Source
+     * @param spool Spool to append START/STOP messages to
+     */
+    void (*run)(source_t *src, spool_t *spool);
+
+    /**
+     * @brief Generates the next START/STOP message
+     *
+     * @param src Source
+     * @param msg Set to the message
+     * @param due_ms Set to when it's due at 1x speed, in milliseconds since the source was opened
+     * @return int 1 if a message was generated, 0 when the source is exhausted
+     */
+    int (*next)(source_t *src, gps_msg_t *msg, int64_t *due_ms);
+    void (*close)(source_t *src);
+    void *state;                       // Backend state
+
+    gps_msg_t pending;                 // Generated, not spooled yet
+    int64_t pending_due_ms;
+    int has_pending;
+    int more;                          // Last read filled a frame, more may be waiting
+    int blocked;                       // Last read stopped on a full spool
+    int done;                          // next() is exhausted
+    int64_t start_ms;                  // Monotonic time the source was opened
+    uint64_t produced;                 // Messages spooled so far
+    source_stats_t stats;
+    metrics_source_t *metrics;         // Shared counters of generated sources
+    event_filter_t *filter;            // Last event of each vehicle, kept across reopens
+};
+
+/**
+ * @brief Runs the source process loop.
+ *
+ * @param spool Spool to append START/STOP messages to
+ * @param cfg Pointer to config containing source settings, updated in place when SIGHUP reloads it
+ */
+void run_source_process(spool_t *spool, Config *cfg);
+
+/**
+ * @brief Opens the configured source
+ *
+ * Every source of the process shares one event filter, so a reopened
+ * source still drops repeats of the events spooled before.
+ *
+ * @param src Source
+ * @param cfg Pointer to config containing source settings
+ * @return int 0 on success, -1 on failure
+ */
+int source_open(source_t *src, const Config *cfg);
+
+/**
+ * @brief Applies a reloaded config to an open source
+ *
+ * The I2C source is reopened if its targets changed. If the new ones can't
+ * be opened, the old ones are put back in the config and reopened. Other
+ * settings are read from the config as the source goes.
+ *
+ * @param src Source, opened on cfg
+ * @param cfg Reloaded config
+ * @param old Config before the reload
+ * @return int 0 on success, -1 if no I2C target could be opened
+ */
+int source_reload(source_t *src, Config *cfg, const Config *old);
+
+/**
+ * @brief Reads one frame of messages, spooling its START/STOP messages
+ *
+ * Never blocks on generated sources: messages not due yet, or that don't fit
+ * in the spool, wait for a later read. Repeated events are dropped.
+ *
+ * @param src Source
+ * @param spool Spool to append START/STOP messages to
+ * @return int Number of messages read, -1 on an error worth backing off from
+ */
+int source_read(source_t *src, spool_t *spool);
+
+/**
+ * @brief Time until a read that returned a partial frame is worth repeating
+ *
+ * @param src Source
+ * @return int Milliseconds, 0 to read again right away, -1 if the source is exhausted
+ */
+int source_idle_ms(const source_t *src);
+
+/**
+ * @brief Logs and resets statistics every SOURCE_REPORT_MS
+ *
+ * @param st Statistics
+ * @param name What they are about, e.g. a device
+ * @param spool Spool the source appends to
+ */
+void source_stats_report(source_stats_t *st, const char *name, spool_t *spool);
+
+/**
+ * @brief Closes a source
+ *
+ * @param src Source
+ */
+void source_close(source_t *src);
+
+/**
+ * @brief Opens a replay of a capture file, made of raw 17-byte records as sent on the I2C bus
+ *
+ * @param src Source with cfg set
+ * @return int 0 on success, -1 on failure
+ */
+int replay_source_open(source_t *src);
+
+/**
+ * @brief Opens a deterministic simulation of sim_vehicles vehicles
+ *
+ * @param src Source with cfg set
+ * @return int 0 on success, -1 on failure
+ */
+int sim_source_open(source_t *src);
@@ -0,0 +1,172 @@
+/**
+ * @file spool.h
+ * @author Leah
+ * @brief Persistent message spool between the I2C and ETH processes
+ * @date 2026-10-19
+ * 
+ */
+#pragma once
+
+#include "gps_msg.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPOOL_MAGIC 0x4C505350u        // "SPPL"
+#define SPOOL_CACHE_LINE 64            // Keeps producer and consumer indices apart
+#define SPOOL_ANON "none"              // spool_path for a memory-only spool
+#define SPOOL_SYNC_MS 1000             // Max time a spooled record waits to be written to the file
+
+/**
+ * @brief Spool file header
+ * 
+ * head and tail are free-running record counters: the producer (I2C) only
+ * writes head, the consumer (ETH) only writes tail. A record is visible
+ * to the consumer once head passes it, and its slot is reused once tail
+ * passes it, so a crash of either process never exposes a half-written record.
+ * Record positions double as sequence numbers on the wire; epoch tells the
+ * server when they restarted from 0.
+ * 
+ * waiting is set by the consumer before it sleeps on the wakeup eventfd, and the
+ * producer signals the eventfd only while it's set. As long as the consumer keeps
+ * up, handing a message over costs no syscall, just the writes to the shared mapping.
+ */
+typedef struct
+{
+    uint32_t magic;                    // SPOOL_MAGIC
+    uint32_t msg_len;                  // Record size, MSG_LEN
+    uint32_t capacity;                 // Number of record slots, a power of 2
+    uint32_t epoch;                    // Random, changes whenever the spool is recreated
+    _Atomic uint32_t head __attribute__((aligned(SPOOL_CACHE_LINE)));    // Records written
+    _Atomic uint32_t tail __attribute__((aligned(SPOOL_CACHE_LINE)));    // Records consumed
+    _Atomic uint32_t waiting;          // Consumer is asleep on the eventfd
+    _Atomic uint32_t dropped __attribute__((aligned(SPOOL_CACHE_LINE))); // Records dropped on full spool
+} spool_hdr_t;
+
+typedef struct
+{
+    spool_hdr_t *hdr;                  // Mapped header
+    uint8_t *recs;                     // Mapped record slots
+    size_t map_len;                    // Mapping length
+    uint32_t mask;                     // capacity - 1
+    int wake_fd;                       // eventfd the consumer sleeps on
+    int file_backed;                   // Mapped from a file, not SPOOL_ANON
+    uint32_t synced;                   // Producer: records written to the file by spool_sync()
+    int64_t synced_ms;                 // Producer: monotonic time of the last spool_sync()
+} spool_t;
+
+/**
+ * @brief Opens or creates a spool file and maps it
+ * 
+ * Records left in an existing spool of the same capacity are kept.
+ * Must be called before fork() so both processes share the mapping and the eventfd.
+ * 
+ * @param sp Spool to initialize
+ * @param path Path of the spool file, or SPOOL_ANON for an anonymous shared mapping
+ *             that doesn't survive a restart
+ * @param records Requested capacity, rounded up to a power of 2
+ * @return int 0 on success, -1 on failure
+ */
+int spool_open(spool_t *sp, const char *path, uint32_t records);
+
+/**
+ * @brief Unmaps the spool and closes its eventfd
+ * 
+ * @param sp Spool to close
+ */
+void spool_close(spool_t *sp);
+
+/**
+ * @brief Appends a message. Never blocks; drops the message when the spool is full.
+ * 
+ * Wakes the consumer if it's waiting. Producer side only.
+ * 
+ * @param sp Spool
+ * @param msg Message to append
+ * @return int 0 on success, -1 if the spool is full
+ */
+int spool_push(spool_t *sp, const gps_msg_t *msg);
+
+/**
+ * @brief Writes the records appended since the last call to the spool file
+ * 
+ * Does nothing until SPOOL_SYNC_MS passed since the last write. Otherwise
+ * blocks until the new records and then the header are on disk (msync), a
+ * few milliseconds on eMMC, so a power loss loses at most the records of the
+ * last SPOOL_SYNC_MS instead of everything the kernel hadn't written back.
+ * Producer side only, call it after appending.
+ * 
+ * @param sp Spool
+ */
+void spool_sync(spool_t *sp);
+
+/**
+ * @brief Number of messages waiting to be consumed
+ * 
+ * @param sp Spool
+ * @return uint32_t Number of messages
+ */
+uint32_t spool_count(spool_t *sp);
+
+/**
+ * @brief Waits until more than a number of messages are waiting
+ * 
+ * Returns right away without a syscall when there already are.
+ * Consumer side only.
+ * 
+ * @param sp Spool
+ * @param have Number of messages the caller already knows about
+ * @param timeout_ms Max time to wait, -1 waits forever
+ * @return uint32_t Number of messages waiting, may still be have on timeout
+ */
+uint32_t spool_wait(spool_t *sp, uint32_t have, int timeout_ms);
+
+/**
+ * @brief Announces that the consumer is about to sleep on wake_fd
+ * 
+ * For consumers that poll wake_fd together with other descriptors.
+ * Must be followed by spool_wait_end() after the poll. Consumer side only.
+ * 
+ * @param sp Spool
+ * @param have Number of messages the caller already knows about
+ * @return int 1 if wake_fd should be polled, 0 if more messages are already waiting
+ */
+int spool_wait_begin(spool_t *sp, uint32_t have);
+
+/**
+ * @brief Ends a wait started with spool_wait_begin()
+ * 
+ * @param sp Spool
+ */
+void spool_wait_end(spool_t *sp);
+
+/**
+ * @brief Position of the oldest waiting message
+ * 
+ * Consumer side only.
+ * 
+ * @param sp Spool
+ * @return uint32_t Free-running record position
+ */
+uint32_t spool_tail(spool_t *sp);
+
+/**
+ * @brief Copies a waiting message without consuming it
+ * 
+ * Consumer side only.
+ * 
+ * @param sp Spool
+ * @param offset Position of the message after the oldest waiting one
+ * @param msg Destination
+ */
+void spool_peek(spool_t *sp, uint32_t offset, gps_msg_t *msg);
+
+/**
+ * @brief Consumes the oldest waiting messages, freeing their slots
+ * 
+ * Consumer side only.
+ * 
+ * @param sp Spool
+ * @param n Number of messages to consume
+ */
+void spool_release(spool_t *sp, uint32_t n);
@@ -0,0 +1,99 @@
+/**
+ * @file batch_bench.c
+ * @author Leah
+ * @brief Checks the batch frame encoder against the server's format, and measures its throughput
+ * @date 2026-10-19
+ *
+ */
+#include "batch_codec.h"
+#include "sender.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_VEHICLES 1000            // Vehicles behind the gateway
+#define BENCH_EVENTS (1 << 20)         // Events encoded per round
+#define BENCH_ROUNDS 20                // Encoding rounds
+#define BENCH_LICENSE 10000000         // License ID of the first vehicle
+#define BENCH_LOTS 50                  // Lots STARTs are resolved to
+
+// Events whose encoding is pinned by golden_frame: deltas of both signs, a
+// timestamp going back, the highest license ID and lots of one and two bytes
+static const gps_msg_t golden_msgs[] = {
+    {MSGT_START, 12345678, 1751371200, 32.0853f, 34.7818f},
+    {MSGT_STOP, 12345678, 1751374800, 32.0853f, 34.7818f},
+    {MSGT_START, 12345600, 1751374790, 29.5f, 35.9f},
+    {MSGT_STOP, 4294967295u, 1751371200, 33.3f, 34.2f},
+};
+static const uint32_t golden_lots[] = {7, 0, 300, 0};
+
+// golden_msgs as sequence 1000 onwards, as the server's batch bench
+// (server/Src/batch_bench.cpp) encodes and decodes them
+static const uint8_t golden_frame[] = {
+    0xab, 0x36, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x04, 0x00, 0x04, 0x03, 0x02,
+    0x01, 0x05, 0x9c, 0x85, 0xe3, 0x0b, 0x80, 0xb7, 0x9e, 0x86, 0x0d, 0xb2,
+    0xdd, 0x82, 0xa0, 0x08, 0xa0, 0x82, 0xd9, 0xa0, 0x08, 0x07, 0x02, 0x00,
+    0xa0, 0x38, 0x00, 0x00, 0x05, 0x9b, 0x01, 0x13, 0xb1, 0xdd, 0xa2, 0x01,
+    0x94, 0xe4, 0x23, 0xac, 0x02, 0x02, 0x81, 0x84, 0xe3, 0x0b, 0x8b, 0x38,
+    0xe6, 0xcc, 0xc9, 0x01, 0x99, 0xb3, 0x36,
+};
+
+static uint8_t out[BATCH_HDR_LEN + BATCH_MAX_EVENTS * BATCH_EVENT_MAX_LEN];
+
+int main(void)
+{
+    batch_enc_t e;
+    batch_begin(&e, out, 1000, 0x01020304);
+    for (size_t i = 0; i < sizeof(golden_msgs) / sizeof(golden_msgs[0]); i++)
+        batch_add(&e, &golden_msgs[i], golden_lots[i]);
+    size_t len = batch_finish(&e);
+    if (len != sizeof(golden_frame) || memcmp(out, golden_frame, len) != 0)
+    {
+        fprintf(stderr, "Encoded the golden messages into a frame the server doesn't expect\n");
+        return 1;
+    }
+
+    // START/STOP messages of vehicles around one city, a few per second, as they're spooled
+    gps_msg_t *msgs = malloc(BENCH_EVENTS * sizeof(*msgs));
+    uint32_t *lots = malloc(BENCH_EVENTS * sizeof(*lots));
+    if (!msgs || !lots)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    srand(0);
+    uint32_t now = MIN_UTC;
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++)
+    {
+        now += rand() % 3 == 0;
+        msgs[i].msg_type = rand() % 2 ? MSGT_START : MSGT_STOP;
+        msgs[i].license_id = BENCH_LICENSE + rand() % BENCH_VEHICLES;
+        msgs[i].utc_sec = now;
+        msgs[i].latitude = 32.0263f + (rand() % 1000 - 500) / 10000.0f;
+        msgs[i].longitude = 34.8257f + (rand() % 1000 - 500) / 10000.0f;
+        lots[i] = msgs[i].msg_type == MSGT_START ? 1 + rand() % BENCH_LOTS : 0;
+    }
+
+    uint64_t total = 0;
+    int64_t t0 = monotonic_ms();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (uint32_t i = 0; i < BENCH_EVENTS; i += BATCH_MAX_EVENTS)
+        {
+            batch_begin(&e, out, i, 1);
+            for (uint32_t j = i; j < i + BATCH_MAX_EVENTS; j++)
+                batch_add(&e, &msgs[j], lots[j]);
+            total += batch_finish(&e);
+        }
+    }
+    int64_t elapsed = monotonic_ms() - t0;
+
+    double encoded = (double)BENCH_EVENTS * BENCH_ROUNDS;
+    printf("Golden frame matches the server's\n"
+           "Encoded %.0f events of %d vehicles in %lld ms: %.0f events/sec, %.2f bytes/event\n",
+           encoded, BENCH_VEHICLES, (long long)elapsed, elapsed > 0 ? encoded * 1000 / elapsed : 0.0,
+           total / encoded);
+    free(msgs);
+    free(lots);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file batch_codec.c
+ * @author Leah
+ * @brief Delta-encoded batch frames, for gateways on constrained uplinks
+ * @date 2026-10-19
+ *
+ */
+#include "batch_codec.h"
+#include "sender.h"
+#include <string.h>
+
+/**
+ * @brief Appends a varint: 7 bits per byte, least significant first, top bit set on all but the last
+ *
+ * @param p Output
+ * @param value Value
+ * @return uint8_t* End of the varint
+ */
+static uint8_t *put_varint(uint8_t *p, uint32_t value);
+
+/**
+ * @brief Maps a signed difference to an unsigned value, small for small differences of either sign
+ */
+static uint32_t zigzag(uint32_t delta);
+
+/**
+ * @brief Bit pattern of a float
+ */
+static uint32_t float_bits(float f);
+
+void batch_begin(batch_enc_t *e, uint8_t *out, uint32_t seq, uint32_t lots_version)
+{
+    memset(e, 0, sizeof(*e));
+    e->frame = out;
+    e->p = out + BATCH_HDR_LEN;
+
+    out[0] = FRAME_BATCH;
+    memcpy(out + 3, &seq, sizeof(seq));
+    memcpy(out + 9, &lots_version, sizeof(lots_version));
+}
+
+void batch_add(batch_enc_t *e, const gps_msg_t *msg, uint32_t lot)
+{
+    uint32_t lat = float_bits(msg->latitude);
+    uint32_t lon = float_bits(msg->longitude);
+
+    *e->p++ = (msg->msg_type & 3) | (lot ? 4 : 0);
+    e->p = put_varint(e->p, zigzag(msg->license_id - e->license));
+    e->p = put_varint(e->p, zigzag(msg->utc_sec - e->utc));
+    e->p = put_varint(e->p, zigzag(lat - e->lat));
+    e->p = put_varint(e->p, zigzag(lon - e->lon));
+    if (lot)
+        e->p = put_varint(e->p, lot);
+
+    e->license = msg->license_id;
+    e->utc = msg->utc_sec;
+    e->lat = lat;
+    e->lon = lon;
+    e->count++;
+}
+
+size_t batch_finish(batch_enc_t *e)
+{
+    uint16_t body = (uint16_t)(e->p - e->frame - BATCH_HDR_LEN);
+    memcpy(e->frame + 1, &body, sizeof(body));
+    memcpy(e->frame + 7, &e->count, sizeof(e->count));
+    return (size_t)(e->p - e->frame);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
@@ -11,11 +11,44 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 #include <syslog.h>
+#include <unistd.h>
 
-int load_config(Config *cfg)
+#define MACHINE_ID_PATH "/etc/machine-id"
+
+// Keeps the running value of a setting that can't change without a restart
+#define KEEP(changed, field, key)                                                       \
+    if (changed)                                                                        \
+    {                                                                                   \
+        syslog(LOG_WARNING, "[CONFIG] " key " can't change without a restart, ignored"); \
+        memcpy(&next.field, &cfg->field, sizeof(next.field));                           \
+    }
+#define KEEP_INT(field, key) KEEP(next.field != cfg->field, field, key)
+#define KEEP_STR(field, key) KEEP(strcmp(next.field, cfg->field) != 0, field, key)
+
+static const char *reload_path = CONFIG_PATH; // Config file reload_config() reads
+static volatile sig_atomic_t reload_flag;    // SIGHUP handled since the last config_reload_requested()
+static sigset_t hup_set;                     // Just SIGHUP
+static sigset_t wait_mask;                   // Mask of config_wait_mask()
+
+/**
+ * @brief SIGHUP handler, records the reload request
+ *
+ * @param sig Signal number
+ */
+static void on_sighup(int sig);
+
+/**
+ * @brief Derives a default gateway ID from the machine ID
+ * 
+ * @return unsigned int Gateway ID
+ */
+static unsigned int default_gateway_id(void);
+
+int load_config(Config *cfg, const char *path)
 {
-    FILE *fd = fopen(CONFIG_PATH, "r");
+    FILE *fd = fopen(path, "r");
     if (!fd)
     {
         perror("fopen config");
@@ -30,6 +63,28 @@ int load_config(Config *cfg)
     strcpy(cfg->log_path, DEFAULT_LOG_PATH);
     strcpy(cfg->service_name, DEFAULT_SERVICE_NAME);
     strcpy(cfg->service_path, DEFAULT_SERVICE_PATH);
+    strcpy(cfg->spool_path, DEFAULT_SPOOL_PATH);
+    cfg->spool_size = DEFAULT_SPOOL_SIZE;
+    cfg->batch_max = DEFAULT_BATCH_MAX;
+    cfg->batch_delay_ms = DEFAULT_BATCH_DELAY_MS;
+    cfg->mode = DEFAULT_MODE;
+    cfg->i2c_poll_ms = DEFAULT_I2C_POLL_MS;
+    cfg->i2c_batch = DEFAULT_I2C_BATCH;
+    cfg->i2c_target_count = 0;
+    cfg->source = DEFAULT_SOURCE;
+    cfg->replay_path[0] = '\0';
+    cfg->source_realtime = 1;
+    cfg->sim_vehicles = DEFAULT_SIM_VEHICLES;
+    cfg->log_level = DEFAULT_LOG_LEVEL;
+    cfg->edge_lots = DEFAULT_EDGE_LOTS;
+    strcpy(cfg->lots_path, DEFAULT_LOTS_PATH);
+    strcpy(cfg->metrics_path, DEFAULT_METRICS_PATH);
+    cfg->compress = DEFAULT_COMPRESS;
+    cfg->server_count = 0;
+    cfg->failover_ms = DEFAULT_FAILOVER_MS;
+    cfg->connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS;
+    cfg->gateway_id = default_gateway_id();
+    cfg->ack_window = DEFAULT_ACK_WINDOW;
 
     char line[256];
     while (fgets(line, sizeof(line), fd))
@@ -68,10 +123,54 @@ int load_config(Config *cfg)
                     cfg->i2c_addr = addr;
                 }
             }
+            else if (strcmp(key, "i2c_target") == 0)
+            {
+                // <bus>:<address>, one line per STM32
+                char *sep = strrchr(val, ':');
+                int addr = sep ? (int)strtol(sep + 1, NULL, 0) : -1;
+                if (!sep || sep == val || (size_t)(sep - val) >= sizeof(cfg->i2c_targets[0].bus)
+                    || addr < MIN_I2C_ADDR || addr > MAX_I2C_ADDR)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid i2c target: %s. Skipping", val);
+                }
+                else if (cfg->i2c_target_count == MAX_I2C_TARGETS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] more than %d i2c targets. Skipping %s", MAX_I2C_TARGETS, val);
+                }
+                else
+                {
+                    i2c_target_t *t = &cfg->i2c_targets[cfg->i2c_target_count++];
+                    memcpy(t->bus, val, sep - val);
+                    t->bus[sep - val] = '\0';
+                    t->addr = addr;
+                }
+            }
             else if (strcmp(key, "server_ip") == 0)
             {
                 strncpy(cfg->server_ip, val, sizeof(cfg->server_ip));
             }
+            else if (strcmp(key, "server") == 0)
+            {
+                // <ip>:<port>, one line per server
+                char *sep = strrchr(val, ':');
+                int port = sep ? atoi(sep + 1) : -1;
+                if (!sep || sep == val || (size_t)(sep - val) >= sizeof(cfg->servers[0].ip)
+                    || port <= MIN_PORT || port > MAX_PORT)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid server: %s. Skipping", val);
+                }
+                else if (cfg->server_count == MAX_SERVERS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] more than %d servers. Skipping %s", MAX_SERVERS, val);
+                }
+                else
+                {
+                    server_addr_t *srv = &cfg->servers[cfg->server_count++];
+                    memcpy(srv->ip, val, sep - val);
+                    srv->ip[sep - val] = '\0';
+                    srv->port = port;
+                }
+            }
             else if (strcmp(key, "server_port") == 0)
             {
                 int port = atoi(val);
@@ -98,9 +197,371 @@ int load_config(Config *cfg)
             {
                 strncpy(cfg->service_path, val, sizeof(cfg->service_path));
             }
+            else if (strcmp(key, "spool_path") == 0)
+            {
+                strncpy(cfg->spool_path, val, sizeof(cfg->spool_path));
+            }
+            else if (strcmp(key, "spool_size") == 0)
+            {
+                int size = atoi(val);
+                if (size < MIN_SPOOL_SIZE || size > MAX_SPOOL_SIZE)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid spool size: %d. Using default: %d",
+                           size, DEFAULT_SPOOL_SIZE);
+                }
+                else
+                {
+                    cfg->spool_size = size;
+                }
+            }
+            else if (strcmp(key, "batch_max") == 0)
+            {
+                int max = atoi(val);
+                if (max < 1 || max > MAX_BATCH_MAX)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid batch max: %d. Using default: %d",
+                           max, DEFAULT_BATCH_MAX);
+                }
+                else
+                {
+                    cfg->batch_max = max;
+                }
+            }
+            else if (strcmp(key, "batch_delay_ms") == 0)
+            {
+                int delay = atoi(val);
+                if (delay < 0 || delay > MAX_BATCH_DELAY_MS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid batch delay: %d. Using default: %d",
+                           delay, DEFAULT_BATCH_DELAY_MS);
+                }
+                else
+                {
+                    cfg->batch_delay_ms = delay;
+                }
+            }
+            else if (strcmp(key, "mode") == 0)
+            {
+                if (strcmp(val, "fork") == 0)
+                {
+                    cfg->mode = MODE_FORK;
+                }
+                else if (strcmp(val, "single") == 0)
+                {
+                    cfg->mode = MODE_SINGLE;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid mode: %s. Using default: fork", val);
+                }
+            }
+            else if (strcmp(key, "i2c_poll_ms") == 0)
+            {
+                int poll_ms = atoi(val);
+                if (poll_ms < MIN_I2C_POLL_MS || poll_ms > MAX_I2C_POLL_MS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid i2c poll period: %d. Using default: %d",
+                           poll_ms, DEFAULT_I2C_POLL_MS);
+                }
+                else
+                {
+                    cfg->i2c_poll_ms = poll_ms;
+                }
+            }
+            else if (strcmp(key, "i2c_batch") == 0)
+            {
+                int batch = atoi(val);
+                if (batch < 1 || batch > MAX_I2C_BATCH)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid i2c batch: %d. Using default: %d",
+                           batch, DEFAULT_I2C_BATCH);
+                }
+                else
+                {
+                    cfg->i2c_batch = batch;
+                }
+            }
+            else if (strcmp(key, "source") == 0)
+            {
+                if (strcmp(val, "i2c") == 0)
+                {
+                    cfg->source = SOURCE_I2C;
+                }
+                else if (strcmp(val, "replay") == 0)
+                {
+                    cfg->source = SOURCE_REPLAY;
+                }
+                else if (strcmp(val, "sim") == 0)
+                {
+                    cfg->source = SOURCE_SIM;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid source: %s. Using default: i2c", val);
+                }
+            }
+            else if (strcmp(key, "replay_path") == 0)
+            {
+                strncpy(cfg->replay_path, val, sizeof(cfg->replay_path));
+            }
+            else if (strcmp(key, "source_speed") == 0)
+            {
+                if (strcmp(val, "1x") == 0)
+                {
+                    cfg->source_realtime = 1;
+                }
+                else if (strcmp(val, "max") == 0)
+                {
+                    cfg->source_realtime = 0;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid source speed: %s. Using default: 1x", val);
+                }
+            }
+            else if (strcmp(key, "sim_vehicles") == 0)
+            {
+                int vehicles = atoi(val);
+                if (vehicles < 1 || vehicles > MAX_SIM_VEHICLES)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid sim vehicles: %d. Using default: %d",
+                           vehicles, DEFAULT_SIM_VEHICLES);
+                }
+                else
+                {
+                    cfg->sim_vehicles = vehicles;
+                }
+            }
+            else if (strcmp(key, "log_level") == 0)
+            {
+                if (strcmp(val, "err") == 0)
+                {
+                    cfg->log_level = LOG_ERR;
+                }
+                else if (strcmp(val, "warning") == 0)
+                {
+                    cfg->log_level = LOG_WARNING;
+                }
+                else if (strcmp(val, "info") == 0)
+                {
+                    cfg->log_level = LOG_INFO;
+                }
+                else if (strcmp(val, "debug") == 0)
+                {
+                    cfg->log_level = LOG_DEBUG;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid log level: %s. Using default: info", val);
+                }
+            }
+            else if (strcmp(key, "connect_timeout_ms") == 0)
+            {
+                int timeout = atoi(val);
+                if (timeout < MIN_CONNECT_TIMEOUT_MS || timeout > MAX_CONNECT_TIMEOUT_MS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid connect timeout: %d. Using default: %d",
+                           timeout, DEFAULT_CONNECT_TIMEOUT_MS);
+                }
+                else
+                {
+                    cfg->connect_timeout_ms = timeout;
+                }
+            }
+            else if (strcmp(key, "gateway_id") == 0)
+            {
+                cfg->gateway_id = (unsigned int)strtoul(val, NULL, 0);
+            }
+            else if (strcmp(key, "ack_window") == 0)
+            {
+                int window = atoi(val);
+                if (window < 1 || window > MAX_ACK_WINDOW)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid ack window: %d. Using default: %d",
+                           window, DEFAULT_ACK_WINDOW);
+                }
+                else
+                {
+                    cfg->ack_window = window;
+                }
+            }
+            else if (strcmp(key, "edge_lots") == 0)
+            {
+                if (strcmp(val, "on") == 0)
+                {
+                    cfg->edge_lots = 1;
+                }
+                else if (strcmp(val, "off") == 0)
+                {
+                    cfg->edge_lots = 0;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid edge lots: %s. Using default: on", val);
+                }
+            }
+            else if (strcmp(key, "lots_path") == 0)
+            {
+                strncpy(cfg->lots_path, val, sizeof(cfg->lots_path));
+            }
+            else if (strcmp(key, "metrics_path") == 0)
+            {
+                strncpy(cfg->metrics_path, val, sizeof(cfg->metrics_path));
+            }
+            else if (strcmp(key, "compress") == 0)
+            {
+                if (strcmp(val, "on") == 0)
+                {
+                    cfg->compress = 1;
+                }
+                else if (strcmp(val, "off") == 0)
+                {
+                    cfg->compress = 0;
+                }
+                else
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid compress: %s. Using default: off", val);
+                }
+            }
+            else if (strcmp(key, "failover_ms") == 0)
+            {
+                int failover = atoi(val);
+                if (failover < MIN_FAILOVER_MS || failover > MAX_FAILOVER_MS)
+                {
+                    syslog(LOG_ERR, "[CONFIG] invalid failover time: %d. Using default: %d",
+                           failover, DEFAULT_FAILOVER_MS);
+                }
+                else
+                {
+                    cfg->failover_ms = failover;
+                }
+            }
         }
     }
 
     fclose(fd);
+
+    if (cfg->i2c_target_count == 0)
+    {
+        snprintf(cfg->i2c_targets[0].bus, sizeof(cfg->i2c_targets[0].bus), "%s", cfg->i2c_bus);
+        cfg->i2c_targets[0].addr = cfg->i2c_addr;
+        cfg->i2c_target_count = 1;
+    }
+
+    if (cfg->server_count == 0)
+    {
+        snprintf(cfg->servers[0].ip, sizeof(cfg->servers[0].ip), "%s", cfg->server_ip);
+        cfg->servers[0].port = cfg->server_port;
+        cfg->server_count = 1;
+    }
+
+    if (cfg->source == SOURCE_REPLAY && cfg->replay_path[0] == '\0')
+    {
+        fprintf(stderr, "source=replay needs a replay_path\n");
+        return -1;
+    }
+    return 0;
+}
+
+int reload_config(Config *cfg)
+{
+    Config next;
+    if (load_config(&next, reload_path) != 0)
+    {
+        syslog(LOG_ERR, "[CONFIG] Failed to reload %s, keeping the running config", reload_path);
+        return -1;
+    }
+
+    KEEP_STR(log_path, "log_path");
+    KEEP_STR(service_name, "service_name");
+    KEEP_STR(service_path, "service_path");
+    KEEP_STR(spool_path, "spool_path");
+    KEEP_INT(spool_size, "spool_size");
+    KEEP_INT(mode, "mode");
+    KEEP_INT(gateway_id, "gateway_id");
+    KEEP_INT(source, "source");
+    KEEP_STR(replay_path, "replay_path");
+    KEEP_INT(source_realtime, "source_speed");
+    KEEP_INT(sim_vehicles, "sim_vehicles");
+    KEEP_INT(edge_lots, "edge_lots");
+    KEEP_STR(lots_path, "lots_path");
+    KEEP_STR(metrics_path, "metrics_path");
+
+    *cfg = next;
+    setlogmask(LOG_UPTO(cfg->log_level));
+    syslog(LOG_INFO, "[CONFIG] Reloaded %s", reload_path);
     return 0;
-}
\ No newline at end of file
+}
+
+void config_catch_reload(const char *path)
+{
+    reload_path = path;
+    sigemptyset(&hup_set);
+    sigaddset(&hup_set, SIGHUP);
+
+    // No SA_RESTART, so that waits return to take the request
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sighup;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+}
+
+void config_block_reload(void)
+{
+    pthread_sigmask(SIG_BLOCK, &hup_set, &wait_mask);
+    sigdelset(&wait_mask, SIGHUP);
+}
+
+const sigset_t *config_wait_mask(void)
+{
+    return &wait_mask;
+}
+
+int config_reload_requested(void)
+{
+    // Blocked SIGHUPs stay pending until taken here
+    sigset_t pending;
+    int sig;
+    if (sigpending(&pending) == 0 && sigismember(&pending, SIGHUP) && sigwait(&hup_set, &sig) == 0)
+        reload_flag = 1;
+
+    int requested = reload_flag;
+    reload_flag = 0;
+    return requested;
+}
+
+void config_wait_reload(void)
+{
+    // Handled before SIGHUP was blocked
+    int sig;
+    while (!config_reload_requested() && sigwait(&hup_set, &sig) != 0)
+        ;
+}
+
+static void on_sighup(int sig)
+{
+    (void)sig;
+    reload_flag = 1;
+}
+
+static unsigned int default_gateway_id(void)
+{
+    char id[64] = {0};
+    FILE *fd = fopen(MACHINE_ID_PATH, "r");
+    if (!fd || !fgets(id, sizeof(id), fd))
+    {
+        if (fd) fclose(fd);
+        return (unsigned int)gethostid();
+    }
+    fclose(fd);
+
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (const char *c = id; *c && *c != '\n'; c++)
+    {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -5,120 +5,108 @@
  * @date 2025-07-15
  * 
  */
+#define _GNU_SOURCE // ppoll()
 #include "eth_process.h"
-#include "gps_msg.h"
+#include "metrics.h"
+#include "router.h"
 #include <stdint.h>
-#include <unistd.h>
-#include <string.h>
+#include <stdlib.h>
 #include <errno.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
 #include <syslog.h>
-#include <time.h>
-
-/**
- * Delays are implemented here in order to avoid clogging
- * the syslog journal with repeating error messages.
- */
-#define CONN_DELAY 2        // Delay for try agin after connection error
-#define WRITE_DELAY 1       // Delay for try again after write error
 
-/**
- * @brief Deals with connection to the server
- * 
- * @param ip Server's IP
- * @param port TCP port
- * @return int sockfd if successful, -1 otherwise
- */
-static int connect_to_server(const char *ip, int port);
-
-void run_eth_process(int read_fd, const Config *cfg)
+void run_eth_process(spool_t *spool, Config *cfg)
 {
-    int sockfd = -1;
+    config_block_reload();
+
+    router_t rt;
+    if (router_init(&rt, spool, cfg) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    int metrics_fd = metrics_listen(cfg->metrics_path);
 
     while (1)
     {
-        // Read from IPC pipe
-        gps_msg_t msg;
-        ssize_t rd = read(read_fd, &msg, sizeof(msg));
-        if (rd < 0)
+        // Disconnected servers are left out of the poll, the spool buffers
+        // whatever the I2C process reads until they're back or failed over
+        router_route(&rt);
+        router_flush(&rt);
+
+        // Wait for connections, acks, socket space, metrics clients or new messages, whichever comes first
+        struct pollfd pfd[MAX_SERVERS + 2];
+        sender_t *polled[MAX_SERVERS];
+        int nfds = 0;
+        for (int i = 0; i < rt.count; i++)
         {
-            syslog(LOG_ERR, "[ETH] Read error: %s\n", strerror(errno));
-            continue;
+            sender_t *s = &rt.links[i];
+            if (s->state == SENDER_DOWN)
+                continue;
+            pfd[nfds].fd = s->fd;
+            pfd[nfds].events = s->state == SENDER_CONNECTING ? POLLOUT
+                               : POLLIN | (s->blocked ? POLLOUT : 0);
+            polled[nfds++] = s;
         }
 
-        if (rd != sizeof(msg))
+        int metrics_at = nfds;
+        if (metrics_fd >= 0)
         {
-            syslog(LOG_WARNING, "[ETH] Short read: %zd bytes, expected %zu\n", rd, sizeof(msg));
-            continue;
+            pfd[nfds].fd = metrics_fd;
+            pfd[nfds++].events = POLLIN;
         }
 
-        const time_t msg_time = msg.utc_sec;
-        syslog(LOG_INFO, "[ETH] msg_type=%s(%u), license=%08u, lat=%.6f, lon=%.6f, %s",
-               type_str(msg.msg_type),
-               msg.msg_type,
-               msg.license_id,
-               msg.latitude,
-               msg.longitude,
-               asctime(gmtime(&msg_time)));
-
-        // Send message to server with infinite retries,
-        // reconnect if needed
-        while (1)
+        uint32_t have;
+        int waiting = router_wants_messages(&rt, &have);
+        if (waiting)
         {
-            if (sockfd < 0)
+            if (!spool_wait_begin(spool, have))
             {
-                sockfd = connect_to_server(cfg->server_ip, cfg->server_port);
-                if (sockfd < 0)
-                {
-                    syslog(LOG_WARNING, "[ETH] Retry in %d seconds...\n", CONN_DELAY);
-                    sleep(CONN_DELAY);
-                }
+                // Messages arrived since the flush
+                spool_wait_end(spool);
+                continue;
             }
-
-            ssize_t wr = write(sockfd, &msg, sizeof(msg));
-            if (wr == sizeof(msg))
-                break; // success
-
-            syslog(LOG_ERR, "[ETH] Write failed: %s. Reconnecting...\n", strerror(errno));
-            close(sockfd);
-            sockfd = -1;
-            sleep(WRITE_DELAY);
-
+            pfd[nfds].fd = spool->wake_fd;
+            pfd[nfds].events = POLLIN;
         }
-    }
 
-    if (sockfd >= 0) close(sockfd); // Shouldn't reach here
-}
+        // SIGHUP only gets through while waiting, so a reload never lands mid-frame
+        int timeout = router_timeout_ms(&rt);
+        struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        int ready = ppoll(pfd, nfds + waiting, timeout < 0 ? NULL : &ts, config_wait_mask());
+        int err = errno;    // spool_wait_end() reads the eventfd, which may set it
+        if (waiting)
+            spool_wait_end(spool);
 
-static int connect_to_server(const char *ip, int port)
-{
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
-    {
-        syslog(LOG_ERR, "[ETH] socket: %s", strerror(errno));
-        return -1;
-    }
+        if (ready < 0)
+        {
+            if (err != EINTR)
+                syslog(LOG_ERR, "[ETH] poll error: %s\n", strerror(err));
+            else if (config_reload_requested() && reload_config(cfg) == 0)
+            {
+                if (router_reload(&rt) < 0)
+                    exit(EXIT_FAILURE);
+            }
+            continue;
+        }
 
-    struct sockaddr_in serv;
-    memset(&serv, 0, sizeof(serv));
-    serv.sin_family = AF_INET;
-    serv.sin_port = htons(port);
+        if (metrics_fd >= 0 && pfd[metrics_at].revents)
+            metrics_serve(metrics_fd, &rt, spool);
 
-    if (inet_pton(AF_INET, ip, &serv.sin_addr) <= 0)
-    {
-        syslog(LOG_ERR, "[ETH] Invalid IP: %s\n", ip);
-        close(sockfd);
-        return -1;
-    }
-
-    if (connect(sockfd, (struct sockaddr*)&serv, sizeof(serv)) < 0)
-    {
-        syslog(LOG_ERR, "[ETH] connect: %s", strerror(errno));
-        close(sockfd);
-        return -1;
+        for (int i = 0; i < metrics_at; i++)
+        {
+            sender_t *s = polled[i];
+            if (s->state == SENDER_CONNECTING)
+            {
+                if (pfd[i].revents)
+                    sender_finish_connect(s);
+            }
+            else if (pfd[i].revents & (POLLIN | POLLERR | POLLHUP))
+            {
+                sender_receive(s);
+            }
+        }
+        router_on_timeout(&rt);
     }
-
-    syslog(LOG_INFO, "[ETH] Connected to %s:%d\n", ip, port);
-    return sockfd;
 }
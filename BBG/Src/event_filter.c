@@ -0,0 +1,61 @@
+/**
+ * @file event_filter.c
+ * @author Leah
+ * @brief Per-vehicle START/STOP state, to drop repeated events before they're spooled
+ * @date 2026-10-19
+ *
+ */
+#include "event_filter.h"
+
+/**
+ * @brief Bucket of a license ID
+ *
+ * Simulated and real license IDs are often consecutive, so they're spread
+ * by a multiplicative hash rather than taken modulo.
+ *
+ * @param f Filter
+ * @param license_id License ID
+ * @return filter_entry_t* First entry of the bucket
+ */
+static inline filter_entry_t *bucket(const event_filter_t *f, uint32_t license_id)
+{
+    return (filter_entry_t *)f->entries[(license_id * 2654435761u) >> (32 - FILTER_BUCKET_BITS)];
+}
+
+int event_filter_check(const event_filter_t *f, const gps_msg_t *msg)
+{
+    const filter_entry_t *b = bucket(f, msg->license_id);
+    for (int i = 0; i < FILTER_WAYS; i++)
+    {
+        if (b[i].license_id != msg->license_id)
+            continue;
+
+        if (msg->utc_sec == b[i].utc_sec && msg->msg_type == b[i].msg_type)
+            return FILTER_DUPLICATE;
+        if (msg->utc_sec < b[i].utc_sec)
+            return FILTER_OUT_OF_ORDER;
+        return msg->msg_type == b[i].msg_type ? FILTER_UNEXPECTED : FILTER_PASS;
+    }
+    return FILTER_PASS;
+}
+
+void event_filter_commit(event_filter_t *f, const gps_msg_t *msg)
+{
+    filter_entry_t *b = bucket(f, msg->license_id);
+    filter_entry_t *e = &b[0];
+    for (int i = 0; i < FILTER_WAYS; i++)
+    {
+        if (b[i].license_id == msg->license_id)
+        {
+            e = &b[i];
+            break;
+        }
+        // Free entries have time 0, so they're taken before any vehicle is forgotten
+        if (b[i].utc_sec < e->utc_sec)
+            e = &b[i];
+    }
+
+    e->license_id = msg->license_id;
+    e->utc_sec = msg->utc_sec;
+    e->msg_type = msg->msg_type;
+}
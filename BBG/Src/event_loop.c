@@ -0,0 +1,341 @@
+/**
+ * @file event_loop.c
+ * @author Leah
+ * @brief Single process event loop for parksys, handling both I2C and ETH
+ * @date 2026-10-19
+ * 
+ */
+#include "event_loop.h"
+#include "metrics.h"
+#include "router.h"
+#include "source.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+
+#define MAX_EVENTS (8 + MAX_SERVERS)
+#define TICK_FRAMES 4       // Max frames read from the source per poll tick
+
+#define EV_POLL_TIMER 0     // epoll tag of the source polling timer
+#define EV_ROUTER_TIMER 1   // epoll tag of the senders' reconnection and deadline timer
+#define EV_METRICS 2        // epoll tag of the metrics socket
+#define EV_SOCKET 3         // epoll tag of the first server's socket, the others follow
+
+typedef struct
+{
+    Config *cfg;
+    spool_t *spool;
+    router_t rt;
+    int epfd;
+    source_t src;
+    int poll_tfd;                      // Periodic, polls the source
+    int router_tfd;                    // One-shot, fires at router_deadline_ms()
+    int metrics_fd;                    // Listening metrics socket, -1 if none
+    int64_t router_at;                 // Deadline router_tfd is armed for, -1 if disarmed
+    int sock_fd[MAX_SERVERS];          // Socket of each sender registered in the epoll set, -1 if none
+    uint32_t sock_events[MAX_SERVERS]; // Events each socket is registered for
+} loop_t;
+
+/**
+ * @brief Creates a timerfd and adds it to the loop
+ *
+ * @param epfd epoll instance
+ * @param tag epoll tag of the timer
+ * @return int timerfd, -1 on failure
+ */
+static int add_timer(int epfd, uint64_t tag);
+
+/**
+ * @brief Reads up to TICK_FRAMES frames from the source, then sends their messages
+ *
+ * @param l Loop
+ */
+static void on_poll_timer(loop_t *l);
+
+/**
+ * @brief Handles readiness of a server socket
+ *
+ * @param l Loop
+ * @param link Index of the server
+ * @param events epoll events
+ */
+static void on_socket(loop_t *l, int link, uint32_t events);
+
+/**
+ * @brief Registers the senders' sockets and arms the timer for what their states need
+ *
+ * Called after every event, since any of them may change a sender's state.
+ *
+ * @param l Loop
+ */
+static void sync_senders(loop_t *l);
+
+/**
+ * @brief Sets the period of the source polling timer to i2c_poll_ms
+ *
+ * @param l Loop
+ */
+static void arm_poll_timer(loop_t *l);
+
+/**
+ * @brief Reloads the config, and applies it to the source, the timers and the senders
+ *
+ * @param l Loop
+ */
+static void reload(loop_t *l);
+
+void run_event_loop(spool_t *spool, Config *cfg)
+{
+    config_block_reload();
+
+    loop_t l;
+    memset(&l, 0, sizeof(l));
+    l.cfg = cfg;
+    l.spool = spool;
+    l.router_at = -1;
+    for (int i = 0; i < MAX_SERVERS; i++)
+        l.sock_fd[i] = -1;
+    if (router_init(&l.rt, spool, cfg) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (source_open(&l.src, cfg) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    l.epfd = epoll_create1(0);
+    if (l.epfd < 0)
+    {
+        syslog(LOG_ERR, "[LOOP] epoll_create1: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    l.poll_tfd = add_timer(l.epfd, EV_POLL_TIMER);
+    l.router_tfd = add_timer(l.epfd, EV_ROUTER_TIMER);
+    if (l.poll_tfd < 0 || l.router_tfd < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    arm_poll_timer(&l);
+
+    l.metrics_fd = metrics_listen(cfg->metrics_path);
+    if (l.metrics_fd >= 0)
+    {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EV_METRICS };
+        if (epoll_ctl(l.epfd, EPOLL_CTL_ADD, l.metrics_fd, &ev) < 0)
+            syslog(LOG_ERR, "[LOOP] epoll_ctl metrics: %s", strerror(errno));
+    }
+
+    syslog(LOG_INFO, "[LOOP] Single process mode, polling the source every %d ms\n", cfg->i2c_poll_ms);
+
+    // Messages recovered from the spool go out as soon as the connections are up
+    router_route(&l.rt);
+    for (int i = 0; i < l.rt.count; i++)
+        sender_connect(&l.rt.links[i]);
+    router_flush(&l.rt);
+    sync_senders(&l);
+
+    while (1)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        // SIGHUP only gets through while waiting, so a reload never lands mid-event
+        int n = epoll_pwait(l.epfd, events, MAX_EVENTS, -1, config_wait_mask());
+        if (n < 0)
+        {
+            if (errno != EINTR)
+                syslog(LOG_ERR, "[LOOP] epoll_wait: %s", strerror(errno));
+            else if (config_reload_requested())
+                reload(&l);
+            continue;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t expirations;
+            uint64_t tag = events[i].data.u64;
+            if (tag == EV_POLL_TIMER)
+            {
+                if (read(l.poll_tfd, &expirations, sizeof(expirations)) > 0)
+                    on_poll_timer(&l);
+            }
+            else if (tag == EV_ROUTER_TIMER)
+            {
+                if (read(l.router_tfd, &expirations, sizeof(expirations)) > 0)
+                {
+                    router_on_timeout(&l.rt);
+                    router_flush(&l.rt);
+                }
+            }
+            else if (tag == EV_METRICS)
+            {
+                metrics_serve(l.metrics_fd, &l.rt, l.spool);
+            }
+            else
+            {
+                on_socket(&l, (int)(tag - EV_SOCKET), events[i].events);
+            }
+            sync_senders(&l);
+        }
+    }
+}
+
+static int add_timer(int epfd, uint64_t tag)
+{
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (tfd < 0)
+    {
+        syslog(LOG_ERR, "[LOOP] timerfd_create: %s", strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = tag };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+    {
+        syslog(LOG_ERR, "[LOOP] epoll_ctl timer: %s", strerror(errno));
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+static void on_poll_timer(loop_t *l)
+{
+    // Frames that aren't full mean nothing more is queued or due
+    for (int i = 0; i < TICK_FRAMES; i++)
+    {
+        int n = source_read(&l->src, l->spool);
+        if (n < 0 || !l->src.more)
+            break;
+    }
+
+    // Routed on every tick, like the ETH process does, so messages spooled while
+    // every window was full or the servers were down aren't left behind
+    router_route(&l->rt);
+    router_flush(&l->rt);
+}
+
+static void on_socket(loop_t *l, int link, uint32_t events)
+{
+    sender_t *s = &l->rt.links[link];
+
+    // Stale event from the same epoll_wait() batch, for a connection that failed meanwhile
+    if (s->state == SENDER_DOWN)
+        return;
+
+    // A server that's back may take its vehicles over again
+    if (s->state == SENDER_CONNECTING)
+    {
+        if (sender_finish_connect(s) == 0)
+        {
+            router_route(&l->rt);
+            sender_flush(s);
+        }
+        return;
+    }
+
+    // Acks may open the window, so route and flush after them too
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && sender_receive(s) < 0)
+        return;
+
+    router_route(&l->rt);
+    sender_flush(s);
+}
+
+static void sync_senders(loop_t *l)
+{
+    for (int i = 0; i < l->rt.count; i++)
+    {
+        sender_t *s = &l->rt.links[i];
+
+        // A failed connection's socket was closed, which removed it from the epoll set
+        if (s->state == SENDER_DOWN)
+        {
+            l->sock_fd[i] = -1;
+            l->sock_events[i] = 0;
+            continue;
+        }
+
+        uint32_t want = EPOLLOUT;
+        if (s->state == SENDER_UP)
+            want = EPOLLIN | EPOLLRDHUP | (s->blocked ? EPOLLOUT : 0);
+
+        if (l->sock_fd[i] != s->fd || want != l->sock_events[i])
+        {
+            struct epoll_event ev = { .events = want, .data.u64 = EV_SOCKET + (uint64_t)i };
+            int op = l->sock_fd[i] == s->fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            if (epoll_ctl(l->epfd, op, s->fd, &ev) < 0)
+            {
+                syslog(LOG_ERR, "[LOOP] epoll_ctl socket: %s", strerror(errno));
+            }
+            else
+            {
+                l->sock_fd[i] = s->fd;
+                l->sock_events[i] = want;
+            }
+        }
+    }
+
+    // Re-armed only when the deadline moves, so frequent events can't keep postponing it.
+    // An absolute deadline that already passed fires right away.
+    int64_t at = router_deadline_ms(&l->rt);
+    if (at == l->router_at)
+        return;
+    l->router_at = at;
+
+    struct itimerspec once = { .it_interval = { 0, 0 }, .it_value = { 0, 0 } };
+    if (at >= 0)
+    {
+        once.it_value.tv_sec = at / 1000;
+        once.it_value.tv_nsec = (at % 1000) * 1000000L;
+    }
+    timerfd_settime(l->router_tfd, TFD_TIMER_ABSTIME, &once, NULL);
+}
+
+static void arm_poll_timer(loop_t *l)
+{
+    int ms = l->cfg->i2c_poll_ms;
+    struct itimerspec period = {
+        .it_interval = { ms / 1000, (ms % 1000) * 1000000L },
+        .it_value = { ms / 1000, (ms % 1000) * 1000000L },
+    };
+    timerfd_settime(l->poll_tfd, 0, &period, NULL);
+}
+
+static void reload(loop_t *l)
+{
+    Config old = *l->cfg;
+    if (reload_config(l->cfg) < 0)
+        return;
+
+    if (source_reload(&l->src, l->cfg, &old) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (l->cfg->i2c_poll_ms != old.i2c_poll_ms)
+        arm_poll_timer(l);
+
+    // Senders may move between links, so their sockets are registered anew
+    for (int i = 0; i < l->rt.count; i++)
+    {
+        if (l->sock_fd[i] >= 0)
+            epoll_ctl(l->epfd, EPOLL_CTL_DEL, l->sock_fd[i], NULL);
+        l->sock_fd[i] = -1;
+        l->sock_events[i] = 0;
+    }
+    if (router_reload(&l->rt) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    router_route(&l->rt);
+    router_flush(&l->rt);
+    sync_senders(l);
+}
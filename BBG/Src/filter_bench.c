@@ -0,0 +1,135 @@
+/**
+ * @file filter_bench.c
+ * @author Leah
+ * @brief Checks the duplicate event filter's rules, and measures its throughput
+ * @date 2026-10-19
+ *
+ */
+#include "event_filter.h"
+#include "sender.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_VEHICLES 100000          // Vehicles seen, more than the filter tracks
+#define BENCH_EVENTS (1 << 22)         // Events filtered
+#define BENCH_LICENSE 10000000         // License ID of the first vehicle
+
+/**
+ * @brief Checks an event's verdict, and records it as spooled unless it's dropped
+ *
+ * @return int 0 if the verdict is the expected one, 1 otherwise
+ */
+static int expect(event_filter_t *f, uint8_t type, uint32_t license, uint32_t utc, int verdict, const char *what)
+{
+    gps_msg_t msg = {type, license, utc, 32.0f, 34.8f};
+    int got = event_filter_check(f, &msg);
+    if (got != FILTER_DUPLICATE)
+        event_filter_commit(f, &msg);
+    if (got == verdict)
+        return 0;
+    fprintf(stderr, "%s: verdict %d, expected %d\n", what, got, verdict);
+    return 1;
+}
+
+/**
+ * @brief Bucket of a license ID, as event_filter.c hashes it
+ */
+static uint32_t bucket_of(uint32_t license)
+{
+    return (license * 2654435761u) >> (32 - FILTER_BUCKET_BITS);
+}
+
+/**
+ * @brief Checks the rules on a few vehicles
+ *
+ * @return int Number of wrong verdicts
+ */
+static int check_rules(event_filter_t *f)
+{
+    const uint32_t t = MIN_UTC;
+    int failures = 0;
+
+    failures += expect(f, MSGT_START, 1000001, t, FILTER_PASS, "first event");
+    failures += expect(f, MSGT_START, 1000001, t, FILTER_DUPLICATE, "same START again");
+    failures += expect(f, MSGT_STOP, 1000001, t + 60, FILTER_PASS, "STOP after START");
+    failures += expect(f, MSGT_STOP, 1000001, t + 60, FILTER_DUPLICATE, "same STOP again");
+    failures += expect(f, MSGT_STOP, 1000001, t + 120, FILTER_UNEXPECTED, "STOP after STOP");
+    failures += expect(f, MSGT_START, 1000001, t + 120, FILTER_PASS, "START at the time of the STOP");
+
+    // An STM32 that rebooted starts its clock over: its events get through, and count from there
+    failures += expect(f, MSGT_STOP, 1000001, t + 5, FILTER_OUT_OF_ORDER, "STOP after a clock reset");
+    failures += expect(f, MSGT_START, 1000001, t + 10, FILTER_PASS, "START after the clock reset");
+    failures += expect(f, MSGT_START, 1000001, t + 10, FILTER_DUPLICATE, "same START after the clock reset");
+    failures += expect(f, MSGT_START, 1000001, t + 5, FILTER_OUT_OF_ORDER, "older START");
+
+    // Each vehicle has a last event of its own
+    failures += expect(f, MSGT_START, 1000002, t, FILTER_PASS, "another vehicle's first event");
+
+    uint32_t same[FILTER_WAYS + 1];
+    int n = 0;
+    for (uint32_t license = 2000000; n < FILTER_WAYS + 1; license++)
+    {
+        if (bucket_of(license) == bucket_of(2000000))
+            same[n++] = license;
+    }
+
+    // A full bucket forgets the vehicle with the oldest event
+    for (int i = 0; i < FILTER_WAYS; i++)
+        failures += expect(f, MSGT_START, same[i], t + i, FILTER_PASS, "first event in a shared bucket");
+    failures += expect(f, MSGT_START, same[FILTER_WAYS], t + FILTER_WAYS, FILTER_PASS, "first event in a full bucket");
+    failures += expect(f, MSGT_START, same[0], t, FILTER_PASS, "repeat of a forgotten vehicle");
+    failures += expect(f, MSGT_START, same[FILTER_WAYS], t + FILTER_WAYS, FILTER_DUPLICATE, "repeat of a tracked vehicle");
+    return failures;
+}
+
+int main(void)
+{
+    event_filter_t *f = calloc(1, sizeof(*f));
+    if (!f)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (check_rules(f) != 0)
+        return 1;
+
+    // Random vehicles and event types, with one event in eight sent again
+    uint32_t *licenses = malloc(BENCH_EVENTS * sizeof(*licenses));
+    if (!licenses)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    srand(0);
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++)
+        licenses[i] = BENCH_LICENSE + rand() % BENCH_VEHICLES;
+
+    uint64_t verdicts[4] = {0};
+    gps_msg_t msg = {MSGT_START, 0, MIN_UTC, 32.0f, 34.8f};
+    int64_t t0 = monotonic_ms();
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++)
+    {
+        if (i % 8 != 0)
+        {
+            msg.license_id = licenses[i];
+            msg.msg_type = (licenses[i] ^ i) & 1 ? MSGT_START : MSGT_STOP;
+            msg.utc_sec = MIN_UTC + i / 16;
+        }
+        int verdict = event_filter_check(f, &msg);
+        verdicts[verdict]++;
+        if (verdict != FILTER_DUPLICATE)
+            event_filter_commit(f, &msg);
+    }
+    int64_t elapsed = monotonic_ms() - t0;
+
+    printf("Filter rules hold\n"
+           "Filtered %d events of %d vehicles in %lld ms: %.0f events/sec\n"
+           "%llu passed, %llu duplicate, %llu unexpected, %llu out of order\n",
+           BENCH_EVENTS, BENCH_VEHICLES, (long long)elapsed,
+           elapsed > 0 ? BENCH_EVENTS * 1000.0 / elapsed : 0.0,
+           (unsigned long long)verdicts[FILTER_PASS], (unsigned long long)verdicts[FILTER_DUPLICATE],
+           (unsigned long long)verdicts[FILTER_UNEXPECTED], (unsigned long long)verdicts[FILTER_OUT_OF_ORDER]);
+    free(licenses);
+    free(f);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "gps_msg.h"
+#include <stdio.h>
 
 const char *type_str(uint8_t t)
 {
@@ -9,4 +10,37 @@ const char *type_str(uint8_t t)
         case MSGT_STOP: return "STOP";
         default: return "UNKNOWN";
     }
+}
+
+int gps_msg_check(const gps_msg_t *msg, time_t now, char *why, size_t len)
+{
+    if (msg->msg_type > MAX_MSGT)
+    {
+        snprintf(why, len, "invalid msg_type %u", msg->msg_type);
+        return 0;
+    }
+
+    if (msg->license_id < MIN_LICENSE)
+    {
+        snprintf(why, len, "invalid license_id %u", msg->license_id);
+        return 0;
+    }
+
+    // Written so NaN fails the checks
+    if (!(msg->latitude >= LAT_MIN && msg->latitude <= LAT_MAX)
+        || !(msg->longitude >= LON_MIN && msg->longitude <= LON_MAX))
+    {
+        snprintf(why, len, "invalid coordinates (%.6f,%.6f)", msg->latitude, msg->longitude);
+        return 0;
+    }
+
+    const time_t msg_time = msg->utc_sec;
+
+    if (msg_time < MIN_UTC || msg_time > now)
+    {
+        snprintf(why, len, "invalid time %lld", (long long)msg_time);
+        return 0;
+    }
+
+    return 1;
 }
\ No newline at end of file
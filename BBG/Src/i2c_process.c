@@ -1,9 +1,9 @@
 /**
  * @file i2c_process.c
  * @author Leah
- * @brief Multiprocessing I2C communication for parksys
+ * @brief I2C message source for parksys
  * @date 2025-07-15
- * 
+ *
  */
 #include "i2c_process.h"
 #include "gps_msg.h"
@@ -11,7 +11,10 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -20,115 +23,430 @@
 
 #define SMALL_DELAY 500
 
+typedef struct i2c_source i2c_source_t;
+
+/**
+ * @brief A bus and the devices on it, polled by one thread
+ */
+typedef struct
+{
+    i2c_source_t *owner;
+    spool_t *spool;
+    char path[32];
+    int fd;
+    int first;                         // Index of the bus' first device
+    int count;                         // Number of devices on the bus
+} i2c_bus_t;
+
+struct i2c_source
+{
+    const Config *cfg;
+    i2c_device_t devices[MAX_I2C_TARGETS]; // Grouped by bus
+    int device_count;
+    i2c_bus_t buses[MAX_I2C_TARGETS];
+    int bus_count;
+    pthread_mutex_t push_lock;         // Serializes spooling, the spool has a single producer
+    int threaded;                      // Buses are polled by threads of their own
+    atomic_int stop;                   // Set on a reload request, the bus threads return
+};
+
+/**
+ * @brief Reads a frame from every device once
+ *
+ * @param src Source
+ * @param spool Spool to append START/STOP messages to
+ * @return int Messages read, -1 if every read failed
+ */
+static int i2c_source_read(source_t *src, spool_t *spool);
+
+/**
+ * @brief Source process loop, polling each bus in a thread of its own until a reload is requested
+ *
+ * @param src Source
+ * @param spool Spool to append START/STOP messages to
+ */
+static void i2c_source_run(source_t *src, spool_t *spool);
+
+/**
+ * @brief Closes the buses
+ *
+ * @param src Source
+ */
+static void i2c_source_close(source_t *src);
+
+/**
+ * @brief Reads a frame from each device on a bus in turn, until a reload is requested
+ *
+ * @param arg Bus
+ * @return void* NULL
+ */
+static void *poll_bus(void *arg);
+
+/**
+ * @brief Reads a frame from a device, and reports its statistics when due
+ *
+ * @param bus Bus of the device
+ * @param dev Device
+ * @param spool Spool to append START/STOP messages to
+ * @return int Messages in the frame, -1 on failure
+ */
+static int read_device(i2c_bus_t *bus, i2c_device_t *dev, spool_t *spool);
+
 /**
  * @brief memcpy wrapper that validates the data it copies
- * 
+ *
+ * @param dev Device the data came from
  * @param msg Destination
  * @param buf Source buffer
  * @return int 1 if successful, 0 otherwise
  */
-static int memcpy_validate(gps_msg_t *msg, uint8_t *buf);
+static int memcpy_validate(i2c_device_t *dev, gps_msg_t *msg, uint8_t *buf);
 
-void run_i2c_process(int write_fd, const Config *cfg)
+int i2c_open(const char *bus)
 {
-    int fd = open(cfg->i2c_bus, O_RDWR);
+    int fd = open(bus, O_RDWR);
     if (fd < 0)
     {
-        syslog(LOG_ERR, "[I2C] open i2c_bus: %s", strerror(errno));
-        exit(EXIT_FAILURE);
+        syslog(LOG_ERR, "[I2C] open %s: %s", bus, strerror(errno));
+        return -1;
     }
 
-    if (ioctl(fd, I2C_SLAVE, cfg->i2c_addr) < 0)
+    // Frames are read with I2C_RDWR, which SMBus-only adapters don't support
+    unsigned long funcs = 0;
+    if (ioctl(fd, I2C_FUNCS, &funcs) < 0 || !(funcs & I2C_FUNC_I2C))
     {
-        syslog(LOG_ERR, "[I2C] ioctl I2C_SLAVE: %s", strerror(errno));
+        syslog(LOG_ERR, "[I2C] %s doesn't support plain I2C transfers\n", bus);
         close(fd);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    return fd;
+}
 
-    syslog(LOG_INFO, "[I2C] Listening on %s @0x%02X ...\n", cfg->i2c_bus, cfg->i2c_addr);
+int i2c_source_open(source_t *src)
+{
+    const Config *cfg = src->cfg;
+    i2c_source_t *st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+        syslog(LOG_ERR, "[I2C] calloc: %s", strerror(errno));
+        return -1;
+    }
+    st->cfg = cfg;
 
-    while (1)
+    // Group the targets by bus, keeping their order
+    for (int i = 0; i < cfg->i2c_target_count; i++)
     {
-        uint8_t buf[MSG_LEN];
-        ssize_t rd = read(fd, buf, MSG_LEN);
+        const i2c_target_t *t = &cfg->i2c_targets[i];
+        int b = 0;
+        while (b < st->bus_count && strcmp(st->buses[b].path, t->bus) != 0)
+            b++;
+        if (b == st->bus_count)
+        {
+            strcpy(st->buses[b].path, t->bus);
+            st->buses[b].fd = -1;
+            st->bus_count++;
+        }
+        st->buses[b].count++;
+    }
 
-        if (rd < 0)
+    int next = 0;
+    for (int b = 0; b < st->bus_count; b++)
+    {
+        i2c_bus_t *bus = &st->buses[b];
+        bus->owner = st;
+        bus->first = next;
+        for (int i = 0; i < cfg->i2c_target_count; i++)
         {
-            if (errno == EAGAIN || errno == EINTR || errno == EBUSY
-                || errno == EIO || errno == ENXIO || errno == EREMOTEIO)
-            {
-                syslog(LOG_ERR, "[I2C] Error: read failed (%s), retrying...\n", strerror(errno));
-                usleep(SMALL_DELAY);
-            }
+            const i2c_target_t *t = &cfg->i2c_targets[i];
+            if (strcmp(t->bus, bus->path) != 0)
+                continue;
+
+            i2c_device_t *dev = &st->devices[next++];
+            snprintf(dev->name, sizeof(dev->name), "%s@0x%02X", t->bus, t->addr);
+            dev->addr = t->addr;
+            dev->stats.last_report_ms = src->start_ms;
+            dev->error_limit = (log_limit_t)LOG_LIMIT_INIT("[I2C] Read errors");
+            dev->invalid_limit = (log_limit_t)LOG_LIMIT_INIT("[I2C] Invalid messages");
+            dev->dropped_limit = (log_limit_t)LOG_LIMIT_INIT("[I2C] Dropped messages");
+            dev->repeat_limit = (log_limit_t)LOG_LIMIT_INIT("[I2C] Repeated events");
+            dev->filter = src->filter;
+        }
+    }
+    st->device_count = next;
+
+    metrics_source_t *m = metrics_sources(st->device_count);
+    for (int i = 0; i < st->device_count; i++)
+    {
+        st->devices[i].metrics = &m[i];
+        strcpy(m[i].name, st->devices[i].name);
+    }
+
+    src->state = st;
+    src->close = i2c_source_close;
+    for (int b = 0; b < st->bus_count; b++)
+    {
+        st->buses[b].fd = i2c_open(st->buses[b].path);
+        if (st->buses[b].fd < 0)
+        {
+            i2c_source_close(src);
+            return -1;
+        }
+    }
+    pthread_mutex_init(&st->push_lock, NULL);
+
+    src->read = i2c_source_read;
+    src->run = i2c_source_run;
+
+    for (int i = 0; i < st->device_count; i++)
+        syslog(LOG_INFO, "[I2C] Listening on %s ...\n", st->devices[i].name);
+    return 0;
+}
+
+int i2c_read_frame(int fd, i2c_device_t *dev, const Config *cfg, spool_t *spool,
+                   pthread_mutex_t *push_lock)
+{
+    source_stats_t *stats = &dev->stats;
+    uint8_t buf[FRAME_LEN(MAX_I2C_BATCH)];
+    struct i2c_msg rd = {
+        .addr = dev->addr,
+        .flags = I2C_M_RD,
+        .len = FRAME_LEN(cfg->i2c_batch),
+        .buf = buf,
+    };
+    struct i2c_rdwr_ioctl_data xfer = { .msgs = &rd, .nmsgs = 1 };
+
+    // The whole frame in one transaction, a single address phase for all of its records
+    if (ioctl(fd, I2C_RDWR, &xfer) < 0)
+    {
+        metrics_read_error(dev->metrics, errno);
+        if (errno == EAGAIN || errno == EINTR || errno == EBUSY || errno == ETIMEDOUT
+            || errno == EIO || errno == ENXIO || errno == EREMOTEIO)
+        {
+            stats->errors++;
+            log_limited(&dev->error_limit, LOG_ERR, "[I2C] %s: read failed (%s), retrying...\n",
+                        dev->name, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    const uint8_t count = buf[0];
+    if (count > cfg->i2c_batch)
+    {
+        stats->invalid++;
+        metric_add(&dev->metrics->invalid, 1);
+        log_limited(&dev->invalid_limit, LOG_WARNING, "[I2C] %s: invalid frame of %u records (i2c_batch=%d), skipping\n",
+                    dev->name, count, cfg->i2c_batch);
+        return -1;
+    }
+    stats->frames++;
+    metric_add(&dev->metrics->frames, 1);
+
+    gps_msg_t msgs[MAX_I2C_BATCH];
+    int n = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (!memcpy_validate(dev, &msgs[n], buf + FRAME_LEN(i)))
+        {
+            stats->invalid++;
+            metric_add(&dev->metrics->invalid, 1);
             continue;
         }
 
-        if (rd != MSG_LEN)
+        // IDLE messages are only counted, in the periodic report
+        if (msgs[n].msg_type == MSGT_IDLE)
         {
-            syslog(LOG_WARNING, "[I2C] short read: %zd/%d bytes, retrying...\n", rd, MSG_LEN);
-            usleep(SMALL_DELAY);
+            stats->idle++;
+            metric_add(&dev->metrics->idle, 1);
             continue;
         }
+        n++;
+    }
 
-        gps_msg_t msg;
+    // Spool only START/STOP messages. Never blocks, so the bus
+    // keeps being read even when the server is unreachable
+    if (push_lock)
+        pthread_mutex_lock(push_lock);
+    for (int i = 0; i < n; i++)
+    {
+        const gps_msg_t *msg = &msgs[i];
+        int verdict = event_filter_check(dev->filter, msg);
+        if (verdict == FILTER_DUPLICATE)
+        {
+            stats->duplicates++;
+            metric_add(&dev->metrics->duplicates, 1);
+            log_limited(&dev->repeat_limit, LOG_WARNING, "[I2C] %s: duplicate %s of license %u at %u, skipping\n",
+                        dev->name, type_str(msg->msg_type), msg->license_id, msg->utc_sec);
+            continue;
+        }
+        if (verdict == FILTER_UNEXPECTED)
+        {
+            // A START or STOP went missing, the server sorts out the session
+            stats->unexpected++;
+            metric_add(&dev->metrics->unexpected, 1);
+            log_limited(&dev->repeat_limit, LOG_WARNING, "[I2C] %s: %s of license %u at %u repeats its last event type\n",
+                        dev->name, type_str(msg->msg_type), msg->license_id, msg->utc_sec);
+        }
+        else if (verdict == FILTER_OUT_OF_ORDER)
+        {
+            // Most likely the STM32 rebooted and started its clock over
+            stats->out_of_order++;
+            metric_add(&dev->metrics->out_of_order, 1);
+            log_limited(&dev->repeat_limit, LOG_WARNING, "[I2C] %s: %s of license %u at %u is older than its last event\n",
+                        dev->name, type_str(msg->msg_type), msg->license_id, msg->utc_sec);
+        }
 
-        if (memcpy_validate(&msg, buf))
+        if (spool_push(spool, msg) < 0)
         {
-            const time_t msg_time = msg.utc_sec;
-
-            if (msg.msg_type == 0)
-                syslog(LOG_INFO, "[I2C] msg_type=%s(%u), license=%08u, lat=%.6f, lon=%.6f, %s",
-                    type_str(msg.msg_type),
-                    msg.msg_type,
-                    msg.license_id,
-                    msg.latitude,
-                    msg.longitude,
-                    asctime(gmtime(&msg_time)));
-
-            // Forward only START/STOP messages to pipe
-            if (msg.msg_type == 1 || msg.msg_type == 2) {
-                ssize_t wr = write(write_fd, &msg, sizeof(msg));
-                if (wr != sizeof(msg)) {
-                    syslog(LOG_ERR, "[I2C] Failed to write to pipe: %s\n", strerror(errno));
-                }
+            stats->dropped++;
+            metric_add(&dev->metrics->dropped, 1);
+            log_limited(&dev->dropped_limit, LOG_ERR, "[I2C] %s: spool full, message dropped\n", dev->name);
+        }
+        else
+        {
+            event_filter_commit(dev->filter, msg);
+            if (msg->msg_type == MSGT_START)
+            {
+                stats->starts++;
+                metric_add(&dev->metrics->starts, 1);
+            }
+            else
+            {
+                stats->stops++;
+                metric_add(&dev->metrics->stops, 1);
             }
         }
     }
-    close(fd);
+    if (push_lock)
+        pthread_mutex_unlock(push_lock);
+
+    return count;
 }
 
-static int memcpy_validate(gps_msg_t *msg, uint8_t *buf)
+static int i2c_source_read(source_t *src, spool_t *spool)
 {
-    memcpy(msg, buf, MSG_LEN);
+    i2c_source_t *st = src->state;
+    int total = 0, failed = 0;
 
-    if (msg->msg_type > MAX_MSGT)
+    src->more = 0;
+    for (int b = 0; b < st->bus_count; b++)
     {
-        syslog(LOG_WARNING, "[I2C] Invalid msg_type %u, skipping\n", msg->msg_type);
-        return 0;
+        i2c_bus_t *bus = &st->buses[b];
+        for (int i = bus->first; i < bus->first + bus->count; i++)
+        {
+            int n = read_device(bus, &st->devices[i], spool);
+            if (n < 0)
+            {
+                failed++;
+                continue;
+            }
+
+            // A full frame means the STM32 may have more queued
+            if (n == src->cfg->i2c_batch)
+                src->more = 1;
+            total += n;
+        }
     }
+    return failed == st->device_count ? -1 : total;
+}
 
-    if (msg->license_id < MIN_LICENSE)
+static void i2c_source_run(source_t *src, spool_t *spool)
+{
+    i2c_source_t *st = src->state;
+
+    for (int b = 0; b < st->bus_count; b++)
+        st->buses[b].spool = spool;
+
+    atomic_store(&st->stop, 0);
+    if (st->bus_count == 1)
     {
-        syslog(LOG_WARNING, "[I2C] Invalid license_id %u, skipping\n", msg->license_id);
-        return 0;
+        poll_bus(&st->buses[0]);
+        return;
     }
 
-    if (msg->latitude < LAT_MIN || msg->latitude > LAT_MAX
-        || msg->longitude < LON_MIN || msg->longitude > LON_MAX)
+    // Transfers on different buses run in parallel, only spooling is serialized.
+    // The threads inherit the blocked SIGHUP, which only this one waits for.
+    st->threaded = 1;
+    pthread_t threads[MAX_I2C_TARGETS];
+    for (int b = 0; b < st->bus_count; b++)
     {
-        syslog(LOG_WARNING, "[I2C] Invalid coordinates (%.6f,%.6f), skipping\n",
-               msg->latitude, msg->longitude);
-        return 0;
+        int err = pthread_create(&threads[b], NULL, poll_bus, &st->buses[b]);
+        if (err != 0)
+        {
+            syslog(LOG_ERR, "[I2C] pthread_create: %s", strerror(err));
+            exit(EXIT_FAILURE);
+        }
     }
+    config_wait_reload();
+    atomic_store(&st->stop, 1);
+    for (int b = 0; b < st->bus_count; b++)
+        pthread_join(threads[b], NULL);
+}
 
-    const time_t msg_time = msg->utc_sec;
-    
-    if (msg_time < MIN_UTC || msg_time > time(NULL))
+static void i2c_source_close(source_t *src)
+{
+    i2c_source_t *st = src->state;
+    for (int b = 0; b < st->bus_count; b++)
     {
-        syslog(LOG_WARNING, "[I2C] Invalid time (%s), skipping\n",
-               asctime(gmtime(&msg_time)));
-        return 0;
+        if (st->buses[b].fd >= 0)
+            close(st->buses[b].fd);
     }
+    free(st);
+    src->state = NULL;
+}
 
+static void *poll_bus(void *arg)
+{
+    i2c_bus_t *bus = arg;
+    i2c_source_t *st = bus->owner;
+
+    while (!atomic_load(&st->stop))
+    {
+        // A lone bus is polled by the source process' thread, which takes the request itself
+        if (!st->threaded && config_reload_requested())
+            break;
+
+        int failed = 0;
+        for (int i = bus->first; i < bus->first + bus->count; i++)
+        {
+            if (read_device(bus, &st->devices[i], bus->spool) < 0)
+                failed++;
+        }
+
+        if (failed == bus->count)
+            usleep(SMALL_DELAY);
+    }
+    return NULL;
+}
+
+static int read_device(i2c_bus_t *bus, i2c_device_t *dev, spool_t *spool)
+{
+    i2c_source_t *st = bus->owner;
+    int n = i2c_read_frame(bus->fd, dev, st->cfg, spool, st->threaded ? &st->push_lock : NULL);
+
+    // Bounds what a power loss takes from the spool, even once the bus goes quiet
+    if (st->threaded)
+        pthread_mutex_lock(&st->push_lock);
+    spool_sync(spool);
+    if (st->threaded)
+        pthread_mutex_unlock(&st->push_lock);
+    log_limit_flush(&dev->error_limit);
+    log_limit_flush(&dev->invalid_limit);
+    log_limit_flush(&dev->repeat_limit);
+    log_limit_flush(&dev->dropped_limit);
+    source_stats_report(&dev->stats, dev->name, spool);
+    return n;
+}
+
+static int memcpy_validate(i2c_device_t *dev, gps_msg_t *msg, uint8_t *buf)
+{
+    memcpy(msg, buf, MSG_LEN);
+
+    char why[64];
+    if (!gps_msg_check(msg, time(NULL), why, sizeof(why)))
+    {
+        log_limited(&dev->invalid_limit, LOG_WARNING, "[I2C] %s: %s, skipping\n", dev->name, why);
+        return 0;
+    }
     return 1;
-}
\ No newline at end of file
+}
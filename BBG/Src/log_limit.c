@@ -0,0 +1,55 @@
+/**
+ * @file log_limit.c
+ * @author Leah
+ * @brief Rate limited syslog output, for messages that may repeat many times a second
+ * @date 2026-10-19
+ *
+ */
+#include "log_limit.h"
+#include "sender.h"
+#include <stdarg.h>
+#include <syslog.h>
+
+/**
+ * @brief Logs the number of messages suppressed so far, and starts counting again
+ *
+ * @param lim Category
+ */
+static void report(log_limit_t *lim)
+{
+    if (lim->suppressed > 0)
+        syslog(lim->priority, "%s: %lu similar messages suppressed\n", lim->what, lim->suppressed);
+    lim->logged = 0;
+    lim->suppressed = 0;
+}
+
+int log_limited(log_limit_t *lim, int priority, const char *fmt, ...)
+{
+    int64_t now = monotonic_ms();
+    if (lim->logged == 0 || now - lim->window_ms >= LOG_LIMIT_INTERVAL_MS)
+    {
+        report(lim);
+        lim->window_ms = now;
+    }
+
+    if (lim->logged >= LOG_LIMIT_BURST)
+    {
+        lim->suppressed++;
+        lim->priority = priority;
+        return 0;
+    }
+    lim->logged++;
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsyslog(priority, fmt, ap);
+    va_end(ap);
+    return 1;
+}
+
+void log_limit_flush(log_limit_t *lim)
+{
+    // The next message starts a new interval
+    if (lim->suppressed > 0 && monotonic_ms() - lim->window_ms >= LOG_LIMIT_INTERVAL_MS)
+        report(lim);
+}
@@ -0,0 +1,183 @@
+/**
+ * @file lot_table.c
+ * @author Leah
+ * @brief Local copy of the server's lot table, for resolving START messages on the gateway
+ * @date 2026-10-19
+ *
+ */
+#include "lot_table.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define LOT_TABLE_NO_CACHE "none"      // lots_path for a memory-only table
+
+/**
+ * @brief Parses a table and makes it the current one
+ *
+ * @param t Table
+ * @param buf Table in its wire format
+ * @param len Bytes in buf
+ * @return int 0 on success, -1 on failure
+ */
+static int parse(lot_table_t *t, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Writes the current table to the cache file, replacing it atomically
+ *
+ * @param t Table
+ * @param path Cache file
+ */
+static void save(const lot_table_t *t, const char *path);
+
+void lot_table_init(lot_table_t *t, const char *path)
+{
+    memset(t, 0, sizeof(*t));
+    if (strcmp(path, LOT_TABLE_NO_CACHE) == 0)
+        return;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            syslog(LOG_WARNING, "[LOTS] open %s: %s", path, strerror(errno));
+        return;
+    }
+
+    uint8_t *buf = malloc(LOT_TABLE_LEN(LOT_TABLE_MAX));
+    ssize_t len = buf ? read(fd, buf, LOT_TABLE_LEN(LOT_TABLE_MAX)) : -1;
+    close(fd);
+
+    if (len < 0 || parse(t, buf, (size_t)len) < 0)
+        syslog(LOG_WARNING, "[LOTS] Ignoring invalid lot table cache %s", path);
+    else
+        syslog(LOG_INFO, "[LOTS] Loaded lot table %08x with %u lots from %s", t->version, t->count, path);
+    free(buf);
+}
+
+int lot_table_set(lot_table_t *t, const uint8_t *buf, size_t len, const char *path)
+{
+    if (parse(t, buf, len) < 0)
+        return -1;
+
+    syslog(LOG_INFO, "[LOTS] Received lot table %08x with %u lots", t->version, t->count);
+    if (strcmp(path, LOT_TABLE_NO_CACHE) != 0)
+        save(t, path);
+    return 0;
+}
+
+uint32_t lot_table_nearest(const lot_table_t *t, float latitude, float longitude)
+{
+    const uint32_t n = t->count;
+    float best_dist = FLT_MAX;
+    uint32_t best = 0, i = 0;
+
+    if (n == 0)
+        return 0;
+
+#if defined(__ARM_NEON)
+    // 4 lots per iteration, keeping the best one of each lane apart
+    static const uint32_t lanes[4] = { 0, 1, 2, 3 };
+    const float32x4_t vlat = vdupq_n_f32(latitude);
+    const float32x4_t vlon = vdupq_n_f32(longitude);
+    const uint32x4_t four = vdupq_n_u32(4);
+    float32x4_t vbest = vdupq_n_f32(FLT_MAX);
+    uint32x4_t vbest_i = vdupq_n_u32(0);
+    uint32x4_t vi = vld1q_u32(lanes);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t dx = vsubq_f32(vld1q_f32(t->lat + i), vlat);
+        float32x4_t dy = vsubq_f32(vld1q_f32(t->lon + i), vlon);
+        float32x4_t dist = vmlaq_f32(vmulq_f32(dx, dx), dy, dy);
+        uint32x4_t closer = vcltq_f32(dist, vbest);
+        vbest = vbslq_f32(closer, dist, vbest);
+        vbest_i = vbslq_u32(closer, vi, vbest_i);
+        vi = vaddq_u32(vi, four);
+    }
+
+    float lane_dist[4];
+    uint32_t lane_i[4];
+    vst1q_f32(lane_dist, vbest);
+    vst1q_u32(lane_i, vbest_i);
+    for (int l = 0; l < 4; l++)
+    {
+        if (lane_dist[l] < best_dist || (lane_dist[l] == best_dist && lane_i[l] < best))
+        {
+            best_dist = lane_dist[l];
+            best = lane_i[l];
+        }
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        float dx = t->lat[i] - latitude;
+        float dy = t->lon[i] - longitude;
+        float dist = dx * dx + dy * dy;
+        if (dist < best_dist)
+        {
+            best_dist = dist;
+            best = i;
+        }
+    }
+    return t->id[best];
+}
+
+static int parse(lot_table_t *t, const uint8_t *buf, size_t len)
+{
+    uint32_t version, count;
+    if (len < LOT_TABLE_HDR_LEN)
+        return -1;
+    memcpy(&version, buf, sizeof(version));
+    memcpy(&count, buf + 4, sizeof(count));
+    if (count > LOT_TABLE_MAX || len != LOT_TABLE_LEN(count))
+        return -1;
+
+    uint8_t *raw = malloc(len);
+    if (!raw)
+    {
+        syslog(LOG_ERR, "[LOTS] Out of memory");
+        return -1;
+    }
+    memcpy(raw, buf, len);
+
+    free(t->raw);
+    t->raw = raw;
+    t->version = version;
+    t->count = count;
+    t->lat = (float *)(raw + LOT_TABLE_HDR_LEN);
+    t->lon = t->lat + count;
+    t->id = (uint32_t *)(t->lon + count);
+    return 0;
+}
+
+static void save(const lot_table_t *t, const char *path)
+{
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        syslog(LOG_WARNING, "[LOTS] open %s: %s", tmp, strerror(errno));
+        return;
+    }
+
+    size_t len = LOT_TABLE_LEN(t->count);
+    ssize_t wr = write(fd, t->raw, len);
+    close(fd);
+    if (wr != (ssize_t)len || rename(tmp, path) < 0)
+    {
+        syslog(LOG_WARNING, "[LOTS] Failed to cache the lot table in %s", path);
+        unlink(tmp);
+    }
+}
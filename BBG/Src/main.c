@@ -5,8 +5,11 @@
  * @date 2025-07-14
  */
 #include "config.h"
-#include "i2c_process.h"
 #include "eth_process.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "source.h"
+#include "spool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +36,21 @@
  */
 static int first_time_install(void);
 
+/**
+ * @brief Writes the systemd service file
+ * 
+ * @return int 0 on success, -1 on failure
+ */
+static int write_service_file(void);
+
+/**
+ * @brief Rewrites a service file installed before reloads were supported
+ * 
+ * Upgrades keep their service file, so one without ExecReload is replaced
+ * and systemd is told to reread it.
+ */
+static void upgrade_service_file(void);
+
 /**
  * @brief Display program status to stdout
  * 
@@ -45,9 +63,33 @@ static void print_status();
  */
 static void uninstall();
 
+/**
+ * @brief Creates the directory of a file and its parents, like mkdir -p
+ * 
+ * @param path File path
+ * @return int 0 on success, or if they exist, -1 on failure
+ */
+static int make_parent_dirs(const char *path);
+
+/**
+ * @brief Removes a data file, and its directory if that's left empty
+ * 
+ * @param path File path
+ */
+static void remove_data_file(const char *path);
+
 int main(int argc, char *argv[])
 {
-    if (argc == 2 && strcmp(argv[1], "status") == 0)
+    // "run <config>" stays in the foreground, logging to stderr, without installing anything
+    const char *config_path = CONFIG_PATH;
+    int foreground = 0;
+
+    if (argc == 3 && strcmp(argv[1], "run") == 0)
+    {
+        config_path = argv[2];
+        foreground = 1;
+    }
+    else if (argc == 2 && strcmp(argv[1], "status") == 0)
     {
         print_status();
         return 0;
@@ -63,16 +105,18 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    if (first_time_install() == 1)
+    if (!foreground && first_time_install() == 1)
     {
         printf("[INIT] First-time setup done.\n");
         printf("Please start the service manually with:\n");
         printf("  sudo systemctl start parksys\n");
         return EXIT_SUCCESS; 
     }
+    if (!foreground && geteuid() == 0)
+        upgrade_service_file();
 
     Config cfg;
-    if (load_config(&cfg) != 0)
+    if (load_config(&cfg, config_path) != 0)
     {
         fprintf(stderr, "Failed to load config\n");
         return EXIT_FAILURE;
@@ -81,40 +125,94 @@ int main(int argc, char *argv[])
     printf("Loaded config:\n");
     printf("  i2c_bus     = %s\n", cfg.i2c_bus);
     printf("  i2c_addr    = 0x%02X\n", cfg.i2c_addr);
+    for (int i = 0; i < cfg.i2c_target_count; i++)
+        printf("  i2c_target  = %s:0x%02X\n", cfg.i2c_targets[i].bus, cfg.i2c_targets[i].addr);
     printf("  server_ip   = %s\n", cfg.server_ip);
     printf("  server_port = %d\n", cfg.server_port);
+    for (int i = 0; i < cfg.server_count; i++)
+        printf("  server      = %s:%d\n", cfg.servers[i].ip, cfg.servers[i].port);
+    printf("  failover_ms = %d\n", cfg.failover_ms);
     printf("  log_path    = %s\n", cfg.log_path);
     printf("  service_name= %s\n", cfg.service_name);
-    printf("  service_path= %s\n\n", cfg.service_path);
-
-    int pipefd[2];
-    if (pipe(pipefd) < 0)
+    printf("  service_path= %s\n", cfg.service_path);
+    printf("  spool_path  = %s\n", cfg.spool_path);
+    printf("  spool_size  = %d\n", cfg.spool_size);
+    printf("  batch_max   = %d\n", cfg.batch_max);
+    printf("  batch_delay_ms = %d\n", cfg.batch_delay_ms);
+    printf("  mode        = %s\n", cfg.mode == MODE_SINGLE ? "single" : "fork");
+    printf("  i2c_poll_ms = %d\n", cfg.i2c_poll_ms);
+    printf("  i2c_batch   = %d\n", cfg.i2c_batch);
+    printf("  source      = %s\n", cfg.source == SOURCE_SIM ? "sim" : cfg.source == SOURCE_REPLAY ? "replay" : "i2c");
+    printf("  replay_path = %s\n", cfg.replay_path);
+    printf("  source_speed= %s\n", cfg.source_realtime ? "1x" : "max");
+    printf("  sim_vehicles= %d\n", cfg.sim_vehicles);
+    printf("  log_level   = %s\n", cfg.log_level == LOG_DEBUG ? "debug" : cfg.log_level == LOG_INFO ? "info"
+                                    : cfg.log_level == LOG_WARNING ? "warning" : "err");
+    printf("  connect_timeout_ms = %d\n", cfg.connect_timeout_ms);
+    printf("  gateway_id  = %u\n", cfg.gateway_id);
+    printf("  ack_window  = %d\n", cfg.ack_window);
+    printf("  edge_lots   = %s\n", cfg.edge_lots ? "on" : "off");
+    printf("  lots_path   = %s\n", cfg.lots_path);
+    printf("  compress    = %s\n", cfg.compress ? "on" : "off");
+    printf("  metrics_path= %s\n\n", cfg.metrics_path);
+
+    // Upgrades keep their config and service, so first_time_install() doesn't create these
+    make_parent_dirs(cfg.spool_path);
+    make_parent_dirs(cfg.lots_path);
+
+    // Shared by both processes through fork()
+    spool_t spool;
+    if (spool_open(&spool, cfg.spool_path, cfg.spool_size) != 0)
     {
-        perror("pipe");
-        return 1;
+        fprintf(stderr, "Failed to open spool %s\n", cfg.spool_path);
+        return EXIT_FAILURE;
     }
 
-    if (daemon(0, 0) < 0)
+    // Shared by both processes through fork() too, private to each one if it fails
+    metrics_open();
+
+    // Inherited by both processes. Masked messages aren't even formatted
+    setlogmask(LOG_UPTO(cfg.log_level));
+
+    int log_opts = LOG_PID | LOG_CONS;
+    if (foreground)
     {
-        perror("daemon");
-        return EXIT_FAILURE;
+        log_opts |= LOG_PERROR;
     }
-
-    // Make sure systemd knows who's the parent
-    FILE *pid_file = fopen("/run/parksys.pid", "w");
-    if (pid_file)
+    else
     {
-        fprintf(pid_file, "%d\n", getpid());
-        fclose(pid_file);
+        if (daemon(0, 0) < 0)
+        {
+            perror("daemon");
+            return EXIT_FAILURE;
+        }
+
+        // Make sure systemd knows who's the parent
+        FILE *pid_file = fopen("/run/parksys.pid", "w");
+        if (pid_file)
+        {
+            fprintf(pid_file, "%d\n", getpid());
+            fclose(pid_file);
+        }
     }
 
+    // systemctl reload: each process reloads the config file where it's safe to
+    config_catch_reload(config_path);
+
+    if (cfg.mode == MODE_SINGLE)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        openlog("parksys", log_opts, LOG_DAEMON);
+        run_event_loop(&spool, &cfg);
+
+        return EXIT_FAILURE; // Shouldn't reach here
+    }
 
     pid_t i2c_pid = fork();
     if (i2c_pid == 0)
     {
-        close(pipefd[0]);
-        openlog("parksys-i2c", LOG_PID | LOG_CONS, LOG_DAEMON);
-        run_i2c_process(pipefd[1], &cfg);
+        openlog("parksys-i2c", log_opts, LOG_DAEMON);
+        run_source_process(&spool, &cfg);
 
         exit(EXIT_FAILURE); // Shouldn't reach here
     }
@@ -129,17 +227,31 @@ int main(int argc, char *argv[])
         */
         signal(SIGPIPE, SIG_IGN);
 
-        close(pipefd[1]); 
-        openlog("parksys-eth", LOG_PID | LOG_CONS, LOG_DAEMON);
-        run_eth_process(pipefd[0], &cfg);
+        openlog("parksys-eth", log_opts, LOG_DAEMON);
+        run_eth_process(&spool, &cfg);
 
         exit(EXIT_FAILURE); // Shouldn't reach here
     }
 
-    // Shouldn't reach here
+    // Passes reload requests on to both processes until they exit, which they shouldn't
     int status;
-    waitpid(i2c_pid, &status, 0);
-    waitpid(eth_pid, &status, 0);
+    int children = 2;
+    while (children > 0)
+    {
+        if (wait(&status) > 0)
+        {
+            children--;
+        }
+        else if (errno == EINTR && config_reload_requested())
+        {
+            kill(i2c_pid, SIGHUP);
+            kill(eth_pid, SIGHUP);
+        }
+        else if (errno == ECHILD)
+        {
+            break;
+        }
+    }
     return EXIT_SUCCESS;
 }
 
@@ -190,13 +302,47 @@ static int first_time_install(void)
             "i2c_addr=0x10\n"
             "server_ip=192.168.1.71\n"
             "server_port=12321\n"
+            "failover_ms=%d\n"
             "log_path=%s\n"
             "service_name=%s\n"
-            "service_path=%s\n",
-            LOG_PATH, SERVICE_NAME, SERVICE_PATH);
+            "service_path=%s\n"
+            "spool_path=%s\n"
+            "spool_size=%d\n"
+            "batch_max=%d\n"
+            "batch_delay_ms=%d\n"
+            "mode=fork\n"
+            "i2c_poll_ms=%d\n"
+            "i2c_batch=%d\n"
+            "source=i2c\n"
+            "log_level=info\n"
+            "connect_timeout_ms=%d\n"
+            "ack_window=%d\n"
+            "edge_lots=on\n"
+            "lots_path=%s\n"
+            "compress=off\n"
+            "metrics_path=%s\n",
+            DEFAULT_FAILOVER_MS, LOG_PATH, SERVICE_NAME, SERVICE_PATH, DEFAULT_SPOOL_PATH, DEFAULT_SPOOL_SIZE,
+            DEFAULT_BATCH_MAX, DEFAULT_BATCH_DELAY_MS, DEFAULT_I2C_POLL_MS,
+            DEFAULT_I2C_BATCH, DEFAULT_CONNECT_TIMEOUT_MS, DEFAULT_ACK_WINDOW, DEFAULT_LOTS_PATH,
+            DEFAULT_METRICS_PATH);
     fclose(fcfg);
 
-    // Write service file
+    if (write_service_file() != 0)
+        return -1;
+
+    // Reload and enable service
+    printf("[INIT] Enabling service...\n");
+    system("systemctl daemon-reexec");
+    system("systemctl daemon-reload");
+    system("systemctl enable parksys.service");
+
+    printf("[INIT] Setup complete. starting service.\n");
+
+    return 1; // Signal that setup occurred
+}
+
+static int write_service_file(void)
+{
     FILE *fsvc = fopen(SERVICE_PATH, "w");
     if (!fsvc)
     {
@@ -210,21 +356,33 @@ static int first_time_install(void)
             "After=network.target\n\n"
             "[Service]\n"
             "ExecStart=/usr/sbin/parksys\n"
+            "ExecReload=/bin/kill -HUP $MAINPID\n"
             "PIDFile=/run/parksys.pid\n"
             "Restart=always\n\n"
             "[Install]\n"
             "WantedBy=multi-user.target\n");
     fclose(fsvc);
+    return 0;
+}
 
-    // Reload and enable service
-    printf("[INIT] Enabling service...\n");
-    system("systemctl daemon-reexec");
-    system("systemctl daemon-reload");
-    system("systemctl enable parksys.service");
+static void upgrade_service_file(void)
+{
+    FILE *fsvc = fopen(SERVICE_PATH, "r");
+    if (!fsvc)
+        return;
 
-    printf("[INIT] Setup complete. starting service.\n");
+    int has_reload = 0;
+    char line[256];
+    while (!has_reload && fgets(line, sizeof(line), fsvc))
+        has_reload = strncmp(line, "ExecReload=", 11) == 0;
+    fclose(fsvc);
+    if (has_reload)
+        return;
 
-    return 1; // Signal that setup occurred
+    // Installed by a version without reloads, systemctl reload would fail on it
+    printf("[INIT] Adding ExecReload to %s\n", SERVICE_PATH);
+    if (write_service_file() == 0)
+        system("systemctl daemon-reload");
 }
 
 static void print_status()
@@ -238,6 +396,14 @@ static void print_status()
 
 static void uninstall()
 {
+    // The config may have moved the data files, so it's read before it's removed
+    Config cfg;
+    if (load_config(&cfg, CONFIG_PATH) != 0)
+    {
+        strcpy(cfg.spool_path, DEFAULT_SPOOL_PATH);
+        strcpy(cfg.lots_path, DEFAULT_LOTS_PATH);
+    }
+
     printf("[UNINSTALL] Stopping and disabling service...\n");
     system("systemctl stop parksys.service");
     system("systemctl disable parksys.service");
@@ -246,7 +412,53 @@ static void uninstall()
     remove(CONFIG_PATH);
     remove(LOG_PATH);
     remove(BIN_PATH);
+    remove_data_file(cfg.spool_path);
+    remove_data_file(cfg.lots_path);
     rmdir("/etc/parksys");
     rmdir("/var/log/parksys");
     printf("[UNINSTALL] Uninstall complete.\n");
+}
+
+static int make_parent_dirs(const char *path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    // No directory to create for "none", relative names and files in /
+    char *slash = strrchr(dir, '/');
+    if (!slash || slash == dir)
+        return 0;
+    *slash = '\0';
+
+    for (char *p = dir + 1; ; p++)
+    {
+        if (*p != '/' && *p != '\0')
+            continue;
+
+        char c = *p;
+        *p = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+            return -1;
+        }
+        *p = c;
+
+        if (c == '\0')
+            return 0;
+    }
+}
+
+static void remove_data_file(const char *path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    remove(dir);
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir)
+    {
+        *slash = '\0';
+        rmdir(dir);    // Fails unless it's empty
+    }
 }
\ No newline at end of file
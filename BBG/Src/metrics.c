@@ -0,0 +1,334 @@
+/**
+ * @file metrics.c
+ * @author Leah
+ * @brief Counters shared by the processes, exported in the Prometheus text format
+ * @date 2026-10-19
+ *
+ */
+#define _GNU_SOURCE // accept4()
+#include "metrics.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+
+#define METRICS_TEXT_LEN (128 * 1024) // Room for the metrics of MAX_I2C_TARGETS sources and MAX_SERVERS servers
+
+static metrics_t private_metrics;             // Counters until metrics_open()
+static metrics_t *shared = &private_metrics;
+
+static const int read_errnos[METRICS_ERRNOS - 1] = { EAGAIN, EINTR, EBUSY, ETIMEDOUT, EIO, ENXIO, EREMOTEIO };
+static const char *const errno_names[METRICS_ERRNOS] = {
+    "EAGAIN", "EINTR", "EBUSY", "ETIMEDOUT", "EIO", "ENXIO", "EREMOTEIO", "other"
+};
+
+/**
+ * @brief Metrics text being built
+ */
+typedef struct
+{
+    char *buf;
+    size_t len;
+} text_t;
+
+/**
+ * @brief Appends to the metrics text, truncating it when it's full
+ *
+ * @param t Text
+ * @param fmt printf format
+ */
+static void put(text_t *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Appends the HELP and TYPE lines of a metric
+ *
+ * @param t Text
+ * @param name Metric name
+ * @param type counter, gauge or histogram
+ * @param help Description
+ */
+static void put_header(text_t *t, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Appends one counter of every source
+ *
+ * @param t Text
+ * @param m Counters
+ * @param name Metric name
+ * @param help Description
+ * @param offset Offset of the counter in metrics_source_t
+ */
+static void put_sources(text_t *t, metrics_t *m, const char *name, const char *help, size_t offset);
+
+/**
+ * @brief Appends one value of every server still in use
+ *
+ * @param t Text
+ * @param r Router
+ * @param name Metric name
+ * @param type counter or gauge
+ * @param help Description
+ * @param values Value of each link
+ */
+static void put_servers(text_t *t, const router_t *r, const char *name, const char *type, const char *help,
+                        const uint64_t *values);
+
+/**
+ * @brief Builds the metrics text
+ *
+ * @param t Text
+ * @param r Router
+ * @param spool Spool
+ */
+static void build(text_t *t, const router_t *r, spool_t *spool);
+
+static inline uint64_t get(metric_t *m)
+{
+    return atomic_load_explicit(m, memory_order_relaxed);
+}
+
+int metrics_open(void)
+{
+    void *p = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        syslog(LOG_ERR, "[METRICS] mmap: %s", strerror(errno));
+        return -1;
+    }
+    shared = p;
+    return 0;
+}
+
+metrics_t *metrics(void)
+{
+    return shared;
+}
+
+metrics_source_t *metrics_sources(int count)
+{
+    atomic_store(&shared->source_count, 0);
+    memset(shared->sources, 0, sizeof(shared->sources));
+    atomic_store(&shared->source_count, count);
+    return shared->sources;
+}
+
+void metrics_read_error(metrics_source_t *src, int err)
+{
+    int i = 0;
+    while (i < METRICS_ERRNOS - 1 && read_errnos[i] != err)
+        i++;
+    metric_add(&src->errors[i], 1);
+}
+
+void metrics_ack_latency(int64_t ms)
+{
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && ms > (1 << bucket))
+        bucket++;
+    metric_add(&shared->acks[bucket], 1);
+    metric_add(&shared->ack_ms, ms > 0 ? (uint64_t)ms : 0);
+}
+
+int metrics_listen(const char *path)
+{
+    if (strcmp(path, "none") == 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        syslog(LOG_ERR, "[METRICS] Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "[METRICS] socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // Left behind by the previous run
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+    {
+        syslog(LOG_ERR, "[METRICS] Can't listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    syslog(LOG_INFO, "[METRICS] Serving metrics on %s", path);
+    return fd;
+}
+
+void metrics_serve(int fd, const router_t *r, spool_t *spool)
+{
+    static char buf[METRICS_TEXT_LEN];
+    text_t t = { buf, 0 };
+    int built = 0;
+
+    // Each client gets the whole text at once, the socket buffer holds it
+    int client;
+    while ((client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (!built)
+        {
+            build(&t, r, spool);
+            built = 1;
+        }
+        if (send(client, t.buf, t.len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)t.len)
+            syslog(LOG_WARNING, "[METRICS] Metrics didn't fit in the client's socket buffer");
+        close(client);
+    }
+}
+
+static void put(text_t *t, const char *fmt, ...)
+{
+    if (t->len >= METRICS_TEXT_LEN)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(t->buf + t->len, METRICS_TEXT_LEN - t->len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        t->len += (size_t)n < METRICS_TEXT_LEN - t->len ? (size_t)n : METRICS_TEXT_LEN - t->len - 1;
+}
+
+static void put_header(text_t *t, const char *name, const char *type, const char *help)
+{
+    put(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void put_sources(text_t *t, metrics_t *m, const char *name, const char *help, size_t offset)
+{
+    int count = atomic_load(&m->source_count);
+    put_header(t, name, "counter", help);
+    for (int i = 0; i < count; i++)
+    {
+        metrics_source_t *src = &m->sources[i];
+        put(t, "%s{source=\"%s\"} %llu\n", name, src->name,
+            (unsigned long long)get((metric_t *)((char *)src + offset)));
+    }
+}
+
+static void build(text_t *t, const router_t *r, spool_t *spool)
+{
+    metrics_t *m = shared;
+    int count = atomic_load(&m->source_count);
+
+    put_sources(t, m, "parksys_source_frames_total", "Frames read from the source",
+                offsetof(metrics_source_t, frames));
+    put_header(t, "parksys_source_messages_total", "counter", "Messages read from the source, by type");
+    for (int i = 0; i < count; i++)
+    {
+        metrics_source_t *src = &m->sources[i];
+        put(t, "parksys_source_messages_total{source=\"%s\",type=\"start\"} %llu\n", src->name,
+            (unsigned long long)get(&src->starts));
+        put(t, "parksys_source_messages_total{source=\"%s\",type=\"stop\"} %llu\n", src->name,
+            (unsigned long long)get(&src->stops));
+        put(t, "parksys_source_messages_total{source=\"%s\",type=\"idle\"} %llu\n", src->name,
+            (unsigned long long)get(&src->idle));
+    }
+    put_sources(t, m, "parksys_source_invalid_total", "Invalid messages and frames",
+                offsetof(metrics_source_t, invalid));
+    put_sources(t, m, "parksys_source_dropped_total", "Messages dropped on a full spool",
+                offsetof(metrics_source_t, dropped));
+    put_sources(t, m, "parksys_source_duplicates_total", "START/STOP messages dropped as repeats",
+                offsetof(metrics_source_t, duplicates));
+    put_sources(t, m, "parksys_source_unexpected_total", "START while parked or STOP while not, sent anyway",
+                offsetof(metrics_source_t, unexpected));
+    put_sources(t, m, "parksys_source_out_of_order_total", "START/STOP messages older than their vehicle's last, sent anyway",
+                offsetof(metrics_source_t, out_of_order));
+    put_header(t, "parksys_source_read_errors_total", "counter", "Failed reads, by errno");
+    for (int i = 0; i < count; i++)
+    {
+        metrics_source_t *src = &m->sources[i];
+        for (int e = 0; e < METRICS_ERRNOS; e++)
+            put(t, "parksys_source_read_errors_total{source=\"%s\",errno=\"%s\"} %llu\n", src->name,
+                errno_names[e], (unsigned long long)get(&src->errors[e]));
+    }
+
+    put_header(t, "parksys_spool_depth", "gauge", "Messages in the spool, sent or not, waiting for an acknowledgement");
+    put(t, "parksys_spool_depth %u\n", spool_count(spool));
+    put_header(t, "parksys_spool_capacity", "gauge", "Messages the spool holds");
+    put(t, "parksys_spool_capacity %u\n", spool->mask + 1);
+
+    put_header(t, "parksys_sent_messages_total", "counter", "Messages sent to a server, resent ones included");
+    put(t, "parksys_sent_messages_total %llu\n", (unsigned long long)get(&m->sent_msgs));
+    put_header(t, "parksys_sent_bytes_total", "counter", "Bytes of the frames of those messages");
+    put(t, "parksys_sent_bytes_total %llu\n", (unsigned long long)get(&m->sent_bytes));
+    put_header(t, "parksys_acked_messages_total", "counter", "Messages acknowledged by a server");
+    put(t, "parksys_acked_messages_total %llu\n", (unsigned long long)get(&m->acked_msgs));
+    put_header(t, "parksys_moved_messages_total", "counter", "Messages moved to another server by failovers and reloads");
+    put(t, "parksys_moved_messages_total %llu\n", (unsigned long long)get(&m->moved_msgs));
+    put_header(t, "parksys_lot_table_errors_total", "counter", "Lot tables from a server that could not be applied");
+    put(t, "parksys_lot_table_errors_total %llu\n", (unsigned long long)get(&m->lot_table_errors));
+
+    // Histograms count each bucket on its own, Prometheus wants them cumulative
+    uint64_t total = 0;
+    put_header(t, "parksys_batch_size", "histogram", "Messages per batch sent");
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        total += get(&m->batches[i]);
+        unsigned le = (2u << i) - 1;
+        put(t, "parksys_batch_size_bucket{le=\"%u\"} %llu\n", le < MAX_BATCH_MAX ? le : MAX_BATCH_MAX,
+            (unsigned long long)total);
+    }
+    put(t, "parksys_batch_size_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)total);
+    put(t, "parksys_batch_size_sum %llu\n", (unsigned long long)get(&m->sent_msgs));
+    put(t, "parksys_batch_size_count %llu\n", (unsigned long long)total);
+
+    total = 0;
+    put_header(t, "parksys_ack_latency_seconds", "histogram", "Time from sending a batch to its acknowledgement");
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS - 1; i++)
+    {
+        total += get(&m->acks[i]);
+        put(t, "parksys_ack_latency_seconds_bucket{le=\"%g\"} %llu\n", (1 << i) / 1000.0, (unsigned long long)total);
+    }
+    total += get(&m->acks[METRICS_LATENCY_BUCKETS - 1]);
+    put(t, "parksys_ack_latency_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)total);
+    put(t, "parksys_ack_latency_seconds_sum %.3f\n", get(&m->ack_ms) / 1000.0);
+    put(t, "parksys_ack_latency_seconds_count %llu\n", (unsigned long long)total);
+
+    // Per server, from the ETH side's own state. Removed servers show while they drain.
+    uint64_t up[MAX_SERVERS], connects[MAX_SERVERS], failures[MAX_SERVERS], queued[MAX_SERVERS], in_flight[MAX_SERVERS];
+    for (int i = 0; i < r->count; i++)
+    {
+        const sender_t *s = &r->links[i];
+        up[i] = s->state == SENDER_UP;
+        connects[i] = s->connects;
+        failures[i] = s->failures;
+        queued[i] = s->queued;
+        in_flight[i] = s->in_flight;
+    }
+    put_servers(t, r, "parksys_server_up", "gauge", "1 if connected to the server", up);
+    put_servers(t, r, "parksys_server_connects_total", "counter", "Connections established", connects);
+    put_servers(t, r, "parksys_server_failures_total", "counter", "Connections lost and connection attempts failed",
+                failures);
+    put_servers(t, r, "parksys_server_queued", "gauge", "Messages routed to the server and not acknowledged yet",
+                queued);
+    put_servers(t, r, "parksys_server_in_flight", "gauge", "Messages sent to the server and not acknowledged yet",
+                in_flight);
+}
+
+static void put_servers(text_t *t, const router_t *r, const char *name, const char *type, const char *help,
+                        const uint64_t *values)
+{
+    put_header(t, name, type, help);
+    for (int i = 0; i < r->count; i++)
+    {
+        if (!r->closed[i])
+            put(t, "%s{server=\"%s:%d\"} %llu\n", name, r->links[i].server.ip, r->links[i].server.port,
+                (unsigned long long)values[i]);
+    }
+}
@@ -0,0 +1,121 @@
+/**
+ * @file replay_source.c
+ * @author Leah
+ * @brief Replays a capture file of I2C records
+ * @date 2026-10-19
+ *
+ */
+#include "source.h"
+#include "log_limit.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+typedef struct
+{
+    FILE *file;
+    int64_t first_utc;                 // Time of the first record, -1 before it was read
+    uint64_t records;                  // Records read
+    uint64_t idle;                     // IDLE records skipped
+    uint64_t invalid;                  // Records out of range, skipped
+    log_limit_t invalid_limit;
+} replay_t;
+
+/**
+ * @brief Reads the next START/STOP record of the capture
+ *
+ * @param src Source
+ * @param msg Set to the message
+ * @param due_ms Set to its time after the first record
+ * @return int 1 if a message was read, 0 at the end of the capture
+ */
+static int replay_next(source_t *src, gps_msg_t *msg, int64_t *due_ms);
+
+/**
+ * @brief Closes the capture
+ *
+ * @param src Source
+ */
+static void replay_close(source_t *src);
+
+int replay_source_open(source_t *src)
+{
+    replay_t *r = calloc(1, sizeof(*r));
+    if (!r)
+    {
+        syslog(LOG_ERR, "[SRC] calloc: %s", strerror(errno));
+        return -1;
+    }
+
+    r->file = fopen(src->cfg->replay_path, "rb");
+    if (!r->file)
+    {
+        syslog(LOG_ERR, "[SRC] open %s: %s", src->cfg->replay_path, strerror(errno));
+        free(r);
+        return -1;
+    }
+    r->first_utc = -1;
+    r->invalid_limit = (log_limit_t)LOG_LIMIT_INIT("[SRC] Invalid records");
+
+    src->state = r;
+    src->next = replay_next;
+    src->close = replay_close;
+
+    syslog(LOG_INFO, "[SRC] Replaying %s at %s speed\n", src->cfg->replay_path,
+           src->cfg->source_realtime ? "1x" : "max");
+    return 0;
+}
+
+static int replay_next(source_t *src, gps_msg_t *msg, int64_t *due_ms)
+{
+    replay_t *r = src->state;
+
+    while (fread(msg, MSG_LEN, 1, r->file) == 1)
+    {
+        r->records++;
+
+        // Checked like records read from the bus, so a bad capture can't reach the spool
+        char why[64];
+        if (!gps_msg_check(msg, time(NULL), why, sizeof(why)))
+        {
+            r->invalid++;
+            src->stats.invalid++;
+            metric_add(&src->metrics->invalid, 1);
+            log_limited(&r->invalid_limit, LOG_WARNING, "[SRC] %s: record %llu: %s, skipping\n",
+                        src->cfg->replay_path, (unsigned long long)r->records, why);
+            continue;
+        }
+
+        if (r->first_utc < 0)
+            r->first_utc = msg->utc_sec;
+
+        if (msg->msg_type == MSGT_IDLE)
+        {
+            r->idle++;
+            src->stats.idle++;
+            metric_add(&src->metrics->idle, 1);
+            continue;
+        }
+
+        int64_t offset = (int64_t)msg->utc_sec - r->first_utc;
+        *due_ms = offset > 0 ? offset * 1000 : 0;
+        return 1;
+    }
+
+    if (ferror(r->file))
+        syslog(LOG_ERR, "[SRC] read %s: %s", src->cfg->replay_path, strerror(errno));
+    log_limit_flush(&r->invalid_limit);
+    syslog(LOG_INFO, "[SRC] End of %s, %llu IDLE and %llu invalid records skipped\n",
+           src->cfg->replay_path, (unsigned long long)r->idle, (unsigned long long)r->invalid);
+    return 0;
+}
+
+static void replay_close(source_t *src)
+{
+    replay_t *r = src->state;
+    fclose(r->file);
+    free(r);
+    src->state = NULL;
+}
@@ -0,0 +1,410 @@
+/**
+ * @file router.c
+ * @author Leah
+ * @brief Spreads spooled messages over the servers by license ID, with failover
+ * @date 2026-10-19
+ *
+ */
+#include "router.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <syslog.h>
+
+/**
+ * @brief Spreads the bits of a 32-bit value, so that close license IDs land far apart on the ring
+ *
+ * @param h Value
+ * @return uint32_t Mixed value
+ */
+static uint32_t mix32(uint32_t h);
+
+/**
+ * @brief Orders ring points by hash
+ */
+static int ring_cmp(const void *a, const void *b);
+
+/**
+ * @brief Finds the server of a license ID: the first reachable one from its place on the ring
+ *
+ * @param r Router
+ * @param license_id License ID
+ * @return int Index of the server, the owner of the license ID if none is reachable
+ */
+static int route(const router_t *r, uint32_t license_id);
+
+/**
+ * @brief Fills the hash ring with the points of the configured servers
+ *
+ * @param r Router
+ */
+static void build_ring(router_t *r);
+
+/**
+ * @brief Queues the messages of a sender for the servers that own them now
+ *
+ * @param r Router
+ * @param s Sender that isn't SENDER_UP, whose queue is emptied
+ * @return uint32_t Number of messages moved
+ */
+static uint32_t requeue(router_t *r, sender_t *s);
+
+/**
+ * @brief Draws an epoch for sequence numbers that can't be the spool's
+ *
+ * @return uint32_t Epoch
+ */
+static uint32_t random_epoch(void);
+
+/**
+ * @brief Updates the reachability of the servers, and moves the queues of
+ *        unreachable ones to reachable ones
+ *
+ * @param r Router
+ */
+static void check_health(router_t *r);
+
+/**
+ * @brief Disconnects from the removed servers that are done draining, or that
+ *        disconnected, moving what they still had queued
+ *
+ * @param r Router
+ */
+static void check_draining(router_t *r);
+
+int router_init(router_t *r, spool_t *spool, const Config *cfg)
+{
+    memset(r, 0, sizeof(*r));
+    r->cfg = cfg;
+    r->spool = spool;
+    r->count = cfg->server_count;
+    r->configured = r->count;
+    r->routed = spool_tail(spool);
+    if (sender_shared_init(&r->shared, spool, cfg) < 0)
+        return -1;
+
+    // One server keeps the spool's numbering. Servers that share the traffic can't,
+    // and don't keep their numbering across restarts either.
+    uint32_t epoch = spool->hdr->epoch;
+    uint32_t first_seq = r->routed;
+    if (r->count > 1)
+    {
+        epoch = random_epoch();
+        first_seq = 0;
+    }
+
+    for (int i = 0; i < r->count; i++)
+    {
+        if (sender_init(&r->links[i], spool, cfg, &cfg->servers[i], &r->shared, epoch, first_seq) < 0)
+            return -1;
+        r->healthy[i] = 1;
+    }
+    build_ring(r);
+
+    if (r->count > 1)
+        syslog(LOG_INFO, "[ETH] Routing vehicles over %d servers, failing over after %d ms",
+               r->count, cfg->failover_ms);
+    return 0;
+}
+
+int router_reload(router_t *r)
+{
+    sender_t old[MAX_SERVERS];
+    int old_healthy[MAX_SERVERS], old_closed[MAX_SERVERS], kept[MAX_SERVERS] = { 0 };
+    int old_count = r->count, old_configured = r->configured;
+    memcpy(old, r->links, sizeof(old));
+    memcpy(old_healthy, r->healthy, sizeof(old_healthy));
+    memcpy(old_closed, r->closed, sizeof(old_closed));
+    memset(r->closed, 0, sizeof(r->closed));
+
+    // Servers still listed keep their connection, queue and numbering, even
+    // when draining. New ones can't take the spool's numbering, which another
+    // server may have used.
+    uint32_t epoch = random_epoch();
+    r->configured = r->cfg->server_count;
+    for (int i = 0; i < r->configured; i++)
+    {
+        const server_addr_t *srv = &r->cfg->servers[i];
+        int j = 0;
+        while (j < old_count && (kept[j] || old_closed[j] || old[j].server.port != srv->port
+                                 || strcmp(old[j].server.ip, srv->ip) != 0))
+            j++;
+
+        if (j < old_count)
+        {
+            kept[j] = 1;
+            r->links[i] = old[j];
+            r->healthy[i] = j < old_configured ? old_healthy[j] : 1;
+            if (sender_reload(&r->links[i]) < 0)
+                return -1;
+        }
+        else
+        {
+            if (sender_init(&r->links[i], r->spool, r->cfg, srv, &r->shared, epoch, 0) < 0)
+                return -1;
+            r->healthy[i] = 1;
+            syslog(LOG_INFO, "[ETH] Added server %s:%d", srv->ip, srv->port);
+        }
+    }
+    r->count = r->configured;
+    build_ring(r);
+
+    // Removed servers drain behind the configured ones, with room for them all
+    // unless servers were added too
+    for (int j = 0; j < old_count; j++)
+    {
+        if (kept[j] || old_closed[j])
+            continue;
+
+        if (old[j].state == SENDER_UP && old[j].queued > 0 && r->count < MAX_SERVERS)
+        {
+            r->healthy[r->count] = 0;
+            r->links[r->count++] = old[j];
+            syslog(LOG_INFO, "[ETH] Removed server %s:%d, draining its %u queued messages",
+                   old[j].server.ip, old[j].server.port, old[j].queued);
+            continue;
+        }
+
+        sender_close(&old[j]);
+        uint32_t n = requeue(r, &old[j]);
+        syslog(LOG_INFO, "[ETH] Removed server %s:%d, moved its %u queued messages to the other servers",
+               old[j].server.ip, old[j].server.port, n);
+    }
+    return 0;
+}
+
+void router_route(router_t *r)
+{
+    if (r->configured > 1)
+        check_health(r);
+    if (r->count > r->configured)
+        check_draining(r);
+
+    uint32_t tail = spool_tail(r->spool);
+    uint32_t end = tail + spool_count(r->spool);
+    for (; r->routed != end; r->routed++)
+    {
+        int link = 0;
+        if (r->configured > 1)
+        {
+            gps_msg_t msg;
+            spool_peek(r->spool, r->routed - tail, &msg);
+            link = route(r, msg.license_id);
+        }
+        sender_enqueue(&r->links[link], r->routed);
+    }
+}
+
+void router_flush(router_t *r)
+{
+    for (int i = 0; i < r->count; i++)
+    {
+        if (r->links[i].state == SENDER_UP)
+            sender_flush(&r->links[i]);
+    }
+}
+
+void router_on_timeout(router_t *r)
+{
+    // Before a removed server that disconnected reconnects
+    if (r->count > r->configured)
+        check_draining(r);
+
+    for (int i = 0; i < r->count; i++)
+    {
+        if (!r->closed[i])
+            sender_on_timeout(&r->links[i]);
+    }
+    router_route(r);
+}
+
+int router_wants_messages(const router_t *r, uint32_t *have)
+{
+    *have = r->routed - spool_tail(r->spool);
+    for (int i = 0; i < r->configured; i++)
+    {
+        if (sender_wants_messages(&r->links[i]))
+            return 1;
+    }
+    return 0;
+}
+
+int64_t router_deadline_ms(const router_t *r)
+{
+    int64_t deadline = -1;
+    for (int i = 0; i < r->count; i++)
+    {
+        const sender_t *s = &r->links[i];
+        if (r->closed[i])
+            continue;
+
+        int64_t at = sender_deadline_ms(s);
+        if (at >= 0 && (deadline < 0 || at < deadline))
+            deadline = at;
+
+        // A disconnected server fails over failover_ms after the connection was lost
+        at = s->down_since_ms + r->cfg->failover_ms;
+        if (r->configured > 1 && r->healthy[i] && s->state != SENDER_UP && (deadline < 0 || at < deadline))
+            deadline = at;
+    }
+    return deadline;
+}
+
+int router_timeout_ms(const router_t *r)
+{
+    int64_t at = router_deadline_ms(r);
+    if (at < 0)
+        return -1;
+
+    int64_t left = at - monotonic_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+static uint32_t mix32(uint32_t h)
+{
+    // MurmurHash3 finalizer
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int ring_cmp(const void *a, const void *b)
+{
+    const ring_point_t *pa = a, *pb = b;
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+    return pa->link - pb->link;
+}
+
+static int route(const router_t *r, uint32_t license_id)
+{
+    uint32_t h = mix32(license_id);
+
+    // First point at or after h, wrapping around
+    int lo = 0, hi = r->ring_len;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (r->ring[mid].hash < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == r->ring_len)
+        lo = 0;
+
+    for (int i = 0; i < r->ring_len; i++)
+    {
+        int link = r->ring[(lo + i) % r->ring_len].link;
+        if (r->healthy[link])
+            return link;
+    }
+    return r->ring[lo].link;
+}
+
+static void check_health(router_t *r)
+{
+    int64_t now = monotonic_ms();
+    int any = 0;
+    for (int i = 0; i < r->configured; i++)
+    {
+        int healthy = sender_healthy(&r->links[i], now);
+        if (healthy && !r->healthy[i])
+            syslog(LOG_INFO, "[ETH] %s:%d is reachable again, routing its vehicles to it",
+                   r->cfg->servers[i].ip, r->cfg->servers[i].port);
+        else if (!healthy && r->healthy[i])
+            syslog(LOG_WARNING, "[ETH] %s:%d unreachable for %d ms, routing its vehicles to other servers",
+                   r->cfg->servers[i].ip, r->cfg->servers[i].port, r->cfg->failover_ms);
+        r->healthy[i] = healthy;
+        any |= healthy;
+    }
+
+    // Queues of unreachable servers wait where they are while no server is reachable
+    if (!any)
+        return;
+
+    for (int i = 0; i < r->configured; i++)
+    {
+        if (r->healthy[i] || r->links[i].queued == 0)
+            continue;
+
+        uint32_t n = requeue(r, &r->links[i]);
+        syslog(LOG_WARNING, "[ETH] Moved %u messages queued for %s:%d to other servers",
+               n, r->cfg->servers[i].ip, r->cfg->servers[i].port);
+    }
+}
+
+static void check_draining(router_t *r)
+{
+    for (int i = r->configured; i < r->count; i++)
+    {
+        sender_t *s = &r->links[i];
+        if (r->closed[i] || (s->state == SENDER_UP && s->queued > 0))
+            continue;
+
+        sender_close(s);
+        r->closed[i] = 1;
+        uint32_t n = requeue(r, s);
+        if (n > 0)
+            syslog(LOG_WARNING, "[ETH] Removed server %s:%d disconnected while draining, moved its %u queued messages to the other servers",
+                   s->server.ip, s->server.port, n);
+        else
+            syslog(LOG_INFO, "[ETH] Removed server %s:%d drained, disconnected", s->server.ip, s->server.port);
+    }
+}
+
+static void build_ring(router_t *r)
+{
+    // FNV-1a of "<ip>:<port>#<point>", so the ring doesn't depend on the order of the servers
+    r->ring_len = 0;
+    for (int i = 0; i < r->configured; i++)
+    {
+        for (int p = 0; p < RING_POINTS; p++)
+        {
+            char name[96];
+            int len = snprintf(name, sizeof(name), "%s:%d#%d", r->cfg->servers[i].ip, r->cfg->servers[i].port, p);
+            uint32_t h = 2166136261u;
+            for (int c = 0; c < len; c++)
+                h = (h ^ (uint8_t)name[c]) * 16777619u;
+
+            r->ring[r->ring_len].hash = mix32(h);
+            r->ring[r->ring_len].link = i;
+            r->ring_len++;
+        }
+    }
+    qsort(r->ring, r->ring_len, sizeof(r->ring[0]), ring_cmp);
+}
+
+static uint32_t requeue(router_t *r, sender_t *s)
+{
+    // In order, so each vehicle's messages stay in order on its new server.
+    // Messages the server recorded without acknowledging them are recorded twice.
+    uint32_t mask = r->spool->mask;
+    uint32_t tail = spool_tail(r->spool);
+    uint32_t pos;
+    uint32_t n = sender_drop_queue(s, &pos);
+    for (uint32_t k = 0; k < n; k++)
+    {
+        uint32_t next = r->shared.chain[pos & mask];
+        gps_msg_t msg;
+        spool_peek(r->spool, pos - tail, &msg);
+        sender_enqueue(&r->links[route(r, msg.license_id)], pos);
+        pos = next;
+    }
+    metric_add(&metrics()->moved_msgs, n);
+    return n;
+}
+
+static uint32_t random_epoch(void)
+{
+    uint32_t epoch;
+    if (getrandom(&epoch, sizeof(epoch), GRND_NONBLOCK) != sizeof(epoch))
+        epoch = (uint32_t)getpid() ^ (uint32_t)monotonic_ms();
+    return epoch;
+}
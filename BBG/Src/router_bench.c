@@ -0,0 +1,167 @@
+/**
+ * @file router_bench.c
+ * @author Leah
+ * @brief Checks how the router spreads vehicles over servers and fails them over, and measures its throughput
+ * @date 2026-10-19
+ *
+ */
+#include "router.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SERVERS 3                // Servers vehicles are spread over
+#define BENCH_VEHICLES 20000           // Vehicles, each sending a message per round
+#define BENCH_LICENSE 10000000         // License ID of the first vehicle
+#define BENCH_SPOOL (1 << 16)          // Spool capacity, room for the three rounds
+
+static Config cfg;
+static spool_t spool;
+static router_t rt;
+static int owner[BENCH_VEHICLES];      // Server each vehicle's first message went to
+
+/**
+ * @brief Spools a message of every vehicle, marked with its round in the time
+ */
+static void push_round(int round)
+{
+    for (uint32_t v = 0; v < BENCH_VEHICLES; v++)
+    {
+        gps_msg_t msg = {round % 2 ? MSGT_STOP : MSGT_START, BENCH_LICENSE + v, MIN_UTC + round, 32.0f, 34.8f};
+        spool_push(&spool, &msg);
+    }
+}
+
+/**
+ * @brief Finds the server every vehicle's message of a round is queued for
+ *
+ * @param round Round of the messages
+ * @param links Set to the server of each vehicle's message, -1 if it's not queued
+ */
+static void find_round(int round, int *links)
+{
+    uint32_t tail = spool_tail(&spool);
+    for (uint32_t v = 0; v < BENCH_VEHICLES; v++)
+        links[v] = -1;
+
+    for (int i = 0; i < rt.count; i++)
+    {
+        uint32_t pos = rt.links[i].head;
+        for (uint32_t k = 0; k < rt.links[i].queued; k++)
+        {
+            gps_msg_t msg;
+            spool_peek(&spool, pos - tail, &msg);
+            if (msg.utc_sec == MIN_UTC + (uint32_t)round)
+                links[msg.license_id - BENCH_LICENSE] = i;
+            pos = rt.shared.chain[pos & spool.mask];
+        }
+    }
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(void)
+{
+    static int links[BENCH_VEHICLES];
+    int failures = 0;
+
+    // Servers that are never connected to: they're only marked up or down
+    cfg.server_count = BENCH_SERVERS;
+    for (int i = 0; i < BENCH_SERVERS; i++)
+    {
+        snprintf(cfg.servers[i].ip, sizeof(cfg.servers[i].ip), "10.0.0.%d", i + 1);
+        cfg.servers[i].port = DEFAULT_SERVER_PORT;
+    }
+    cfg.failover_ms = DEFAULT_FAILOVER_MS;
+    cfg.batch_max = DEFAULT_BATCH_MAX;
+    cfg.ack_window = DEFAULT_ACK_WINDOW;
+    cfg.connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS;
+
+    if (metrics_open() < 0 || spool_open(&spool, SPOOL_ANON, BENCH_SPOOL) < 0 || router_init(&rt, &spool, &cfg) < 0)
+    {
+        fprintf(stderr, "Failed to set up the router\n");
+        return 1;
+    }
+    for (int i = 0; i < BENCH_SERVERS; i++)
+        rt.links[i].state = SENDER_UP;
+
+    // Every server gets a fair share of the vehicles
+    push_round(0);
+    int64_t t0 = now_ns();
+    router_route(&rt);
+    int64_t routed_ns = now_ns() - t0;
+    find_round(0, owner);
+    int share[BENCH_SERVERS] = {0};
+    for (uint32_t v = 0; v < BENCH_VEHICLES; v++)
+        share[owner[v]]++;
+    for (int i = 0; i < BENCH_SERVERS; i++)
+    {
+        if (share[i] < BENCH_VEHICLES / BENCH_SERVERS * 2 / 3 || share[i] > BENCH_VEHICLES / BENCH_SERVERS * 4 / 3)
+        {
+            fprintf(stderr, "Server %d got %d of %d vehicles\n", i, share[i], BENCH_VEHICLES);
+            failures++;
+        }
+    }
+
+    // A server down for failover_ms loses its vehicles, queued messages included. The others keep theirs.
+    rt.links[1].state = SENDER_DOWN;
+    rt.links[1].down_since_ms = monotonic_ms() - cfg.failover_ms - 1;
+    push_round(1);
+    uint64_t moved = metrics()->moved_msgs;
+    router_route(&rt);
+    moved = metrics()->moved_msgs - moved;
+    if (rt.links[1].queued != 0 || moved != (uint64_t)share[1])
+    {
+        fprintf(stderr, "Failover moved %llu messages and left %u, expected to move %d\n",
+                (unsigned long long)moved, rt.links[1].queued, share[1]);
+        failures++;
+    }
+
+    static int before[BENCH_VEHICLES];
+    find_round(0, before);
+    find_round(1, links);
+    int wrong = 0;
+    for (uint32_t v = 0; v < BENCH_VEHICLES; v++)
+    {
+        // START and STOP stay together, on the owner unless it's the failed server
+        if (before[v] != links[v] || before[v] < 0 || (owner[v] == 1) != (links[v] != owner[v]) || links[v] == 1)
+            wrong++;
+    }
+    if (wrong > 0)
+    {
+        fprintf(stderr, "%d vehicles routed wrong during the failover\n", wrong);
+        failures++;
+    }
+
+    // Once it's back, the server gets its vehicles again
+    rt.links[1].state = SENDER_UP;
+    push_round(2);
+    router_route(&rt);
+    find_round(2, links);
+    wrong = 0;
+    for (uint32_t v = 0; v < BENCH_VEHICLES; v++)
+        wrong += links[v] != owner[v];
+    if (wrong > 0)
+    {
+        fprintf(stderr, "%d vehicles not back on their server after it recovered\n", wrong);
+        failures++;
+    }
+
+    if (failures > 0)
+        return 1;
+    printf("Vehicles per server:");
+    for (int i = 0; i < BENCH_SERVERS; i++)
+        printf(" %d", share[i]);
+    printf("\nFailover moved %llu messages of server 1, and they came back with it\n"
+           "Routed %d messages over %d servers in %.3f ms (%.1f ns/message)\n",
+           (unsigned long long)moved, BENCH_VEHICLES, BENCH_SERVERS, routed_ns / 1e6,
+           (double)routed_ns / BENCH_VEHICLES);
+    return 0;
+}
@@ -0,0 +1,601 @@
+/**
+ * @file sender.c
+ * @author Leah
+ * @brief Non-blocking delivery of spooled messages to the server
+ * @date 2026-10-19
+ * 
+ */
+#include "sender.h"
+#include "batch_codec.h"
+#include "metrics.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <syslog.h>
+
+/**
+ * @brief Frames the next spooled messages into the output buffer
+ * 
+ * @param s Sender with an empty output buffer
+ * @return flush_result_t FLUSH_DONE if frames were added or there was nothing
+ *         to frame (out_len tells), FLUSH_HOLD if a partial batch is held back
+ */
+static flush_result_t frame_messages(sender_t *s);
+
+/**
+ * @brief Handles a frame from the server
+ * 
+ * @param s Sender
+ * @param frame Received bytes, starting with a frame
+ * @param len Number of received bytes
+ * @return long Length of the frame, 0 if it wasn't received in full yet, -1 if it's invalid
+ */
+static long handle_frame(sender_t *s, const uint8_t *frame, size_t len);
+
+int sender_shared_init(sender_shared_t *sh, spool_t *spool, const Config *cfg)
+{
+    memset(sh, 0, sizeof(*sh));
+    sh->stats.last_report = time(NULL);
+    sh->chain = malloc(((size_t)spool->mask + 1) * sizeof(*sh->chain));
+    sh->acked = calloc((size_t)spool->mask + 1, sizeof(*sh->acked));
+    if (!sh->chain || !sh->acked)
+    {
+        syslog(LOG_ERR, "[ETH] Out of memory");
+        return -1;
+    }
+
+    if (cfg->edge_lots)
+        lot_table_init(&sh->lots, cfg->lots_path);
+    return 0;
+}
+
+int sender_init(sender_t *s, spool_t *spool, const Config *cfg, const server_addr_t *server,
+                sender_shared_t *shared, uint32_t epoch, uint32_t first_seq)
+{
+    memset(s, 0, sizeof(*s));
+    s->cfg = cfg;
+    s->server = *server;
+    s->spool = spool;
+    s->shared = shared;
+    s->epoch = epoch;
+    s->head_seq = first_seq;
+    s->fd = -1;
+    s->state = SENDER_DOWN;
+    s->backoff_ms = BACKOFF_MIN_MS;
+    s->retry_at_ms = monotonic_ms();
+    s->down_since_ms = s->retry_at_ms;
+
+    s->out_cap = OUT_BUF_LEN(cfg->batch_max);
+    s->out = malloc(s->out_cap);
+    s->in = malloc(IN_BUF_LEN);
+    if (!s->out || !s->in)
+    {
+        syslog(LOG_ERR, "[ETH] Out of memory");
+        return -1;
+    }
+
+    // Gateways booted together have near identical pids and clocks
+    if (getrandom(&s->seed, sizeof(s->seed), GRND_NONBLOCK) != sizeof(s->seed))
+        s->seed = (unsigned int)getpid() ^ (unsigned int)monotonic_ms();
+    return 0;
+}
+
+int sender_reload(sender_t *s)
+{
+    // Never shrunk, since frames waiting in it are kept
+    size_t cap = OUT_BUF_LEN(s->cfg->batch_max);
+    if (cap <= s->out_cap)
+        return 0;
+
+    uint8_t *out = realloc(s->out, cap);
+    if (!out)
+    {
+        syslog(LOG_ERR, "[ETH] Out of memory");
+        return -1;
+    }
+    s->out = out;
+    s->out_cap = cap;
+    return 0;
+}
+
+void sender_close(sender_t *s)
+{
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+    s->state = SENDER_DOWN;
+    free(s->out);
+    free(s->in);
+    s->out = s->in = NULL;
+}
+
+void sender_enqueue(sender_t *s, uint32_t pos)
+{
+    if (s->queued == 0)
+        s->head = pos;
+    else
+        s->shared->chain[s->last & s->spool->mask] = pos;
+    if (s->queued == s->in_flight)
+        s->next = pos;
+    s->last = pos;
+    s->queued++;
+}
+
+uint32_t sender_drop_queue(sender_t *s, uint32_t *pos)
+{
+    uint32_t n = s->queued;
+    *pos = s->head;
+    s->head_seq += n;
+    s->queued = s->in_flight = 0;
+    s->ack_deadline_ms = 0;
+    return n;
+}
+
+int sender_healthy(const sender_t *s, int64_t now)
+{
+    return s->state == SENDER_UP || now - s->down_since_ms < s->cfg->failover_ms;
+}
+
+int sender_connect(sender_t *s)
+{
+    struct sockaddr_in serv;
+    memset(&serv, 0, sizeof(serv));
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(s->server.port);
+
+    if (inet_pton(AF_INET, s->server.ip, &serv.sin_addr) <= 0)
+    {
+        sender_fail(s, "invalid server IP");
+        return -1;
+    }
+
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0)
+    {
+        sender_fail(s, strerror(errno));
+        return -1;
+    }
+
+    // Batches are already coalesced, so don't let Nagle hold back their last segment
+    int one = 1;
+    if (setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    {
+        syslog(LOG_WARNING, "[ETH] TCP_NODELAY: %s", strerror(errno));
+    }
+
+    // With other servers to fail over to, don't wait for TCP to give up on unacknowledged segments
+    unsigned int user_timeout = (unsigned int)s->cfg->failover_ms;
+    if (s->cfg->server_count > 1
+        && setsockopt(s->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) < 0)
+    {
+        syslog(LOG_WARNING, "[ETH] TCP_USER_TIMEOUT: %s", strerror(errno));
+    }
+
+    if (connect(s->fd, (struct sockaddr*)&serv, sizeof(serv)) == 0)
+    {
+        s->state = SENDER_CONNECTING;
+        return sender_finish_connect(s);
+    }
+    if (errno != EINPROGRESS)
+    {
+        sender_fail(s, strerror(errno));
+        return -1;
+    }
+
+    s->state = SENDER_CONNECTING;
+    s->retry_at_ms = monotonic_ms() + s->cfg->connect_timeout_ms;
+    return 0;
+}
+
+int sender_finish_connect(sender_t *s)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err != 0)
+    {
+        sender_fail(s, strerror(err));
+        return -1;
+    }
+
+    syslog(LOG_INFO, "[ETH] Connected to %s:%d\n", s->server.ip, s->server.port);
+    s->state = SENDER_UP;
+    s->backoff_ms = BACKOFF_MIN_MS;
+    s->connects++;
+
+    // Introduce the gateway, then resend everything that wasn't acknowledged
+    uint32_t id = (uint32_t)s->cfg->gateway_id;
+    s->out[0] = FRAME_HELLO;
+    memcpy(s->out + 1, &id, sizeof(id));
+    memcpy(s->out + 5, &s->epoch, sizeof(s->epoch));
+    s->out_len = HELLO_FRAME_LEN;
+
+    // Ask for the lot table, unless the cached one is current
+    if (s->cfg->edge_lots)
+    {
+        s->out[s->out_len] = FRAME_LOTS_REQ;
+        memcpy(s->out + s->out_len + 1, &s->shared->lots.version, sizeof(s->shared->lots.version));
+        s->out_len += LOTS_REQ_FRAME_LEN;
+    }
+    s->out_off = 0;
+    s->in_len = 0;
+    s->next = s->head;
+    s->in_flight = 0;
+    s->times_len = 0;
+    s->blocked = 0;
+    s->hold_until_ms = 0;
+    s->ack_deadline_ms = 0;
+    return 0;
+}
+
+flush_result_t sender_flush(sender_t *s)
+{
+    s->blocked = 0;
+
+    while (1)
+    {
+        if (s->out_off == s->out_len)
+        {
+            s->out_len = s->out_off = 0;
+            flush_result_t r = frame_messages(s);
+            if (r != FLUSH_DONE || s->out_len == 0)
+                return r;
+        }
+
+        ssize_t wr = send(s->fd, s->out + s->out_off, s->out_len - s->out_off,
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (wr > 0)
+        {
+            s->out_off += (size_t)wr;
+            if (s->ack_deadline_ms == 0 && s->in_flight != 0)
+                s->ack_deadline_ms = monotonic_ms() + ACK_TIMEOUT_MS;
+            continue;
+        }
+        if (wr < 0 && errno == EINTR)
+            continue;
+        if (wr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            s->blocked = 1;
+            return FLUSH_BLOCKED;
+        }
+
+        sender_fail(s, wr < 0 ? strerror(errno) : "nothing written");
+        return FLUSH_FAILED;
+    }
+}
+
+static flush_result_t frame_messages(sender_t *s)
+{
+    // The window may have shrunk below what's in flight on a reload
+    uint32_t unframed = s->queued - s->in_flight;
+    uint32_t window = (uint32_t)s->cfg->ack_window;
+    uint32_t room = s->in_flight < window ? window - s->in_flight : 0;
+    uint32_t n = unframed;
+    if (n > room)
+        n = room;
+    if (n > (uint32_t)s->cfg->batch_max)
+        n = s->cfg->batch_max;
+    if (n == 0)
+        return FLUSH_DONE;
+
+    // Hold a partial batch back for a while, trading latency for fewer, fuller segments.
+    // Not when the window is what limits it, since only acks can help then.
+    if (n == unframed && n < (uint32_t)s->cfg->batch_max && s->cfg->batch_delay_ms > 0)
+    {
+        int64_t now = monotonic_ms();
+        if (s->hold_until_ms == 0)
+            s->hold_until_ms = now + s->cfg->batch_delay_ms;
+        if (now < s->hold_until_ms)
+            return FLUSH_HOLD;
+    }
+    s->hold_until_ms = 0;
+
+    const lot_table_t *lots = &s->shared->lots;
+    uint32_t tail = spool_tail(s->spool);
+    uint32_t pos = s->next;
+    uint8_t *p = s->out;
+    batch_enc_t enc;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        gps_msg_t msg;
+        uint32_t seq = s->head_seq + s->in_flight + i;
+        spool_peek(s->spool, pos - tail, &msg);
+        if (i + 1 < unframed)
+            pos = s->shared->chain[pos & s->spool->mask];
+
+        // Resolve the lot of a START here, so the server only has to check it
+        uint32_t lot = 0;
+        if (msg.msg_type == MSGT_START)
+            lot = lot_table_nearest(lots, msg.latitude, msg.longitude);
+
+        if (s->cfg->compress)
+        {
+            if (i % BATCH_MAX_EVENTS == 0)
+                batch_begin(&enc, p, seq, lots->version);
+            batch_add(&enc, &msg, lot);
+            if ((i + 1) % BATCH_MAX_EVENTS == 0 || i + 1 == n)
+                p += batch_finish(&enc);
+        }
+        else
+        {
+            p[0] = lot ? FRAME_DATA_LOT : FRAME_DATA;
+            memcpy(p + 1, &seq, sizeof(seq));
+            memcpy(p + 5, &msg, MSG_LEN);
+            if (lot)
+            {
+                memcpy(p + DATA_FRAME_LEN, &lot, sizeof(lot));
+                memcpy(p + DATA_FRAME_LEN + 4, &lots->version, sizeof(lots->version));
+                p += DATA_LOT_FRAME_LEN;
+            }
+            else
+            {
+                p += DATA_FRAME_LEN;
+            }
+        }
+
+        // Masked unless log_level=debug, so keep the arguments cheap
+        syslog(LOG_DEBUG, "[ETH] seq=%u, msg_type=%s(%u), license=%08u, lat=%.6f, lon=%.6f, utc=%u, lot=%u",
+               seq,
+               type_str(msg.msg_type),
+               msg.msg_type,
+               msg.license_id,
+               msg.latitude,
+               msg.longitude,
+               msg.utc_sec,
+               lot);
+    }
+
+    s->out_len = (size_t)(p - s->out);
+    s->next = pos;
+    s->in_flight += n;
+    batch_stats_record(&s->shared->stats, n, s->out_len);
+
+    if (s->times_len < SENDER_TIMES)
+    {
+        uint32_t slot = (s->times_head + s->times_len++) % SENDER_TIMES;
+        s->times_seq[slot] = s->head_seq + s->in_flight;
+        s->times_ms[slot] = monotonic_ms();
+    }
+    return FLUSH_DONE;
+}
+
+int sender_receive(sender_t *s)
+{
+    while (1)
+    {
+        ssize_t rd = recv(s->fd, s->in + s->in_len, IN_BUF_LEN - s->in_len, MSG_DONTWAIT);
+        if (rd == 0)
+        {
+            sender_fail(s, "closed by server");
+            return -1;
+        }
+        if (rd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            sender_fail(s, strerror(errno));
+            return -1;
+        }
+        s->in_len += (size_t)rd;
+
+        size_t off = 0;
+        while (off < s->in_len)
+        {
+            long len = handle_frame(s, s->in + off, s->in_len - off);
+            if (len < 0)
+            {
+                sender_fail(s, "unexpected frame from server");
+                return -1;
+            }
+            if (len == 0)
+                break;
+            off += (size_t)len;
+        }
+        memmove(s->in, s->in + off, s->in_len - off);
+        s->in_len -= off;
+    }
+}
+
+static long handle_frame(sender_t *s, const uint8_t *frame, size_t len)
+{
+    if (frame[0] == FRAME_LOTS)
+    {
+        uint32_t count;
+        if (len < 1 + LOT_TABLE_HDR_LEN)
+            return 0;
+        memcpy(&count, frame + 1 + 4, sizeof(count));
+        if (!s->cfg->edge_lots || count > LOT_TABLE_MAX)
+            return -1;
+
+        size_t need = 1 + LOT_TABLE_LEN(count);
+        if (len < need)
+            return 0;
+        if (lot_table_set(&s->shared->lots, frame + 1, need - 1, s->cfg->lots_path) < 0)
+        {
+            syslog(LOG_ERR, "[LOTS] Could not apply lot table with %u lots from %s:%d, keeping version %08x",
+                   count, s->server.ip, s->server.port, s->shared->lots.version);
+            metric_add(&metrics()->lot_table_errors, 1);
+        }
+        return (long)need;
+    }
+
+    if (frame[0] != FRAME_ACK)
+        return -1;
+    if (len < ACK_FRAME_LEN)
+        return 0;
+
+    uint32_t next;
+    memcpy(&next, frame + 1, sizeof(next));
+
+    // Only acks that move forward within what was sent count (wrap-around safe)
+    uint32_t acked = next - s->head_seq;
+    if ((int32_t)acked <= 0 || acked > s->in_flight)
+        return ACK_FRAME_LEN;
+
+    uint32_t mask = s->spool->mask;
+    for (uint32_t i = 0; i < acked; i++)
+    {
+        s->shared->acked[s->head & mask] = 1;
+        if (i + 1 < s->queued)
+            s->head = s->shared->chain[s->head & mask];
+    }
+    // Batches acknowledged as a whole (wrap-around safe)
+    int64_t now = monotonic_ms();
+    while (s->times_len > 0 && (int32_t)(next - s->times_seq[s->times_head]) >= 0)
+    {
+        metrics_ack_latency(now - s->times_ms[s->times_head]);
+        s->times_head = (s->times_head + 1) % SENDER_TIMES;
+        s->times_len--;
+    }
+    metric_add(&metrics()->acked_msgs, acked);
+
+    s->head_seq = next;
+    s->queued -= acked;
+    s->in_flight -= acked;
+    s->ack_deadline_ms = s->in_flight == 0 ? 0 : monotonic_ms() + ACK_TIMEOUT_MS;
+
+    // Messages of other servers may still hold the spool tail back
+    uint32_t tail = spool_tail(s->spool), count = spool_count(s->spool), n = 0;
+    while (n < count && s->shared->acked[(tail + n) & mask])
+    {
+        s->shared->acked[(tail + n) & mask] = 0;
+        n++;
+    }
+    if (n > 0)
+        spool_release(s->spool, n);
+    return ACK_FRAME_LEN;
+}
+
+void sender_on_timeout(sender_t *s)
+{
+    if (sender_timeout_ms(s) != 0)
+        return;
+
+    if (s->state == SENDER_DOWN)
+        sender_connect(s);
+    else if (s->state == SENDER_CONNECTING)
+        sender_fail(s, "connection timed out");
+    else if (s->ack_deadline_ms != 0 && monotonic_ms() >= s->ack_deadline_ms)
+        sender_fail(s, "no acknowledgement");
+}
+
+int sender_wants_messages(const sender_t *s)
+{
+    return s->state == SENDER_UP && !s->blocked && s->out_off == s->out_len
+           && s->in_flight == s->queued && s->in_flight < (uint32_t)s->cfg->ack_window;
+}
+
+void sender_fail(sender_t *s, const char *what)
+{
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+
+    // Frames cut in the middle are dropped by the server with the connection,
+    // and everything unacknowledged is resent on the next one
+    s->out_len = s->out_off = 0;
+    s->in_len = 0;
+    s->blocked = 0;
+
+    if (s->state == SENDER_UP)
+        s->down_since_ms = monotonic_ms();
+
+    int half = s->backoff_ms / 2;
+    int delay = half + rand_r(&s->seed) % (half + 1);
+
+    s->failures++;
+    syslog(LOG_ERR, "[ETH] %s to %s:%d failed: %s. Retry in %d ms\n",
+           s->state == SENDER_UP ? "Connection" : "Connecting",
+           s->server.ip, s->server.port, what, delay);
+
+    s->state = SENDER_DOWN;
+    s->retry_at_ms = monotonic_ms() + delay;
+    s->backoff_ms = s->backoff_ms * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : s->backoff_ms * 2;
+}
+
+int64_t sender_deadline_ms(const sender_t *s)
+{
+    if (s->state != SENDER_UP)
+        return s->retry_at_ms;
+    if (s->hold_until_ms != 0 && (s->ack_deadline_ms == 0 || s->hold_until_ms < s->ack_deadline_ms))
+        return s->hold_until_ms;
+    if (s->ack_deadline_ms != 0)
+        return s->ack_deadline_ms;
+    return -1;
+}
+
+int sender_timeout_ms(const sender_t *s)
+{
+    int64_t at = sender_deadline_ms(s);
+    if (at < 0)
+        return -1;
+
+    int64_t left = at - monotonic_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+void batch_stats_record(batch_stats_t *stats, uint32_t count, size_t bytes)
+{
+    int bucket = 0;
+    while (bucket < HIST_BUCKETS - 1 && (count >> (bucket + 1)) != 0)
+        bucket++;
+
+    stats->batches++;
+    stats->msgs += count;
+    stats->bytes += bytes;
+    stats->hist[bucket]++;
+
+    metrics_t *m = metrics();
+    metric_add(&m->sent_msgs, count);
+    metric_add(&m->sent_bytes, bytes);
+    metric_add(&m->batches[bucket], 1);
+
+    time_t now = time(NULL);
+    if (now - stats->last_report < HIST_PERIOD)
+        return;
+    stats->last_report = now;
+
+    char hist[HIST_BUCKETS * 24];
+    size_t len = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        if (stats->hist[i] == 0)
+            continue;
+
+        // Batches never exceed MAX_BATCH_MAX, which the top bucket starts at
+        unsigned lo = 1u << i, hi = (2u << i) - 1;
+        if (hi > MAX_BATCH_MAX)
+            hi = MAX_BATCH_MAX;
+        if (lo == hi)
+            len += snprintf(hist + len, sizeof(hist) - len, " %u:%llu",
+                            lo, (unsigned long long)stats->hist[i]);
+        else
+            len += snprintf(hist + len, sizeof(hist) - len, " %u-%u:%llu",
+                            lo, hi, (unsigned long long)stats->hist[i]);
+
+        // snprintf() returns the length it wanted, past the end once it truncates
+        if (len >= sizeof(hist))
+            len = sizeof(hist) - 1;
+    }
+
+    syslog(LOG_INFO, "[ETH] Sent %llu messages (%.1f bytes/message) in %llu batches, batch sizes:%s",
+           (unsigned long long)stats->msgs, stats->msgs ? (double)stats->bytes / stats->msgs : 0.0,
+           (unsigned long long)stats->batches, hist);
+}
+
+int64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file sim_source.c
+ * @author Leah
+ * @brief Deterministic simulation of many vehicles, using the STM32 GPS simulator's model
+ * @date 2026-10-19
+ *
+ */
+#include "source.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+// Same model as STM32/GPS_sim (gps_sim.h), one step per simulated second
+#define SIM_START_LAT 32.0263f     // Starting latitude
+#define SIM_START_LON 34.8257f     // Starting longitude
+#define SIM_SPREAD 0.05f           // Max distance of a vehicle's start from the starting point
+#define MOVE_STEP_MIN -0.0005f     // Minimum movement per step
+#define MOVE_STEP_MAX 0.0005f      // Maximum movement per step
+#define PARK_INTERVAL_MIN 5        // Minimum interval between parkings (sec)
+#define PARK_INTERVAL_MAX 15       // Maximum interval between parkings (sec)
+#define PARK_DURATION_MIN 1        // Minimum parking duration (sec)
+#define PARK_DURATION_MAX 10       // Maximum parking duration (sec)
+#define SIM_LICENSE_BASE 10000000U // License ID of the first vehicle
+
+typedef struct
+{
+    float lat;
+    float lon;
+    uint8_t is_parking;
+    uint32_t park_counter;
+    uint32_t park_duration;
+    uint32_t until_next_park;
+} vehicle_t;
+
+typedef struct
+{
+    vehicle_t *vehicles;
+    int count;
+    int cursor;                        // Next vehicle to step
+    uint32_t step;                     // Simulated seconds since the start
+    unsigned int seed;                 // Random state, fixed so every run is the same
+} sim_t;
+
+/**
+ * @brief Steps vehicles until one of them starts or stops parking
+ *
+ * @param src Source
+ * @param msg Set to the message
+ * @param due_ms Set to the simulated time of the step
+ * @return int Always 1, the simulation never ends
+ */
+static int sim_next(source_t *src, gps_msg_t *msg, int64_t *due_ms);
+
+/**
+ * @brief Frees the simulation
+ *
+ * @param src Source
+ */
+static void sim_close(source_t *src);
+
+/**
+ * @brief Moves a vehicle or advances its parking by one second
+ *
+ * @param sim Simulation
+ * @param v Vehicle
+ * @return uint8_t Message type the STM32 would send for this step
+ */
+static uint8_t step_vehicle(sim_t *sim, vehicle_t *v);
+
+/**
+ * @brief Draws a float in [min, max] from the simulation's random state
+ */
+static float rand_float_range(sim_t *sim, float min, float max);
+
+/**
+ * @brief Draws an integer in [min, max] from the simulation's random state
+ */
+static uint32_t rand_uint_range(sim_t *sim, uint32_t min, uint32_t max);
+
+int sim_source_open(source_t *src)
+{
+    sim_t *sim = calloc(1, sizeof(*sim));
+    if (sim)
+        sim->vehicles = calloc(src->cfg->sim_vehicles, sizeof(vehicle_t));
+    if (!sim || !sim->vehicles)
+    {
+        syslog(LOG_ERR, "[SRC] calloc: %s", strerror(errno));
+        free(sim);
+        return -1;
+    }
+
+    sim->count = src->cfg->sim_vehicles;
+    for (int i = 0; i < sim->count; i++)
+    {
+        vehicle_t *v = &sim->vehicles[i];
+        v->lat = SIM_START_LAT + rand_float_range(sim, -SIM_SPREAD, SIM_SPREAD);
+        v->lon = SIM_START_LON + rand_float_range(sim, -SIM_SPREAD, SIM_SPREAD);
+        v->until_next_park = rand_uint_range(sim, PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
+    }
+
+    src->state = sim;
+    src->next = sim_next;
+    src->close = sim_close;
+
+    syslog(LOG_INFO, "[SRC] Simulating %d vehicles at %s speed\n", sim->count,
+           src->cfg->source_realtime ? "1x" : "max");
+    return 0;
+}
+
+static int sim_next(source_t *src, gps_msg_t *msg, int64_t *due_ms)
+{
+    sim_t *sim = src->state;
+
+    while (1)
+    {
+        vehicle_t *v = &sim->vehicles[sim->cursor];
+        uint8_t type = step_vehicle(sim, v);
+
+        msg->msg_type = type;
+        msg->license_id = SIM_LICENSE_BASE + sim->cursor;
+        msg->utc_sec = MIN_UTC + sim->step;
+        msg->latitude = v->lat;
+        msg->longitude = v->lon;
+        *due_ms = (int64_t)sim->step * 1000;
+
+        if (++sim->cursor == sim->count)
+        {
+            sim->cursor = 0;
+            sim->step++;
+        }
+
+        if (type != MSGT_IDLE)
+            return 1;
+    }
+}
+
+static void sim_close(source_t *src)
+{
+    sim_t *sim = src->state;
+    free(sim->vehicles);
+    free(sim);
+    src->state = NULL;
+}
+
+static uint8_t step_vehicle(sim_t *sim, vehicle_t *v)
+{
+    uint8_t type = MSGT_IDLE;
+
+    if (v->is_parking)
+    {
+        if (v->park_counter == 0)
+        {
+            type = MSGT_START;
+        }
+        else if (v->park_counter >= v->park_duration)
+        {
+            type = MSGT_STOP;
+            v->is_parking = 0;
+            v->until_next_park = rand_uint_range(sim, PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
+            v->park_counter = 0;
+        }
+        v->park_counter++;
+    }
+    else
+    {
+        v->lat += rand_float_range(sim, MOVE_STEP_MIN, MOVE_STEP_MAX);
+        v->lon += rand_float_range(sim, MOVE_STEP_MIN, MOVE_STEP_MAX);
+
+        if (v->lat < LAT_MIN) v->lat = LAT_MIN;
+        if (v->lat > LAT_MAX) v->lat = LAT_MAX;
+        if (v->lon < LON_MIN) v->lon = LON_MIN;
+        if (v->lon > LON_MAX) v->lon = LON_MAX;
+
+        if (--v->until_next_park == 0)
+        {
+            v->is_parking = 1;
+            v->park_duration = rand_uint_range(sim, PARK_DURATION_MIN, PARK_DURATION_MAX);
+            v->park_counter = 0;
+        }
+    }
+    return type;
+}
+
+static float rand_float_range(sim_t *sim, float min, float max)
+{
+    return min + ((float)rand_r(&sim->seed) / RAND_MAX) * (max - min);
+}
+
+static uint32_t rand_uint_range(sim_t *sim, uint32_t min, uint32_t max)
+{
+    return min + (rand_r(&sim->seed) % (max - min + 1));
+}
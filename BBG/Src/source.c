@@ -0,0 +1,271 @@
+/**
+ * @file source.c
+ * @author Leah
+ * @brief Where START/STOP messages come from: I2C, a capture replay or a simulation
+ * @date 2026-10-19
+ *
+ */
+#include "source.h"
+#include "i2c_process.h"
+#include "sender.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define SMALL_DELAY 500
+
+static event_filter_t filter;          // Sources are opened one at a time in a process
+
+/**
+ * @brief Logs how fast an exhausted source was read
+ *
+ * @param src Source
+ */
+static void report_done(const source_t *src);
+
+/**
+ * @brief Reloads the config in the source process, and applies it to the source
+ *
+ * @param src Source
+ * @param cfg Running config
+ */
+static void reload(source_t *src, Config *cfg);
+
+/**
+ * @brief Tells if two configs list the same I2C targets, in the same order
+ *
+ * @param a Config
+ * @param b Config
+ * @return int 1 if they do, 0 otherwise
+ */
+static int same_targets(const Config *a, const Config *b);
+
+void run_source_process(spool_t *spool, Config *cfg)
+{
+    config_block_reload();
+
+    source_t src;
+    if (source_open(&src, cfg) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // run() returns when a reload is requested
+    while (src.run)
+    {
+        src.run(&src, spool);
+        reload(&src, cfg);
+    }
+
+    while (1)
+    {
+        if (config_reload_requested())
+            reload(&src, cfg);
+
+        int n = source_read(&src, spool);
+        if (n < 0)
+        {
+            usleep(SMALL_DELAY);
+        }
+        else if (!src.more)
+        {
+            int ms = source_idle_ms(&src);
+            if (ms < 0)
+                ms = SOURCE_IDLE_MS;
+            if (ms > 0)
+                usleep(ms * 1000);
+        }
+    }
+    source_close(&src);
+}
+
+int source_open(source_t *src, const Config *cfg)
+{
+    memset(src, 0, sizeof(*src));
+    src->cfg = cfg;
+    src->start_ms = monotonic_ms();
+    src->stats.last_report_ms = src->start_ms;
+    src->filter = &filter;
+
+    // The I2C source has counters for each of its devices
+    if (cfg->source != SOURCE_I2C)
+    {
+        src->metrics = metrics_sources(1);
+        strcpy(src->metrics->name, cfg->source == SOURCE_SIM ? "sim" : "replay");
+    }
+
+    switch (cfg->source)
+    {
+    case SOURCE_REPLAY:
+        return replay_source_open(src);
+    case SOURCE_SIM:
+        return sim_source_open(src);
+    default:
+        return i2c_source_open(src);
+    }
+}
+
+int source_reload(source_t *src, Config *cfg, const Config *old)
+{
+    if (cfg->source != SOURCE_I2C || same_targets(cfg, old))
+        return 0;
+
+    source_close(src);
+    if (source_open(src, cfg) == 0)
+        return 0;
+
+    // Back to the devices that were being read
+    syslog(LOG_ERR, "[SRC] Can't open the reloaded I2C targets, keeping the running ones");
+    memcpy(cfg->i2c_targets, old->i2c_targets, sizeof(cfg->i2c_targets));
+    cfg->i2c_target_count = old->i2c_target_count;
+    return source_open(src, cfg);
+}
+
+int source_read(source_t *src, spool_t *spool)
+{
+    if (src->read)
+        return src->read(src, spool);
+
+    const int64_t now = monotonic_ms() - src->start_ms;
+    int n = 0;
+
+    src->blocked = 0;
+    while (n < src->cfg->i2c_batch)
+    {
+        if (!src->has_pending)
+        {
+            if (src->done)
+                break;
+            if (!src->next(src, &src->pending, &src->pending_due_ms))
+            {
+                src->done = 1;
+                report_done(src);
+                break;
+            }
+            src->has_pending = 1;
+        }
+
+        if (src->cfg->source_realtime && src->pending_due_ms > now)
+            break;
+
+        // A replayed capture may hold frames read twice
+        int verdict = event_filter_check(src->filter, &src->pending);
+        if (verdict == FILTER_DUPLICATE)
+        {
+            src->stats.duplicates++;
+            metric_add(&src->metrics->duplicates, 1);
+            src->has_pending = 0;
+            continue;
+        }
+
+        // Unlike the bus, a generated message can wait, so a full spool slows the source down
+        if (spool_push(spool, &src->pending) < 0)
+        {
+            src->blocked = 1;
+            break;
+        }
+        event_filter_commit(src->filter, &src->pending);
+        if (verdict == FILTER_UNEXPECTED)
+        {
+            src->stats.unexpected++;
+            metric_add(&src->metrics->unexpected, 1);
+        }
+        else if (verdict == FILTER_OUT_OF_ORDER)
+        {
+            src->stats.out_of_order++;
+            metric_add(&src->metrics->out_of_order, 1);
+        }
+        if (src->pending.msg_type == MSGT_START)
+        {
+            src->stats.starts++;
+            metric_add(&src->metrics->starts, 1);
+        }
+        else
+        {
+            src->stats.stops++;
+            metric_add(&src->metrics->stops, 1);
+        }
+        src->has_pending = 0;
+        src->produced++;
+        n++;
+    }
+
+    if (n > 0)
+    {
+        src->stats.frames++;
+        metric_add(&src->metrics->frames, 1);
+    }
+    src->more = n == src->cfg->i2c_batch;
+    spool_sync(spool);
+    source_stats_report(&src->stats, src->cfg->source == SOURCE_SIM ? "sim" : "replay", spool);
+    return n;
+}
+
+int source_idle_ms(const source_t *src)
+{
+    if (src->read)
+        return 0;
+    if (src->blocked)
+        return 1;
+    if (src->done && !src->has_pending)
+        return -1;
+    if (!src->cfg->source_realtime || !src->has_pending)
+        return 0;
+
+    int64_t left = src->pending_due_ms - (monotonic_ms() - src->start_ms);
+    return left > 0 ? (int)left : 0;
+}
+
+void source_close(source_t *src)
+{
+    if (src->close)
+        src->close(src);
+    src->close = NULL;
+}
+
+static void reload(source_t *src, Config *cfg)
+{
+    Config old = *cfg;
+    if (reload_config(cfg) == 0 && source_reload(src, cfg, &old) < 0)
+        exit(EXIT_FAILURE);
+}
+
+static int same_targets(const Config *a, const Config *b)
+{
+    if (a->i2c_target_count != b->i2c_target_count)
+        return 0;
+    for (int i = 0; i < a->i2c_target_count; i++)
+    {
+        if (a->i2c_targets[i].addr != b->i2c_targets[i].addr
+            || strcmp(a->i2c_targets[i].bus, b->i2c_targets[i].bus) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void report_done(const source_t *src)
+{
+    int64_t elapsed = monotonic_ms() - src->start_ms;
+    syslog(LOG_INFO, "[SRC] Source exhausted: %llu messages in %lld ms (%.0f msg/s)\n",
+           (unsigned long long)src->produced, (long long)elapsed,
+           elapsed > 0 ? src->produced * 1000.0 / elapsed : 0.0);
+}
+
+void source_stats_report(source_stats_t *st, const char *name, spool_t *spool)
+{
+    int64_t now = monotonic_ms();
+    if (now - st->last_report_ms < SOURCE_REPORT_MS)
+        return;
+
+    syslog(LOG_INFO, "[SRC] %s, last %lld s: %" PRIu64 " frames, %" PRIu64 " START, %" PRIu64 " STOP, "
+           "%" PRIu64 " IDLE, %" PRIu64 " invalid, %" PRIu64 " duplicate, %" PRIu64 " unexpected, "
+           "%" PRIu64 " out of order, %" PRIu64 " read errors, %" PRIu64 " dropped, spool depth %u\n",
+           name, (long long)(now - st->last_report_ms) / 1000, st->frames, st->starts, st->stops,
+           st->idle, st->invalid, st->duplicates, st->unexpected, st->out_of_order, st->errors, st->dropped,
+           spool_count(spool));
+
+    memset(st, 0, sizeof(*st));
+    st->last_report_ms = now;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file spool.c
+ * @author Leah
+ * @brief Persistent message spool between the I2C and ETH processes
+ * @date 2026-10-19
+ * 
+ */
+#include "spool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPOOL_HDR_LEN 256              // Header area, records start after it
+
+_Static_assert(sizeof(spool_hdr_t) <= SPOOL_HDR_LEN, "spool header too large");
+
+/**
+ * @brief Rounds up to the next power of 2
+ * 
+ * @param n Value to round
+ * @return uint32_t Power of 2 not smaller than n
+ */
+static uint32_t round_pow2(uint32_t n);
+
+/**
+ * @brief Draws a new non-zero spool epoch
+ * 
+ * @return uint32_t Epoch
+ */
+static uint32_t new_epoch(void);
+
+/**
+ * @brief Writes a range of the mapping to the file, widened to whole pages
+ * 
+ * @param sp Spool
+ * @param off Offset of the range in the mapping
+ * @param len Length of the range
+ * @return int 0 on success, -1 on failure
+ */
+static int sync_range(spool_t *sp, size_t off, size_t len);
+
+int spool_open(spool_t *sp, const char *path, uint32_t records)
+{
+    uint32_t capacity = round_pow2(records);
+    size_t map_len = SPOOL_HDR_LEN + (size_t)capacity * MSG_LEN;
+    void *p;
+
+    if (strcmp(path, SPOOL_ANON) == 0)
+    {
+        // Zero-filled, so it's initialized below like a new file
+        p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+    else
+    {
+        int fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0)
+        {
+            syslog(LOG_ERR, "[SPOOL] open %s: %s", path, strerror(errno));
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || ((size_t)st.st_size != map_len && ftruncate(fd, map_len) < 0))
+        {
+            syslog(LOG_ERR, "[SPOOL] resize %s: %s", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+
+    if (p == MAP_FAILED)
+    {
+        syslog(LOG_ERR, "[SPOOL] mmap %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    // Non-blocking so a signal never stalls the producer, the consumer polls it
+    sp->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (sp->wake_fd < 0)
+    {
+        syslog(LOG_ERR, "[SPOOL] eventfd: %s", strerror(errno));
+        munmap(p, map_len);
+        return -1;
+    }
+
+    sp->hdr = p;
+    sp->recs = (uint8_t *)p + SPOOL_HDR_LEN;
+    sp->map_len = map_len;
+    sp->mask = capacity - 1;
+    sp->file_backed = strcmp(path, SPOOL_ANON) != 0;
+
+    spool_hdr_t *h = sp->hdr;
+    uint32_t head = atomic_load(&h->head);
+    uint32_t tail = atomic_load(&h->tail);
+
+    if (h->magic != SPOOL_MAGIC || h->msg_len != MSG_LEN || h->capacity != capacity
+        || head - tail > capacity)
+    {
+        if (h->magic == SPOOL_MAGIC)
+            syslog(LOG_WARNING, "[SPOOL] %s has a different layout, discarding its content", path);
+
+        h->msg_len = MSG_LEN;
+        h->capacity = capacity;
+        h->epoch = new_epoch();
+        atomic_store(&h->head, 0);
+        atomic_store(&h->tail, 0);
+        atomic_store(&h->dropped, 0);
+        h->magic = SPOOL_MAGIC;
+        msync(p, SPOOL_HDR_LEN, MS_SYNC);
+    }
+    else if (head != tail)
+    {
+        syslog(LOG_INFO, "[SPOOL] Recovered %u unsent messages from %s", head - tail, path);
+    }
+    atomic_store(&h->waiting, 0);     // Left over from a crashed consumer
+    if (h->epoch == 0)
+        h->epoch = new_epoch();       // Spool created before epochs existed
+    sp->synced = atomic_load(&h->head);
+    sp->synced_ms = 0;
+
+    return 0;
+}
+
+void spool_close(spool_t *sp)
+{
+    if (sp->hdr)
+    {
+        munmap(sp->hdr, sp->map_len);
+        sp->hdr = NULL;
+    }
+    if (sp->wake_fd >= 0)
+    {
+        close(sp->wake_fd);
+        sp->wake_fd = -1;
+    }
+}
+
+int spool_push(spool_t *sp, const gps_msg_t *msg)
+{
+    spool_hdr_t *h = sp->hdr;
+    uint32_t head = atomic_load_explicit(&h->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+
+    if (head - tail > sp->mask)
+    {
+        atomic_fetch_add_explicit(&h->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    memcpy(sp->recs + (size_t)(head & sp->mask) * MSG_LEN, msg, MSG_LEN);
+
+    // Publish the record only after it's fully written
+    atomic_store_explicit(&h->head, head + 1, memory_order_release);
+
+    // Pairs with the fence in spool_wait(): either the consumer sees the new
+    // head before sleeping, or we see its waiting flag and wake it
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&h->waiting, memory_order_relaxed))
+    {
+        uint64_t one = 1;
+        if (write(sp->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            syslog(LOG_ERR, "[SPOOL] eventfd write: %s", strerror(errno));
+    }
+    return 0;
+}
+
+void spool_sync(spool_t *sp)
+{
+    spool_hdr_t *h = sp->hdr;
+    uint32_t head = atomic_load_explicit(&h->head, memory_order_relaxed);
+    if (!sp->file_backed || head == sp->synced)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (now - sp->synced_ms < SPOOL_SYNC_MS)
+        return;
+    sp->synced_ms = now;
+
+    // Records first, so the head on disk never covers records that aren't
+    uint32_t n = head - sp->synced;
+    size_t first = (size_t)(sp->synced & sp->mask) * MSG_LEN;
+    size_t last = (size_t)(head & sp->mask) * MSG_LEN;
+    int rc;
+    if (n > sp->mask)
+        rc = sync_range(sp, SPOOL_HDR_LEN, (size_t)(sp->mask + 1) * MSG_LEN);
+    else if (first < last)
+        rc = sync_range(sp, SPOOL_HDR_LEN + first, last - first);
+    else
+        rc = sync_range(sp, SPOOL_HDR_LEN + first, (size_t)(sp->mask + 1) * MSG_LEN - first) |
+             sync_range(sp, SPOOL_HDR_LEN, last);
+    rc |= sync_range(sp, 0, SPOOL_HDR_LEN);
+
+    if (rc < 0)
+        syslog(LOG_ERR, "[SPOOL] msync: %s", strerror(errno));
+    else
+        sp->synced = head;
+}
+
+uint32_t spool_count(spool_t *sp)
+{
+    spool_hdr_t *h = sp->hdr;
+    return atomic_load_explicit(&h->head, memory_order_acquire)
+           - atomic_load_explicit(&h->tail, memory_order_relaxed);
+}
+
+uint32_t spool_wait(spool_t *sp, uint32_t have, int timeout_ms)
+{
+    uint32_t n = spool_count(sp);
+    if (n > have)
+        return n;
+
+    if (spool_wait_begin(sp, have))
+    {
+        struct pollfd pfd = { .fd = sp->wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR)
+            syslog(LOG_ERR, "[SPOOL] poll: %s", strerror(errno));
+    }
+    spool_wait_end(sp);
+
+    return spool_count(sp);
+}
+
+int spool_wait_begin(spool_t *sp, uint32_t have)
+{
+    atomic_store_explicit(&sp->hdr->waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    return spool_count(sp) <= have;
+}
+
+void spool_wait_end(spool_t *sp)
+{
+    atomic_store_explicit(&sp->hdr->waiting, 0, memory_order_relaxed);
+
+    // Reset the counter, the messages themselves are counted by head
+    uint64_t wakeups;
+    if (read(sp->wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "[SPOOL] eventfd read: %s", strerror(errno));
+}
+
+uint32_t spool_tail(spool_t *sp)
+{
+    return atomic_load_explicit(&sp->hdr->tail, memory_order_relaxed);
+}
+
+void spool_peek(spool_t *sp, uint32_t offset, gps_msg_t *msg)
+{
+    uint32_t tail = atomic_load_explicit(&sp->hdr->tail, memory_order_relaxed);
+    memcpy(msg, sp->recs + (size_t)((tail + offset) & sp->mask) * MSG_LEN, MSG_LEN);
+}
+
+void spool_release(spool_t *sp, uint32_t n)
+{
+    atomic_fetch_add_explicit(&sp->hdr->tail, n, memory_order_release);
+}
+
+static uint32_t round_pow2(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n && p < (1u << 31))
+        p <<= 1;
+    return p;
+}
+
+static uint32_t new_epoch(void)
+{
+    uint32_t epoch = 0;
+    if (getrandom(&epoch, sizeof(epoch), GRND_NONBLOCK) != sizeof(epoch))
+        epoch = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    return epoch ? epoch : 1;
+}
+
+static int sync_range(spool_t *sp, size_t off, size_t len)
+{
+    if (len == 0)
+        return 0;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = off / page * page;
+    return msync((uint8_t *)sp->hdr + start, off + len - start, MS_SYNC);
+}
@@ -23,6 +23,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "gps_sim.h"
+#include "log_uart.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -43,10 +44,12 @@
 /* Private variables ---------------------------------------------------------*/
 
 I2C_HandleTypeDef hi2c1;
+DMA_HandleTypeDef hdma_i2c1_tx;
 
 TIM_HandleTypeDef htim7;
 
 UART_HandleTypeDef huart3;
+DMA_HandleTypeDef hdma_usart3_tx;
 
 /* Definitions for defaultTask */
 osThreadId_t defaultTaskHandle;
@@ -81,6 +84,7 @@ extern volatile uint32_t utc_seconds;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_USART3_UART_Init(void);
 static void MX_TIM7_Init(void);
@@ -94,16 +98,17 @@ void StartI2CSenderTask(void *argument);
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+// printf goes through the log ring as well, never waiting for the UART
 int __io_putchar(int ch) {
-	HAL_UART_Transmit(&huart3, (uint8_t*) &ch, 1, 0xFFFF);
+	char c = ch;
+	log_write(&c, 1);
 	return ch;
 }
 
 int _write(int file, char *ptr, int len) {
-	char *cr = "\r";
-	HAL_UART_Transmit(&huart3, (uint8_t*) ptr, len, 0xFFFF);
-	HAL_UART_Transmit(&huart3, (uint8_t*) cr, 1, 0xFFFF);
-	return len + 1;
+	log_write(ptr, len);
+	log_write("\r", 1);
+	return len;
 }
 /* USER CODE END 0 */
 
@@ -136,6 +141,7 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_I2C1_Init();
   MX_USART3_UART_Init();
   MX_TIM7_Init();
@@ -374,6 +380,25 @@ static void MX_USART3_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Stream3_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+  /* DMA1_Stream6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -471,7 +496,8 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     HAL_IncTick();
   }
   /* USER CODE BEGIN Callback 1 */
-  if (htim->Instance == TIM7)
+  // With a time scale, the GPS task runs the simulated clock
+  if (htim->Instance == TIM7 && SIM_TIME_SCALE == 1)
   {
     utc_seconds++;
   }
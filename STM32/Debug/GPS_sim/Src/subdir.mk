@@ -6,15 +6,18 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../GPS_sim/Src/gps_sim.c \
-../GPS_sim/Src/i2c_send.c 
+../GPS_sim/Src/i2c_send.c \
+../GPS_sim/Src/log_uart.c 
 
 OBJS += \
 ./GPS_sim/Src/gps_sim.o \
-./GPS_sim/Src/i2c_send.o 
+./GPS_sim/Src/i2c_send.o \
+./GPS_sim/Src/log_uart.o 
 
 C_DEPS += \
 ./GPS_sim/Src/gps_sim.d \
-./GPS_sim/Src/i2c_send.d 
+./GPS_sim/Src/i2c_send.d \
+./GPS_sim/Src/log_uart.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -24,7 +27,7 @@ GPS_sim/Src/%.o GPS_sim/Src/%.su GPS_sim/Src/%.cyclo: ../GPS_sim/Src/%.c GPS_sim
 clean: clean-GPS_sim-2f-Src
 
 clean-GPS_sim-2f-Src:
-	-$(RM) ./GPS_sim/Src/gps_sim.cyclo ./GPS_sim/Src/gps_sim.d ./GPS_sim/Src/gps_sim.o ./GPS_sim/Src/gps_sim.su ./GPS_sim/Src/i2c_send.cyclo ./GPS_sim/Src/i2c_send.d ./GPS_sim/Src/i2c_send.o ./GPS_sim/Src/i2c_send.su
+	-$(RM) ./GPS_sim/Src/gps_sim.cyclo ./GPS_sim/Src/gps_sim.d ./GPS_sim/Src/gps_sim.o ./GPS_sim/Src/gps_sim.su ./GPS_sim/Src/i2c_send.cyclo ./GPS_sim/Src/i2c_send.d ./GPS_sim/Src/i2c_send.o ./GPS_sim/Src/i2c_send.su ./GPS_sim/Src/log_uart.cyclo ./GPS_sim/Src/log_uart.d ./GPS_sim/Src/log_uart.o ./GPS_sim/Src/log_uart.su
 
 .PHONY: clean-GPS_sim-2f-Src
 
@@ -26,9 +26,19 @@
 #define PARK_DURATION_MIN 1      // Minimum parking duration (sec)
 #define PARK_DURATION_MAX 10     // Maximum parking duration (sec)
 
-#define LICENSE_ID 12345678U     // Device's license id
+#define LICENSE_ID 12345678U     // Device's license id, the first of the simulated vehicles
 
-#define START_UTC 1751371200     // Tuesday, July 1, 2025 12:00:00 PM
+#define SIM_VEHICLES 1           // Simulated vehicles, with license ids from LICENSE_ID on. Only one sends IDLE messages.
+#define SIM_STEP_MS 1000         // Time between two steps of a vehicle
+#define SIM_SLICES 10            // Groups of vehicles stepped in turn over SIM_STEP_MS, to spread their messages
+#define SIM_SPREAD 0.05f         // Starting positions are up to this far from START_LAT/START_LON
+#define SIM_TIME_SCALE 1         // Simulated seconds per real second, 0 for as fast as the I2C master reads
+#define SIM_HORIZON_SEC (30 * 86400) // With a time scale, simulated time starts this long before the build
+
+#define START_UTC 1751371200     // Tuesday, July 1, 2025 12:00:00 PM, where the clock starts at SIM_TIME_SCALE 1
+
+#define FRAME_MAX_RECORDS 8      // Messages per I2C frame, must match the BBG's i2c_batch
+#define FRAME_RING 4             // Frames ready for the master to read
 
 typedef enum {
     MSG_IDLE = 0,
@@ -44,4 +54,9 @@ typedef struct __attribute__((packed)) {
     float longitude;
 } gps_msg_t;
 
+typedef struct __attribute__((packed)) {
+    uint8_t count;                        // Messages in use, the rest are zeroed
+    gps_msg_t records[FRAME_MAX_RECORDS];
+} i2c_frame_t;
+
 #endif /* INC_GPS_SIM_H_ */
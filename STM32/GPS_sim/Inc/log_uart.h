@@ -0,0 +1,38 @@
+/*
+ * log_uart.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: leah
+ */
+
+#ifndef INC_LOG_UART_H_
+#define INC_LOG_UART_H_
+
+#include <stdint.h>
+
+#define LOG_RING_SIZE 2048       // Bytes waiting for the UART, a power of 2
+#define LOG_LINE_MAX 128         // Longest log line, longer ones are cut
+
+// A log line being built, on the caller's stack
+typedef struct {
+    char buf[LOG_LINE_MAX];
+    uint32_t len;
+} log_line_t;
+
+// Line builders. They only use integer arithmetic, never printf.
+void log_str(log_line_t *line, const char *s);
+void log_u32(log_line_t *line, uint32_t v, uint8_t width);   // Zero padded to width digits
+void log_deg(log_line_t *line, float deg);                   // Degrees with 6 decimals
+void log_utc(log_line_t *line, uint32_t utc_sec);            // "YYYY-MM-DD HH:MM:SS UTC"
+
+// Ends a line and queues it for the UART. Never blocks: a line that doesn't
+// fit in the ring is dropped and counted.
+void log_end(log_line_t *line);
+
+// Queues raw bytes, for printf
+void log_write(const char *data, uint32_t len);
+
+// Lines dropped on a full ring
+uint32_t log_dropped(void);
+
+#endif /* INC_LOG_UART_H_ */
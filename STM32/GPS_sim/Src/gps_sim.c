@@ -6,69 +6,158 @@
  */
 #include "main.h"
 #include "gps_sim.h"
+#include "log_uart.h"
 #include "cmsis_os.h"
 #include <stdlib.h>
 #include <string.h>
 
+// Vehicles stepped each slice. A single vehicle steps alone, once per SIM_STEP_MS.
+#define SLICES (SIM_VEHICLES < SIM_SLICES ? SIM_VEHICLES : SIM_SLICES)
+
+// IDLE messages of hundreds of vehicles would only crowd the bus, the BBG just counts them
+#define SEND_IDLE (SIM_VEHICLES == 1)
+
+// __TIME__ is the build machine's local time, up to 14 hours ahead of UTC
+#define BUILD_TZ_MARGIN_SEC (14 * 3600)
+
+typedef struct {
+	float lat;
+	float lon;
+	uint32_t license_id;
+	uint16_t park_counter;
+	uint16_t park_duration;
+	uint16_t until_next_park;
+	uint8_t is_parking;
+} vehicle_t;
+
 // Private utility functions
 static uint32_t rand_uint_range(uint32_t min, uint32_t max);
 static float rand_float_range(float min, float max);
-static void update_position_randomly(void);
-static void send_gps_msg(msg_type_t type);
+static void update_position_randomly(vehicle_t *v);
+static void step_vehicle(vehicle_t *v);
+static void send_gps_msg(const vehicle_t *v, msg_type_t type);
+static uint32_t build_utc(void);
 
 // Globals
 volatile uint32_t utc_seconds = START_UTC; 
-static float lat = 0.0f;
-static float lon = 0.0f;
-static uint8_t is_parking = 0;
-static uint32_t park_counter = 0;
-static uint32_t park_duration = 0;
-static uint32_t until_next_park = 0;
+static vehicle_t vehicles[SIM_VEHICLES]; // Fixed table, no allocation
+static uint32_t dropped = 0;
 
 extern osMessageQueueId_t gpsMsgQueueHandle;
 
 void StartGPSTask(void *argument)
 {
 	srand(0);
-	lat = START_LAT;
-	lon = START_LON;
+	for (uint32_t i = 0; i < SIM_VEHICLES; i++)
+	{
+		vehicle_t *v = &vehicles[i];
+		v->license_id = LICENSE_ID + i;
+		v->lat = START_LAT;
+		v->lon = START_LON;
+		if (SIM_VEHICLES > 1)
+		{
+			v->lat += rand_float_range(-SIM_SPREAD, SIM_SPREAD);
+			v->lon += rand_float_range(-SIM_SPREAD, SIM_SPREAD);
+		}
+		v->until_next_park = rand_uint_range(PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
+	}
 
-	until_next_park = rand_uint_range(PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
+	uint32_t start = osKernelGetTickCount();
+	uint64_t sim_ms = 0;                  // Simulated time since the start, wraps after ages even at max speed
 
+#if SIM_TIME_SCALE != 1
+	// The BBG rejects times in the future. The board has no real clock, but real
+	// time is past the build, so the simulated clock starts SIM_HORIZON_SEC before
+	// it and never passes the build time plus the real time elapsed since.
+	const uint32_t built = build_utc();
+	uint32_t base = built - SIM_HORIZON_SEC;
+	uint8_t caught_up = 0;
+	uint32_t pace_tick = 0;               // Once caught up: tick and simulated time real pacing counts from
+	uint64_t pace_ms = 0;
+	utc_seconds = base;
+#endif
 	while (1)
 	{
-		if (is_parking)
+		for (uint32_t slice = 0; slice < SLICES; slice++)
 		{
-			if (park_counter == 0)
+			for (uint32_t i = slice * SIM_VEHICLES / SLICES; i < (slice + 1) * SIM_VEHICLES / SLICES; i++)
 			{
-				send_gps_msg(MSG_START);
+				step_vehicle(&vehicles[i]);
 			}
-			else if (park_counter >= park_duration)
+			sim_ms += SIM_STEP_MS / SLICES;
+
+#if SIM_TIME_SCALE != 1
+			// Simulated time runs on the steps, not on TIM7's real seconds
+			uint32_t sim_utc = base + (uint32_t)(sim_ms / 1000);
+			uint32_t real_utc = built + (osKernelGetTickCount() - start) / 1000;
+			if (!caught_up && sim_utc >= real_utc)
 			{
-				send_gps_msg(MSG_STOP);
-				is_parking = 0;
-				until_next_park = rand_uint_range(PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
-				park_counter = 0;
+				// From now on steps are paced like at scale 1, so sessions keep their length
+				caught_up = 1;
+				base = real_utc - (uint32_t)(sim_ms / 1000);
+				sim_utc = real_utc;
+				pace_tick = osKernelGetTickCount();
+				pace_ms = sim_ms;
+
+				log_line_t line = {0};
+				log_str(&line, "Simulated clock caught up with real time at ");
+				log_utc(&line, sim_utc);
+				log_str(&line, ", stepping at real pace from now on");
+				log_end(&line);
 			}
-			else
+			utc_seconds = sim_utc;
+
+			if (caught_up)
 			{
-				send_gps_msg(MSG_IDLE);
+				// A step takes as long in real time as in simulated time
+				osDelayUntil(pace_tick + (uint32_t)(sim_ms - pace_ms));
+				continue;
 			}
-			park_counter++;
+#endif
+#if SIM_TIME_SCALE > 0
+			// Keeps the pace however long the steps took. Past the target,
+			// e.g. when a high scale outruns the steps, it doesn't wait.
+			osDelayUntil(start + (uint32_t)(sim_ms / SIM_TIME_SCALE));
+#endif
 		}
-		else
+	}
+}
+
+static void step_vehicle(vehicle_t *v)
+{
+	if (v->is_parking)
+	{
+		if (v->park_counter == 0)
 		{
-			update_position_randomly();
-			send_gps_msg(MSG_IDLE);
-			if (--until_next_park == 0)
-			{
-				is_parking = 1;
-				park_duration = rand_uint_range(PARK_DURATION_MIN, PARK_DURATION_MAX);
-				park_counter = 0;
-			}
+			send_gps_msg(v, MSG_START);
+		}
+		else if (v->park_counter >= v->park_duration)
+		{
+			send_gps_msg(v, MSG_STOP);
+			v->is_parking = 0;
+			v->until_next_park = rand_uint_range(PARK_INTERVAL_MIN, PARK_INTERVAL_MAX);
+			v->park_counter = 0;
+			return;
+		}
+		else if (SEND_IDLE)
+		{
+			send_gps_msg(v, MSG_IDLE);
+		}
+		v->park_counter++;
+	}
+	else
+	{
+		update_position_randomly(v);
+		if (SEND_IDLE)
+		{
+			send_gps_msg(v, MSG_IDLE);
+		}
+		if (--v->until_next_park == 0)
+		{
+			v->is_parking = 1;
+			v->park_duration = rand_uint_range(PARK_DURATION_MIN, PARK_DURATION_MAX);
+			v->park_counter = 0;
 		}
-
-		osDelay(1000);
 	}
 }
 
@@ -82,28 +171,58 @@ static uint32_t rand_uint_range(uint32_t min, uint32_t max)
     return min + (rand() % (max - min + 1));
 }
 
-static void update_position_randomly(void)
+static void update_position_randomly(vehicle_t *v)
 {
     float d_lat = rand_float_range(MOVE_STEP_MIN, MOVE_STEP_MAX);
     float d_lon = rand_float_range(MOVE_STEP_MIN, MOVE_STEP_MAX);
 
-    lat += d_lat;
-    lon += d_lon;
+    v->lat += d_lat;
+    v->lon += d_lon;
 
-    if (lat < LAT_MIN) lat = LAT_MIN;
-    if (lat > LAT_MAX) lat = LAT_MAX;
-    if (lon < LON_MIN) lon = LON_MIN;
-    if (lon > LON_MAX) lon = LON_MAX;
+    if (v->lat < LAT_MIN) v->lat = LAT_MIN;
+    if (v->lat > LAT_MAX) v->lat = LAT_MAX;
+    if (v->lon < LON_MIN) v->lon = LON_MIN;
+    if (v->lon > LON_MAX) v->lon = LON_MAX;
 }
 
-void send_gps_msg(msg_type_t type)
+static void send_gps_msg(const vehicle_t *v, msg_type_t type)
 {
 	gps_msg_t msg;
 	msg.msg_type = type;
-	msg.license_id = LICENSE_ID;
+	msg.license_id = v->license_id;
 	msg.utc_seconds = utc_seconds;
-	msg.latitude = lat;
-	msg.longitude = lon;
+	msg.latitude = v->lat;
+	msg.longitude = v->lon;
+
+	// Never waits for the I2C side: a master that stopped reading loses the newest
+	// messages. At max speed, the master's reads are what sets the pace.
+	if (osMessageQueuePut(gpsMsgQueueHandle, &msg, 0, SIM_TIME_SCALE == 0 ? osWaitForever : 0) != osOK)
+	{
+		log_line_t line = {0};
+		log_str(&line, "GPS queue full, messages dropped: ");
+		log_u32(&line, ++dropped, 1);
+		log_end(&line);
+	}
+}
+
+static uint32_t build_utc(void)
+{
+	// __DATE__ is "Mmm dd yyyy", __TIME__ is "hh:mm:ss"
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char *date = __DATE__;
+	const char *time = __TIME__;
+
+	uint32_t month = 1;
+	while (month < 12 && strncmp(&months[(month - 1) * 3], date, 3) != 0)
+		month++;
+	uint32_t day = (uint32_t)atoi(date + 4);
+	uint32_t year = (uint32_t)atoi(date + 7);
+
+	// Days since 1970-01-01, counting years from March so leap days come last
+	uint32_t y = year - (month <= 2);
+	uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	uint32_t days = y * 365 + y / 4 - y / 100 + y / 400 + doy - 719468;
 
-	osMessageQueuePut(gpsMsgQueueHandle, &msg, 0, osWaitForever);
+	return days * 86400 + (uint32_t)atoi(time) * 3600 + (uint32_t)atoi(time + 3) * 60
+	       + (uint32_t)atoi(time + 6) - BUILD_TZ_MARGIN_SEC;
 }
@@ -5,55 +5,173 @@
  *      Author: leah
  */
 #include "gps_sim.h"
+#include "log_uart.h"
 #include "main.h"
 #include "cmsis_os.h"
-#include <stdio.h>
-#include <time.h>
+#include <string.h>
 
-#define I2C_TIMO 1000            // I2C timeout ms
-#define TS_BUF_SIZE 64           // Timastamp buffer size
+#define FRAME_SENT_FLAG 0x01U    // Thread flag set by the I2C interrupt when a frame was read
 
 extern I2C_HandleTypeDef hi2c1;
 extern osMessageQueueId_t gpsMsgQueueHandle;
+extern osThreadId_t I2CSenderTaskHandle;
 
-static void utc_to_str(uint32_t utc_sec, char *buf);
+// Frames ready for the master, written by the task and sent by DMA from the
+// I2C interrupt. Kept off the task's 1KB stack.
+static i2c_frame_t ring[FRAME_RING];
+static volatile uint32_t ring_head;       // Frames queued by the task
+static volatile uint32_t ring_tail;       // Frames read by the master, advanced by the interrupt
+static volatile uint8_t sending;          // The tail frame is being transmitted
+static volatile uint32_t resent;          // Frames the master stopped reading early, sent again
+static const i2c_frame_t empty_frame;     // Sent when no frame is ready, the master reads fixed-size frames
+
+static void log_msg(const gps_msg_t *msg);
 
 void StartI2CSenderTask(void *argument)
 {
-	gps_msg_t msg;
+	uint32_t reported = 0;
+	uint32_t log_reported = 0;
+	log_line_t line = {0};
+
+	// The bus is served from interrupts from now on, the task only fills frames
+	if (HAL_I2C_EnableListen_IT(&hi2c1) != HAL_OK)
+	{
+		log_str(&line, "I2C listen failed");
+		log_end(&line);
+	}
+
 	while (1)
 	{
-		if (osMessageQueueGet(gpsMsgQueueHandle, &msg, 0, osWaitForever) == osOK)
+		// Wait for the master to free a frame. Flags set meanwhile aren't lost.
+		while (ring_head - ring_tail == FRAME_RING)
 		{
-			char *type_str;
-			if(msg.msg_type == MSG_IDLE) type_str = "IDLE";
-			else if(msg.msg_type == MSG_START) type_str = "START";
-			else if(msg.msg_type == MSG_STOP) type_str = "STOP";
+			osThreadFlagsWait(FRAME_SENT_FLAG, osFlagsWaitAny, osWaitForever);
+		}
 
-			char buf[TS_BUF_SIZE];
-			utc_to_str(msg.utc_seconds, buf);
+		i2c_frame_t *frame = &ring[ring_head % FRAME_RING];
+		memset(frame, 0, sizeof(*frame));
 
-			printf("Sending %s message: license=%08lu, %s, lat=%.6f, lon=%.6f\n",
-		           type_str, (unsigned long)msg.license_id, buf,
-		           msg.latitude, msg.longitude);
+		// Wait for one message, then take whatever else is queued, so a backlog
+		// goes out in one bus transaction instead of one per message
+		if (osMessageQueueGet(gpsMsgQueueHandle, &frame->records[0], 0, osWaitForever) != osOK)
+		{
+			continue;
+		}
+		frame->count = 1;
+		while (frame->count < FRAME_MAX_RECORDS
+		       && osMessageQueueGet(gpsMsgQueueHandle, &frame->records[frame->count], 0, 0) == osOK)
+		{
+			frame->count++;
+		}
 
-			HAL_StatusTypeDef ret = HAL_I2C_Slave_Transmit(&hi2c1, (uint8_t*)&msg, sizeof(msg), I2C_TIMO);
+		// The interrupt may send it as soon as the head moves
+		__DMB();
+		ring_head++;
 
-			if (ret != HAL_OK)
-			{
-				printf("I2C Transmit failed with code: %d\n", ret);
-			}
+		for (uint8_t i = 0; i < frame->count; i++)
+		{
+			log_msg(&frame->records[i]);
 		}
+		if (resent != reported)
+		{
+			reported = resent;
+			log_str(&line, "I2C frames read partially and sent again: ");
+			log_u32(&line, reported, 1);
+			log_end(&line);
+		}
+		// Under load the UART falls behind the messages
+		if (log_dropped() != log_reported)
+		{
+			log_reported = log_dropped();
+			log_str(&line, "Log lines dropped: ");
+			log_u32(&line, log_reported, 1);
+			log_end(&line);
+		}
+	}
+}
+
+/**
+ * @brief Starts transmitting the oldest ready frame when the master reads
+ */
+void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode)
+{
+	if (hi2c->Instance != I2C1 || TransferDirection != I2C_DIRECTION_RECEIVE)
+	{
+		return;
+	}
 
+	const i2c_frame_t *frame = &empty_frame;
+	sending = ring_head != ring_tail;
+	if (sending)
+	{
+		frame = &ring[ring_tail % FRAME_RING];
+	}
+	HAL_I2C_Slave_Seq_Transmit_DMA(hi2c, (uint8_t*)frame, sizeof(*frame), I2C_FIRST_AND_LAST_FRAME);
+}
+
+/**
+ * @brief Frees the frame the master read, and wakes the task up to fill it again
+ */
+void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c->Instance != I2C1 || !sending)
+	{
+		return;
+	}
+
+	sending = 0;
+	ring_tail++;
+	osThreadFlagsSet(I2CSenderTaskHandle, FRAME_SENT_FLAG);
+}
+
+/**
+ * @brief Keeps a frame the master stopped reading early, to send it again
+ */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c->Instance != I2C1)
+	{
+		return;
+	}
+
+	if (sending)
+	{
+		sending = 0;
+		resent++;
 	}
+	// Busy if the HAL already went back to listening
+	HAL_I2C_EnableListen_IT(hi2c);
 }
 
-static void utc_to_str(uint32_t utc_sec, char *buf)
+/**
+ * @brief Listens for the next read, a transfer ends listening
+ */
+void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c)
 {
-	time_t utc_tim = utc_sec;
-	struct tm *ts;
+	if (hi2c->Instance == I2C1)
+	{
+		HAL_I2C_EnableListen_IT(hi2c);
+	}
+}
 
-	ts = gmtime(&utc_tim);
+static void log_msg(const gps_msg_t *msg)
+{
+	char *type_str = "UNKNOWN";
+	if(msg->msg_type == MSG_IDLE) type_str = "IDLE";
+	else if(msg->msg_type == MSG_START) type_str = "START";
+	else if(msg->msg_type == MSG_STOP) type_str = "STOP";
 
-	strftime(buf, TS_BUF_SIZE, "%Y-%m-%d %H:%M:%S UTC", ts);
+	// Integer formatting only: printf's floats and gmtime() took milliseconds
+	log_line_t line = {0};
+	log_str(&line, "Sending ");
+	log_str(&line, type_str);
+	log_str(&line, " message: license=");
+	log_u32(&line, msg->license_id, 8);
+	log_str(&line, ", ");
+	log_utc(&line, msg->utc_seconds);
+	log_str(&line, ", lat=");
+	log_deg(&line, msg->latitude);
+	log_str(&line, ", lon=");
+	log_deg(&line, msg->longitude);
+	log_end(&line);
 }
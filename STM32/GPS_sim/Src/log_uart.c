@@ -0,0 +1,217 @@
+/*
+ * log_uart.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: leah
+ */
+#include "log_uart.h"
+#include "main.h"
+#include <stdatomic.h>
+#include <string.h>
+
+extern UART_HandleTypeDef huart3;
+
+// Any task appends to the ring without locks: it reserves its bytes by moving
+// `reserved`, copies them, then adds them to `committed`. The bytes before
+// `committed` are all written once it catches up with `reserved`. The UART DMA
+// sends from `tail`, which only its completion interrupt moves.
+static char ring[LOG_RING_SIZE];
+static atomic_uint reserved;             // End of the bytes taken by writers
+static atomic_uint committed;            // Bytes written so far
+static atomic_uint tail;                 // End of the bytes sent
+static atomic_uint busy;                 // A DMA transfer is running, or being started
+static uint32_t sending;                 // Bytes of the running transfer
+static atomic_uint dropped;
+
+static void append(const char *data, uint32_t len);
+static void kick(void);
+
+void log_str(log_line_t *line, const char *s)
+{
+	while (*s && line->len < LOG_LINE_MAX - 2)
+	{
+		line->buf[line->len++] = *s++;
+	}
+}
+
+void log_u32(log_line_t *line, uint32_t v, uint8_t width)
+{
+	char digits[10];
+	uint8_t n = 0;
+
+	do
+	{
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0);
+	while (n < width && n < sizeof(digits))
+	{
+		digits[n++] = '0';
+	}
+
+	while (n > 0 && line->len < LOG_LINE_MAX - 2)
+	{
+		line->buf[line->len++] = digits[--n];
+	}
+}
+
+void log_deg(log_line_t *line, float deg)
+{
+	// The fraction is exact as a 32-bit binary fraction, and rounded to a
+	// millionth in integers, so the digits match printf's "%.6f"
+	float a = deg < 0 ? -deg : deg;
+	uint32_t whole = (uint32_t)a;
+	uint64_t frac = (uint64_t)((a - whole) * 4294967296.0f);
+	uint32_t micro = (uint32_t)((frac * 1000000 + 0x80000000u) >> 32);
+	if (micro >= 1000000)
+	{
+		whole++;
+		micro -= 1000000;
+	}
+
+	if (deg < 0 && (whole > 0 || micro > 0))
+	{
+		log_str(line, "-");
+	}
+	log_u32(line, whole, 1);
+	log_str(line, ".");
+	log_u32(line, micro, 6);
+}
+
+void log_utc(log_line_t *line, uint32_t utc_sec)
+{
+	// Civil date of a day count since 1970-01-01, in 400-year eras of 146097 days
+	uint32_t days = utc_sec / 86400;
+	uint32_t secs = utc_sec % 86400;
+	uint32_t z = days + 719468;
+	uint32_t era = z / 146097;
+	uint32_t doe = z - era * 146097;
+	uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	uint32_t mp = (5 * doy + 2) / 153;
+	uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+	uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+	uint32_t year = yoe + era * 400 + (month <= 2);
+
+	log_u32(line, year, 4);
+	log_str(line, "-");
+	log_u32(line, month, 2);
+	log_str(line, "-");
+	log_u32(line, day, 2);
+	log_str(line, " ");
+	log_u32(line, secs / 3600, 2);
+	log_str(line, ":");
+	log_u32(line, secs / 60 % 60, 2);
+	log_str(line, ":");
+	log_u32(line, secs % 60, 2);
+	log_str(line, " UTC");
+}
+
+void log_end(log_line_t *line)
+{
+	// Builders leave room for the line end
+	line->buf[line->len++] = '\r';
+	line->buf[line->len++] = '\n';
+	append(line->buf, line->len);
+	line->len = 0;
+}
+
+void log_write(const char *data, uint32_t len)
+{
+	append(data, len);
+}
+
+uint32_t log_dropped(void)
+{
+	return atomic_load(&dropped);
+}
+
+/**
+ * @brief Sends the next part of the ring, called when a transfer is done
+ */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance != USART3)
+	{
+		return;
+	}
+
+	atomic_fetch_add(&tail, sending);
+	atomic_store(&busy, 0);
+	kick();
+}
+
+/**
+ * @brief Copies bytes into the ring, or drops them all if they don't fit
+ */
+static void append(const char *data, uint32_t len)
+{
+	if (len == 0 || len > LOG_RING_SIZE)
+	{
+		return;
+	}
+
+	uint32_t start = atomic_load(&reserved);
+	do
+	{
+		if (start + len - atomic_load(&tail) > LOG_RING_SIZE)
+		{
+			atomic_fetch_add(&dropped, 1);
+			return;
+		}
+	} while (!atomic_compare_exchange_weak(&reserved, &start, start + len));
+
+	uint32_t at = start % LOG_RING_SIZE;
+	uint32_t first = len < LOG_RING_SIZE - at ? len : LOG_RING_SIZE - at;
+	memcpy(&ring[at], data, first);
+	memcpy(ring, data + first, len - first);
+
+	atomic_fetch_add(&committed, len);
+	kick();
+}
+
+/**
+ * @brief Starts a DMA transfer of the committed bytes, unless one is running
+ *
+ * Called by writers and by the completion interrupt. Whoever fails to start
+ * a transfer leaves the bytes to the one running, or to the writer still
+ * copying, which calls it again.
+ */
+static void kick(void)
+{
+	while (1)
+	{
+		uint32_t idle = 0;
+		if (!atomic_compare_exchange_strong(&busy, &idle, 1))
+		{
+			return;
+		}
+
+		// Committed first: if reserved hasn't moved past it, no writer is in between
+		uint32_t end = atomic_load(&committed);
+		uint32_t from = atomic_load(&tail);
+		if (end == atomic_load(&reserved) && end != from)
+		{
+			uint32_t at = from % LOG_RING_SIZE;
+			uint32_t len = end - from;
+			if (len > LOG_RING_SIZE - at)
+			{
+				len = LOG_RING_SIZE - at;
+			}
+
+			sending = len;
+			if (HAL_UART_Transmit_DMA(&huart3, (uint8_t*)&ring[at], len) == HAL_OK)
+			{
+				return;
+			}
+		}
+
+		atomic_store(&busy, 0);
+
+		// A writer that committed meanwhile found the flag taken
+		if (atomic_load(&committed) == end)
+		{
+			return;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Parksys
+{
+    /**
+     * @brief Delta-encoded batch frames
+     *
+     * A batch frame carries up to BATCH_MAX_EVENTS events with consecutive
+     * sequence numbers. Each event is a header byte (bits 0-1: request type,
+     * bit 2: a lot ID follows), then varints of the zigzag-encoded differences
+     * from the previous event of the license ID, the timestamp, and the bit
+     * patterns of the latitude and longitude, then the lot ID as a varint if
+     * there's one. The first event is encoded against zeros.
+     *
+     * Varints are 7 bits per byte, least significant first, with the top bit
+     * set on every byte but the last, at most 5 bytes for 32 bits.
+     */
+
+    /**
+     * @brief Encode requests into a batch frame
+     *
+     * @param out Output buffer, at least BATCH_HDR_SIZE + count * BATCH_EVENT_MAX_SIZE bytes
+     * @param seq Sequence number of the first request
+     * @param lots_version Version of the lot table the requests' lots were resolved with
+     * @param reqs Requests to encode, with lot_id 0 when unresolved
+     * @param count Number of requests, up to BATCH_MAX_EVENTS
+     * @return size_t Frame size
+     */
+    size_t encodeBatch(uint8_t *out, uint32_t seq, uint32_t lots_version, const Request *reqs, size_t count);
+
+    /**
+     * @brief Size of a batch frame from its header
+     *
+     * @param frame Received bytes, starting with a batch frame
+     * @param avail Number of received bytes
+     * @return size_t Frame size, BATCH_HDR_SIZE until the length is received,
+     *         0 if the frame is too long to be valid
+     */
+    size_t batchFrameSize(const uint8_t *frame, size_t avail);
+
+    /**
+     * @brief Decode a batch frame
+     *
+     * Reads up to BATCH_READ_PAD bytes past the frame, which must be readable.
+     *
+     * @param frame Batch frame
+     * @param size Frame size, from batchFrameSize()
+     * @param seq Where the sequence number of the first request will be stored
+     * @param reqs Vector where the requests will be stored
+     * @return true if the frame is valid
+     * @return false otherwise
+     */
+    bool decodeBatch(const uint8_t *frame, size_t size, uint32_t &seq, std::vector<Request> &reqs);
+}
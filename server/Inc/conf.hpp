@@ -7,4 +7,10 @@
 
 #define SERVER_IP "0.0.0.0"            // Don't change that unless you know what you're doing
 #define SERVER_PORT 12321              // Server's listening port
-#define REQ_QUEUE_SIZE 8               // Request queue size for listen()
\ No newline at end of file
+#define REQ_QUEUE_SIZE 8               // Request queue size for listen()
+
+#define OCC_PATH "/dev/shm/parksys.occ" // Live occupancy counters shared memory path
+#define OCC_INITIAL_LOTS 4096          // Occupancy counters mapped at startup, grown for higher lot IDs
+#define LOT_REFRESH_MS 1000            // Interval for checking if lots were changed (ms)
+#define RECV_BUF_SIZE 65536            // Per-connection receive buffer (bytes)
+#define MAX_TABLE_LOTS 4096            // Lot tables larger than this aren't sent to gateways
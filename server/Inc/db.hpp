@@ -1,7 +1,12 @@
 #pragma once
 #include "logs.hpp"
+#include "tariff.hpp"
+#include <memory>
+#include <mutex>
 #include <sqlite3.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace Parksys
 {
@@ -12,7 +17,45 @@ namespace Parksys
     enum class pdbStatus
     {
         PDB_OK = 0,         // Success
-        PDB_ERR             // General error occured
+        PDB_ERR,            // General error occured
+        PDB_NOT_FOUND       // No record to change
+    };
+
+    /**
+     * @brief Location and capacity of a parking lot
+     * 
+     */
+    struct LotInfo
+    {
+        uint32_t lot_id;    // Lot ID
+        float latitude;     // GPS latitude
+        float longitude;    // GPS longitude
+        uint32_t capacity;  // Number of parking spaces, 0 = unlimited
+    };
+
+    /**
+     * @brief Scope of a rollup report
+     * 
+     */
+    enum class RollupScope
+    {
+        LOT,                // Aggregates of a single lot
+        CITY                // Aggregates of all lots in a city
+    };
+
+    constexpr uint32_t ROLLUP_HOUR = 3600;   // Hourly bucket length (sec)
+    constexpr uint32_t ROLLUP_DAY = 86400;   // Daily bucket length (sec)
+
+    /**
+     * @brief A single time bucket of aggregated parking activity
+     * 
+     */
+    struct RollupRow
+    {
+        uint32_t bucket;    // Bucket start UTC timestamp
+        uint32_t starts;    // Sessions started within the bucket
+        uint32_t stops;     // Sessions ended within the bucket
+        double revenue;     // Revenue of sessions ended within the bucket
     };
 
     /**
@@ -40,6 +83,35 @@ namespace Parksys
          */
         ~Database();
 
+        // ---------------- Transactions ----------------
+
+        /**
+         * @brief Start a transaction, or a nested one within the current transaction.
+         * 
+         * Other threads can't write until the outermost transaction ends. Every
+         * successful begin() must be ended by commit() or rollback() on the same thread.
+         * 
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus begin();
+
+        /**
+         * @brief Commit the innermost transaction.
+         * 
+         * The outermost commit also flushes the changes to disk, so they are
+         * durable once it returns PDB_OK.
+         * 
+         * @return pdbStatus PDB_ERR if the changes couldn't be committed (they are
+         *         rolled back) or flushed to disk
+         */
+        pdbStatus commit();
+
+        /**
+         * @brief Roll back the innermost transaction.
+         * 
+         */
+        void rollback();
+
         // ------------------ Logging -------------------
 
         /**
@@ -59,9 +131,20 @@ namespace Parksys
          * 
          * @param customer_id Unique ID of the customer
          * @param timestamp UTC timestamp when the parking ends (in seconds)
+         * @param session_lot Reference to a variable where the session's lot ID will be stored
+         * @return pdbStatus Status of the operation, PDB_NOT_FOUND if the customer has no open session
+         */
+        pdbStatus endParking(uint32_t customer_id, uint32_t timestamp, uint32_t &session_lot);
+
+        /**
+         * @brief Count the open parking sessions of every lot.
+         * 
+         * Scans Log, so it's meant for rebuilding live counters at startup.
+         * 
+         * @param counts Vector where (lot_id, open sessions) pairs will be stored
          * @return pdbStatus Status of the operation
          */
-        pdbStatus endParking(uint32_t customer_id, uint32_t timestamp);
+        pdbStatus countOpenSessions(std::vector<std::pair<uint32_t, uint32_t>> &counts);
 
         /**
          * @brief Finds the closest parking lot to given coordinates
@@ -104,11 +187,13 @@ namespace Parksys
          * @param is_hourly Whether the lot charges hourly (true) or fixed price (false)
          * @param price Price per hour or fixed rate (depending on is_hourly)
          * @param max_daily Maximum daily price (only relevant for hourly lots)
+         * @param capacity Number of parking spaces, 0 = unlimited
          * @return pdbStatus Status of the operation
          */
         pdbStatus addLot(const std::string &name, uint32_t city_id,
                          float latitude, float longitude,
-                         bool is_hourly, double price, double max_daily);
+                         bool is_hourly, double price, double max_daily,
+                         uint32_t capacity = 0);
 
         /**
          * @brief Remove a parking lot from the database.
@@ -137,12 +222,174 @@ namespace Parksys
          */
         pdbStatus setLotType(uint32_t lot_id, bool is_hourly);
 
+        /**
+         * @brief Set the number of parking spaces of a lot.
+         * 
+         * @param lot_id ID of the lot to modify
+         * @param capacity Number of parking spaces, 0 = unlimited
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus setLotCapacity(uint32_t lot_id, uint32_t capacity);
+
+        /**
+         * @brief Set the grace period of a lot. Shorter sessions are free.
+         * 
+         * @param lot_id ID of the lot to modify
+         * @param grace_sec Grace period in seconds
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus setLotGrace(uint32_t lot_id, uint32_t grace_sec);
+
+        /**
+         * @brief Add an hourly rate band to a lot's tariff.
+         * 
+         * Within the band the rate replaces the lot's base hourly price.
+         * Bands added later override earlier ones where they overlap.
+         * 
+         * @param lot_id ID of the lot
+         * @param band Days, hours and rate of the band
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus addTariffBand(uint32_t lot_id, const TariffBand &band);
+
+        /**
+         * @brief Remove a rate band.
+         * 
+         * @param band_id ID of the band to remove
+         * @return pdbStatus Status of the operation, PDB_ERR if there's no such band
+         */
+        pdbStatus removeTariffBand(uint32_t band_id);
+
+        /**
+         * @brief Read the pricing rules of all lots.
+         * 
+         * @param rules Vector where the rules will be stored
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus getTariffRules(std::vector<TariffRules> &rules);
+
+        /**
+         * @brief Get the compiled tariffs of all lots.
+         * 
+         * Tariffs are compiled once and recompiled only after pricing rules change,
+         * by this object or by another connection. Changes by other connections are
+         * looked for once per transaction.
+         * 
+         * @return std::shared_ptr<const TariffEngine> Compiled tariffs
+         */
+        std::shared_ptr<const TariffEngine> tariffEngine();
+
+        /**
+         * @brief Read all parking sessions that haven't ended yet.
+         * 
+         * @param sessions Vector where the sessions will be stored
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus getOpenSessions(std::vector<OpenSession> &sessions);
+
+        /**
+         * @brief Record a tariff change and its projected impact on open sessions.
+         * 
+         * @param lot_id ID of the changed lot, 0 if not specific to a lot
+         * @param timestamp UTC timestamp of the change
+         * @param description What was changed
+         * @param impact Projected revenue of open sessions before and after the change
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus recordTariffVersion(uint32_t lot_id, uint32_t timestamp,
+                                      const std::string &description, const RepriceImpact &impact);
+
+        /**
+         * @brief Read location and capacity of all lots.
+         * 
+         * @param lots Vector where the lots will be stored
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus getLots(std::vector<LotInfo> &lots);
+
+        /**
+         * @brief Get the database's data version.
+         * 
+         * The value changes whenever another connection (e.g. parksys-price-updater)
+         * commits a change, so it tells when cached data must be reloaded.
+         * 
+         * @return int64_t Current data version, or -1 on error
+         */
+        int64_t dataVersion();
+
+        // ------------------ Gateways ------------------
+
+        /**
+         * @brief Read the delivery state of a gateway.
+         * 
+         * @param gateway_id Gateway ID
+         * @param epoch Where the gateway's spool epoch will be stored
+         * @param next_seq Where the sequence number expected next will be stored
+         * @return pdbStatus PDB_OK if found, PDB_ERR if the gateway is unknown or on error
+         */
+        pdbStatus getGateway(uint32_t gateway_id, uint32_t &epoch, uint32_t &next_seq);
+
+        /**
+         * @brief Store the delivery state of a gateway.
+         * 
+         * Meant for the transaction that stores the event it counts, so the two
+         * are committed together or not at all.
+         * 
+         * @param gateway_id Gateway ID
+         * @param epoch Gateway's spool epoch
+         * @param next_seq Sequence number expected next
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus setGateway(uint32_t gateway_id, uint32_t epoch, uint32_t next_seq);
+
+        // ------------------ Analytics ------------------
+
+        /**
+         * @brief Read aggregated activity of a lot or a city.
+         * 
+         * Aggregates are maintained incrementally by startParking() and endParking(),
+         * so reading them never scans the Log table.
+         * 
+         * @param scope Whether id refers to a lot or a city
+         * @param id Lot ID or city ID
+         * @param period Bucket length, ROLLUP_HOUR or ROLLUP_DAY
+         * @param from First UTC timestamp to include
+         * @param to Last UTC timestamp to include
+         * @param rows Vector where the buckets will be stored, ordered by time
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus getRollup(RollupScope scope, uint32_t id, uint32_t period,
+                            uint32_t from, uint32_t to, std::vector<RollupRow> &rows);
+
     private:
         sqlite3 *runtime_db;      // Runtime shm DB
         sqlite3 *disk_db;         // Disk backup DB
         bool disk_ok;             // Is disk DB opened successfully?
         Logfile log, err;         // Log output files
 
+        std::recursive_mutex write_m;  // Held by the thread in a transaction
+        unsigned depth;                // Transactions open, nested ones included
+        int flushed_changes;           // sqlite3_total_changes() at the last flush of a transaction
+
+        std::shared_ptr<const TariffEngine> tariffs;  // Compiled tariffs, null when stale
+        int64_t tariff_version;                       // Data version tariffs were compiled from
+        bool tariff_checked;                          // Data version checked in this transaction
+        std::mutex tariff_m;                          // Protects tariffs
+
+        /**
+         * @brief Mark compiled tariffs as stale after pricing rules changed.
+         * 
+         */
+        void invalidateTariffs();
+
+        /**
+         * @brief Run SQL statements on the runtime database, logging failures.
+         * 
+         * @param sql Statements to run
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus exec(const std::string &sql);
+
         /**
          * @brief Backup the in-memory runtime database to disk.
          * 
@@ -153,10 +400,26 @@ namespace Parksys
         /**
          * @brief Calculate the total price for a parking session.
          * 
-         * @param duration_sec Duration of the parking session in seconds
          * @param lot_id ID of the lot where the session took place
+         * @param start_time Session start UTC timestamp
+         * @param end_time Session end UTC timestamp
          * @return double Calculated price
          */
-        double calculatePrice(int duration_sec, uint32_t lot_id);
+        double calculatePrice(uint32_t lot_id, uint32_t start_time, uint32_t end_time);
+
+        /**
+         * @brief Add to the hourly and daily rollups of a lot and its city.
+         * 
+         * Must run in the transaction that writes the Log entry, so both change together.
+         * 
+         * @param lot_id ID of the lot where the activity took place
+         * @param timestamp UTC timestamp of the activity
+         * @param starts Number of started sessions to add
+         * @param stops Number of ended sessions to add
+         * @param revenue Revenue to add
+         * @return pdbStatus Status of the operation
+         */
+        pdbStatus updateRollups(uint32_t lot_id, uint32_t timestamp,
+                                int starts, int stops, double revenue);
     };
 }
\ No newline at end of file
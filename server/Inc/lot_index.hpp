@@ -0,0 +1,125 @@
+#pragma once
+#include "db.hpp"
+#include "occupancy.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Parksys
+{
+    /**
+     * @brief In-memory spatial index of parking lots aware of free capacity
+     * 
+     * Lots are stored as an implicit 2-d tree: every subrange [lo, hi) of the
+     * node array is a subtree whose root is the median element, split by latitude
+     * on even depths and by longitude on odd depths. Each node also holds the number
+     * of lots with free spaces in its subtree, so a nearest-available search skips
+     * full regions without visiting them.
+     * 
+     * Searches are lock-free. Occupancy updates are serialized by a mutex so the
+     * per-subtree summaries always converge to the live occupancy counters.
+     * The lot set itself is immutable; rebuild the index when lots change.
+     * 
+     * The index also holds the lot table published to gateways, which resolve
+     * the closest lot of START events themselves: lot coordinates as arrays of
+     * latitudes, longitudes and IDs, versioned by a hash of their content.
+     * 
+     */
+    class LotIndex
+    {
+    public:
+        /**
+         * @brief Construct a new LotIndex object
+         * 
+         * @param lots Lots to index
+         * @param occ Live occupancy the free capacity is derived from
+         */
+        LotIndex(const std::vector<LotInfo> &lots, const Occupancy &occ);
+
+        LotIndex(const LotIndex&) = delete;
+        LotIndex& operator=(const LotIndex&) = delete;
+
+        /**
+         * @brief Finds the closest lot to given coordinates
+         * 
+         * @param latitude Latitude of vehicle's location
+         * @param longitude Longitude of vehicle's location
+         * @param available_only Skip lots that are full
+         * @param lot_id Reference to a variable where the closest lot ID will be stored
+         * @return true if a matching lot was found,
+         * @return false otherwise
+         */
+        bool nearest(float latitude, float longitude, bool available_only, uint32_t &lot_id) const;
+
+        /**
+         * @brief Refresh the free capacity summary of a lot after its occupancy changed
+         * 
+         * @param lot_id ID of the lot
+         */
+        void update(uint32_t lot_id);
+
+        /**
+         * @brief Check whether a lot is indexed
+         * 
+         * @param lot_id ID of the lot
+         * @return true if the lot exists in the index
+         * @return false otherwise
+         */
+        bool contains(uint32_t lot_id) const;
+
+        /**
+         * @brief Check whether a lot is indexed and has free spaces
+         * 
+         * @param lot_id ID of the lot
+         * @return true if the lot exists and isn't full
+         * @return false otherwise
+         */
+        bool available(uint32_t lot_id) const;
+
+        /**
+         * @brief Get the version of the lot table
+         * 
+         * @return uint32_t Hash of the lot IDs and coordinates, never 0
+         */
+        uint32_t version() const { return table_version; }
+
+        /**
+         * @brief Get the lot table sent to gateways
+         * 
+         * [version u32][count u32][latitude f32 x count][longitude f32 x count][lot ID u32 x count]
+         * 
+         * @return const std::vector<uint8_t>& Lot table
+         */
+        const std::vector<uint8_t> &table() const { return lot_table; }
+
+    private:
+        struct Node
+        {
+            float latitude;
+            float longitude;
+            uint32_t lot_id;
+            uint32_t capacity;   // 0 = unlimited
+        };
+
+        std::vector<Node> nodes;                          // Implicit 2-d tree
+        std::vector<int32_t> parent;                      // Parent position of each node, -1 for root
+        std::vector<int32_t> position;                    // Node position by lot ID, -1 if absent
+        std::unique_ptr<std::atomic<uint32_t>[]> avail;   // Lots with free spaces in each subtree
+        std::unique_ptr<std::atomic<bool>[]> is_free;     // Does the node itself have free spaces?
+        const Occupancy &occ;                             // Live occupancy
+        std::mutex update_m;                              // Serializes updates
+        uint32_t table_version;                           // Hash of the lot table
+        std::vector<uint8_t> lot_table;                   // Lot table sent to gateways
+
+        void build_table(const std::vector<LotInfo> &lots);
+
+        int32_t build(size_t lo, size_t hi, unsigned depth, int32_t up);
+
+        void search(size_t lo, size_t hi, unsigned depth, float latitude, float longitude,
+                    bool available_only, float &best_dist, int32_t &best) const;
+
+        bool has_room(size_t pos) const;
+    };
+}
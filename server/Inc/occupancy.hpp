@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Parksys
+{
+    /**
+     * @brief Live per-lot occupancy counters in shared memory
+     * 
+     * The counters are a flat array of 32-bit integers indexed by lot ID, mapped
+     * from OCC_PATH. The server owns the mapping and updates it with atomic
+     * operations on every START and STOP; any other process (a dashboard, the price
+     * updater) may map the same file read-only and poll it without locks, syscalls
+     * or database access.
+     * 
+     * The file starts with OCC_INITIAL_LOTS counters and the owner grows it when a
+     * higher lot ID shows up. Readers that map it should check its size again when
+     * they look up a lot ID past the end of their mapping.
+     * 
+     */
+    class Occupancy
+    {
+    public:
+        /**
+         * @brief Construct a new Occupancy object
+         * 
+         * @param owner true to create the shared memory file (server), false to
+         *              map an existing one read-only
+         * 
+         * @throw std::runtime_error when the shared memory can't be mapped
+         */
+        explicit Occupancy(bool owner);
+
+        /**
+         * @brief Destroy the Occupancy object
+         * 
+         * Unmaps the counters, earlier smaller mappings included. The owner
+         * also removes the shared memory file.
+         */
+        ~Occupancy();
+
+        Occupancy(const Occupancy&) = delete;
+        Occupancy& operator=(const Occupancy&) = delete;
+
+        /**
+         * @brief Make room for a lot's counter, growing the mapping if needed
+         * 
+         * Owner only. Calls must not run concurrently with each other, while
+         * the other methods may run concurrently with this one.
+         * 
+         * @param lot_id ID of the lot
+         * @return true if the lot is tracked, false if it isn't and can't be
+         */
+        bool reserve(uint32_t lot_id);
+
+        /**
+         * @brief Check whether a lot has a counter
+         * 
+         * @param lot_id ID of the lot
+         * @return true if the lot's occupancy is counted
+         */
+        bool tracks(uint32_t lot_id) const;
+
+        /**
+         * @brief Number of counters mapped, one past the highest lot ID tracked
+         * 
+         * @return uint32_t Number of counters
+         */
+        uint32_t size() const;
+
+        /**
+         * @brief Count one more vehicle in a lot
+         * 
+         * @param lot_id ID of the lot
+         * @return uint32_t Occupancy after the change
+         */
+        uint32_t increment(uint32_t lot_id);
+
+        /**
+         * @brief Count one less vehicle in a lot. Never goes below zero.
+         * 
+         * @param lot_id ID of the lot
+         * @return uint32_t Occupancy after the change
+         */
+        uint32_t decrement(uint32_t lot_id);
+
+        /**
+         * @brief Read the occupancy of a lot
+         * 
+         * @param lot_id ID of the lot
+         * @return uint32_t Number of vehicles currently parked in the lot
+         */
+        uint32_t get(uint32_t lot_id) const;
+
+        /**
+         * @brief Overwrite the occupancy of a lot (used when rebuilding)
+         * 
+         * @param lot_id ID of the lot
+         * @param count Number of vehicles currently parked in the lot
+         */
+        void set(uint32_t lot_id, uint32_t count);
+
+        /**
+         * @brief Zero all counters
+         * 
+         */
+        void reset();
+
+    private:
+        std::atomic<std::atomic<uint32_t>*> counters;  // Mapped counters array
+        std::atomic<uint32_t> mapped;                  // Counters in the current mapping
+        std::vector<std::pair<void*, size_t>> retired;  // Smaller mappings of the same file, kept for lock-free readers
+        bool owner;                                    // Did this object create the mapping?
+
+        /**
+         * @brief Find a lot's counter in the current mapping
+         * 
+         * @param lot_id ID of the lot
+         * @return std::atomic<uint32_t>* The lot's counter, nullptr if it isn't tracked
+         */
+        std::atomic<uint32_t> *counter(uint32_t lot_id) const;
+    };
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Parksys
+{
+    /**
+     * @brief Request types
+     */
+    enum class ReqType : uint8_t
+    {
+        IDLE = 0,             // Vehicle is idle
+        START = 1,            // Parking start
+        STOP = 2              // Parking stop
+    };
+
+    struct Request
+    {
+        ReqType type;         // Request type
+        uint32_t license_id;  // Vehicle's license ID
+        uint32_t timestamp;   // UTC timestamp
+        float latitude;       // GPS latitude
+        float longitude;      // GPS longitude
+        uint32_t lot_id;      // START: lot resolved by the gateway, 0 if it didn't
+        uint32_t lots_version; // Version of the lot table the gateway resolved it with
+    };
+
+    const size_t REQ_SIZE = sizeof(ReqType) + 2 * sizeof(uint32_t)
+                            + 2 * sizeof(float); // Request size (packed)
+
+    /**
+     * @brief Frame types of the acknowledged protocol
+     *
+     * They're told apart from legacy requests by their first byte, which
+     * is never a valid ReqType.
+     */
+    enum class FrameType : uint8_t
+    {
+        DATA = 0xA5,          // [type][seq u32][request], gateway to server
+        ACK = 0xA6,           // [type][next seq u32], server to gateway
+        HELLO = 0xA7,         // [type][gateway id u32][epoch u32], gateway to server
+        DATA_LOT = 0xA8,      // [type][seq u32][request][lot id u32][lot table version u32], gateway to server
+        LOTS_REQ = 0xA9,      // [type][lot table version u32], gateway to server
+        LOTS = 0xAA,          // [type][lot table], server to gateway
+        BATCH = 0xAB          // [type][body length u16][first seq u32][count u16][lot table version u32][events], gateway to server
+    };
+
+    const size_t DATA_FRAME_SIZE = 1 + sizeof(uint32_t) + REQ_SIZE,   // Data frame size
+                 DATA_LOT_FRAME_SIZE = DATA_FRAME_SIZE + 2 * sizeof(uint32_t), // Data frame with a lot size
+                 ACK_FRAME_SIZE = 1 + sizeof(uint32_t),               // Ack frame size
+                 HELLO_FRAME_SIZE = 1 + 2 * sizeof(uint32_t),         // Hello frame size
+                 LOTS_REQ_FRAME_SIZE = 1 + sizeof(uint32_t),          // Lot table request frame size
+                 BATCH_HDR_SIZE = 1 + sizeof(uint16_t) + sizeof(uint32_t)
+                                  + sizeof(uint16_t) + sizeof(uint32_t), // Batch frame header size
+                 BATCH_MAX_EVENTS = 256,                              // Max events in a batch frame
+                 BATCH_EVENT_MAX_SIZE = 1 + 5 * 5,                    // Header byte and 5 varints at most
+                 BATCH_MAX_BODY = BATCH_MAX_EVENTS * BATCH_EVENT_MAX_SIZE, // Max batch frame body size
+                 BATCH_READ_PAD = 8;                                  // Readable bytes needed past a batch frame
+}
@@ -2,34 +2,43 @@
 
 #include "db.hpp"
 #include "logs.hpp"
+#include "lot_index.hpp"
+#include "occupancy.hpp"
+#include "protocol.hpp"
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <netinet/in.h>
 #include <string>
+#include <unordered_map>
 
 namespace Parksys
 {
     /**
-     * @brief Request types
+     * @brief Outcome of a data frame
      */
-    enum class ReqType : uint8_t
+    enum class DataResult
     {
-        IDLE = 0,             // Vehicle is idle
-        START = 1,            // Parking start
-        STOP = 2              // Parking stop
+        HANDLED,              // Next in sequence, handled
+        DUPLICATE,            // Already handled, skipped
+        REJECTED              // Out of sequence or not recorded, the gateway must resend it
     };
 
-    struct Request
+    /**
+     * @brief Delivery state of a gateway, shared by all its connections
+     * 
+     * Sequence numbers are the gateway's spool positions. They restart when
+     * the gateway's spool is recreated, which changes its epoch.
+     */
+    struct GatewayState
     {
-        ReqType type;         // Request type
-        uint32_t license_id;  // Vehicle's license ID
-        uint32_t timestamp;   // UTC timestamp
-        float latitude;       // GPS latitude
-        float longitude;      // GPS longitude
+        std::mutex m;         // Serializes the gateway's events across connections
+        uint32_t id;          // Gateway ID
+        uint32_t epoch;       // Spool epoch the sequence numbers belong to
+        uint32_t next_seq;    // All sequence numbers below this were handled
     };
 
-    const size_t REQ_SIZE = sizeof(ReqType) + 2 * sizeof(uint32_t)
-                            + 2 * sizeof(float); // Request size (packed)
-
     constexpr time_t SERV_TIMO_SEC = 60,         // Server timeout in second
                      SERV_TIMO_MS = 0;           // Server timeout in ms (added to seconds)
 
@@ -63,8 +72,61 @@ namespace Parksys
         int listen_fd;            // Listening port file descriptor
         sockaddr_in server_addr;  // Server addr struct
         Parksys::Database *pdb;   // Parksys database
+        Parksys::Occupancy occ;   // Live per-lot occupancy
         Logfile log, err;         // Log output files
 
+        std::shared_ptr<Parksys::LotIndex> index;          // Spatial index of lots
+        int64_t index_version;                             // DB data version the index was built from
+        std::chrono::steady_clock::time_point index_check; // Last time lots were checked for changes
+        std::mutex index_m;                                // Protects the index pointer, held by
+                                                           // rebuilds and by occupancy changes
+
+        std::unordered_map<uint32_t, std::shared_ptr<GatewayState>> gateways;  // Known gateways by ID
+        std::mutex gateways_m;                                                 // Protects gateways
+
+        /**
+         * @brief Get the lot index, rebuilding it if lots were changed in the database
+         * 
+         * The database is checked at most once every LOT_REFRESH_MS.
+         * 
+         * @return std::shared_ptr<Parksys::LotIndex> Current lot index
+         */
+        std::shared_ptr<Parksys::LotIndex> lot_index();
+
+        /**
+         * @brief Rebuild occupancy counters from the open sessions in the database
+         * 
+         */
+        void rebuild_occupancy();
+
+        /**
+         * @brief Make room for a lot's occupancy counter, logging if there's none
+         * 
+         * Called with index_m held.
+         * 
+         * @param lot_id ID of the lot
+         * @return true if the lot's occupancy is counted
+         */
+        bool reserve_occupancy(uint32_t lot_id);
+
+        /**
+         * @brief Count a vehicle in or out of a lot, and refresh the lot's free capacity
+         * 
+         * Takes the lock index rebuilds hold, so a rebuild either sees the change
+         * or is the index it's applied to.
+         * 
+         * @param lot_id ID of the lot
+         * @param parked true for a START, false for a STOP
+         */
+        void track(uint32_t lot_id, bool parked);
+
+        /**
+         * @brief Reload occupancy from the database after a rolled back transaction
+         * 
+         * The lot index is rebuilt on its next use.
+         */
+        void resync();
+
         /**
          * @brief Handles a single client 
          * 
@@ -73,15 +135,75 @@ namespace Parksys
         void handle_client(int client_fd);
 
         /**
-         * @brief Receives raw request from client
+         * @brief Size of a frame, from its first bytes
+         * 
+         * @param frame Received bytes, starting with the frame
+         * @param avail Number of received bytes
+         * @return size_t Frame size, or the size of its header while that's incomplete,
+         *         0 for an unknown frame type or an invalid length
+         */
+        size_t frame_size(const uint8_t *frame, size_t avail);
+
+        /**
+         * @brief Handles a hello frame, identifying the gateway behind a connection
+         * 
+         * Loads the gateway's delivery state, and resets it if the gateway's
+         * spool epoch changed.
+         * 
+         * @param frame Hello frame
+         * @return std::shared_ptr<Parksys::GatewayState> The gateway's state
+         */
+        std::shared_ptr<Parksys::GatewayState> handle_hello(const uint8_t *frame);
+
+        /**
+         * @brief Handles an event of a data frame, skipping events the gateway already delivered
+         * 
+         * The event and the gateway's next sequence are stored in one transaction.
+         * Must be called within the transaction of the whole read, whose commit
+         * makes them durable.
+         * 
+         * @param gw Sending gateway
+         * @param seq Sequence number of the event
+         * @param req Event, nullptr if it was invalid
+         * @param first Whether it's the first event after the hello, which may skip
+         *              ahead when the gateway released events this server no longer knows of
+         * @return Parksys::DataResult What became of it
+         */
+        Parksys::DataResult handle_data(Parksys::GatewayState &gw, uint32_t seq,
+                                        const Parksys::Request *req, bool first);
+
+        /**
+         * @brief Acknowledges every event of a gateway that was handled so far
+         * 
+         * Only call it once the events were committed to disk.
          * 
          * @param fd Client's file descriptor
-         * @param buf Buffer to copy request to
-         * @param size Buffer's size
+         * @param gw Gateway behind the connection
          * @return true when successful.
          * @return false otherwise.
          */
-        bool recv_request(int fd, void *buf, size_t size);
+        bool send_ack(int fd, Parksys::GatewayState &gw);
+
+        /**
+         * @brief Sends the lot table to a gateway, unless it already has the current one
+         * 
+         * @param fd Client's file descriptor
+         * @param have Version of the gateway's table, updated when a new one is sent
+         * @return true when successful.
+         * @return false otherwise.
+         */
+        bool send_lots(int fd, uint32_t &have);
+
+        /**
+         * @brief Sends a buffer in full
+         * 
+         * @param fd Client's file descriptor
+         * @param buf Data to send
+         * @param len Data length
+         * @return true when successful.
+         * @return false otherwise.
+         */
+        bool send_all(int fd, const uint8_t *buf, size_t len);
 
         /**
          * @brief Parses raw request into request struct
@@ -96,8 +218,14 @@ namespace Parksys
         /**
          * @brief Handles a request according to what was requested
          * 
+         * The capacity check of a START, its write and the occupancy change are
+         * a single transaction, so concurrent STARTs can't both take the last space.
+         * 
          * @param req Request struct to handle
+         * @return true if the request was stored, or can never be (no lots, a STOP
+         *         without a START),
+         * @return false on a database failure, when it may be retried
          */
-        void handle_request(const Parksys::Request &req);
+        bool handle_request(const Parksys::Request &req);
     };
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Parksys
+{
+    constexpr unsigned HOURS_PER_DAY = 24;
+    constexpr unsigned DAYS_PER_WEEK = 7;
+    constexpr unsigned HOURS_PER_WEEK = HOURS_PER_DAY * DAYS_PER_WEEK;
+
+    /**
+     * @brief An hourly rate that applies on some days between two hours (UTC)
+     * 
+     */
+    struct TariffBand
+    {
+        uint8_t days;         // Bitmask of week days, bit 0 = Sunday
+        uint8_t start_hour;   // First hour of the band, 0-23
+        uint8_t end_hour;     // Hour the band ends at (exclusive), 1-24
+        double rate;          // Hourly rate within the band
+    };
+
+    /**
+     * @brief Pricing rules of a single lot, as stored in the database
+     * 
+     */
+    struct TariffRules
+    {
+        uint32_t lot_id;                 // Lot ID
+        bool is_hourly;                  // Hourly (true) or fixed daily (false) pricing
+        double price;                    // Base hourly rate, or price per started day
+        double max_daily;                // Cap per calendar day of hourly lots, 0 = no cap
+        uint32_t grace_sec;              // Sessions up to this long are free
+        std::vector<TariffBand> bands;   // Overrides of the base rate, later ones win
+    };
+
+    /**
+     * @brief A parking session that hasn't ended yet
+     * 
+     */
+    struct OpenSession
+    {
+        uint32_t log_id;      // Log entry of the session
+        uint32_t lot_id;      // Lot where the session takes place
+        uint32_t start_time;  // Session start UTC timestamp
+    };
+
+    /**
+     * @brief Projected revenue of open sessions under two tariffs
+     * 
+     */
+    struct RepriceImpact
+    {
+        uint32_t sessions;    // Open sessions evaluated
+        uint32_t changed;     // Sessions whose projected charge changed
+        double before;        // Projected revenue under the old tariffs
+        double after;         // Projected revenue under the new tariffs
+    };
+
+    /**
+     * @brief Prices parking sessions from pre-compiled tariff tables
+     * 
+     * Every lot's rules are compiled once into a table of hourly rates for each
+     * hour of the week (UTC, week starting Sunday), with prefix sums over hours
+     * and over capped days. Pricing a session of any length then takes a constant
+     * number of table lookups:
+     * 
+     * - Hourly lots bill every started hour since the session start, at the rate
+     *   of the hour of the week it starts in. The daily cap is applied separately
+     *   to every calendar day the billed hours fall in.
+     * - Fixed lots bill their price per started 24 hours, and at least once.
+     * - Sessions no longer than the grace period are free, if the lot has one.
+     * 
+     */
+    class TariffEngine
+    {
+    public:
+        /**
+         * @brief Construct an empty TariffEngine object
+         * 
+         */
+        TariffEngine() = default;
+
+        /**
+         * @brief Construct a new TariffEngine object and compile rules
+         * 
+         * @param rules Pricing rules of all lots
+         */
+        explicit TariffEngine(const std::vector<TariffRules> &rules);
+
+        /**
+         * @brief Calculate the total price for a parking session.
+         * 
+         * @param lot_id ID of the lot where the session took place
+         * @param start_time Session start UTC timestamp
+         * @param end_time Session end UTC timestamp
+         * @param total Reference to a variable where the price will be stored
+         * @return true if the lot has a tariff,
+         * @return false otherwise
+         */
+        bool price(uint32_t lot_id, uint32_t start_time, uint32_t end_time, double &total) const;
+
+        /**
+         * @brief Number of lots with a compiled tariff
+         * 
+         * @return size_t Number of lots
+         */
+        size_t size() const { return tariffs.size(); }
+
+    private:
+        struct Compiled
+        {
+            bool is_hourly;
+            uint32_t grace_sec;
+            double fixed_price;                              // Price per started day (fixed lots)
+            double cap;                                      // Daily cap, 0 = none
+            double hour_prefix[HOURS_PER_WEEK + 1];          // Sum of rates before each hour of week
+            double day_prefix[2 * DAYS_PER_WEEK + 1];        // Sum of capped day costs, two weeks unrolled
+            double week_cost;                                // Cost of a full week
+        };
+
+        std::vector<Compiled> tariffs;    // Compiled tariffs
+        std::vector<int32_t> position;    // Tariff position by lot ID, -1 if absent
+
+        static Compiled compile(const TariffRules &rules);
+        static double hourly(const Compiled &t, uint64_t first_hour, uint64_t hours);
+    };
+
+    /**
+     * @brief Re-evaluate the projected charges of open sessions after a tariff change
+     * 
+     * Every session is priced as if it ended at 'now', under both tariffs.
+     * The sessions are split evenly between threads.
+     * 
+     * @param before Tariffs before the change
+     * @param after Tariffs after the change
+     * @param sessions Open sessions
+     * @param now UTC timestamp to project the charges to
+     * @param threads Number of threads to use, 0 = one per core
+     * @return RepriceImpact Projected revenue before and after the change
+     */
+    RepriceImpact repriceOpenSessions(const TariffEngine &before, const TariffEngine &after,
+                                      const std::vector<OpenSession> &sessions,
+                                      uint32_t now, unsigned threads = 0);
+}
\ No newline at end of file
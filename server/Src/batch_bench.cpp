@@ -0,0 +1,201 @@
+#include "batch_codec.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace Parksys;
+
+constexpr uint32_t BENCH_VEHICLES = 1000;       // Vehicles behind the gateway
+constexpr uint32_t BENCH_EVENTS = 1 << 20;      // Events encoded
+constexpr int BENCH_ROUNDS = 20;                // Decoding rounds
+constexpr uint32_t BENCH_START = 1751371200;    // Tuesday, July 1, 2025 12:00:00 PM
+constexpr uint32_t BENCH_LICENSE = 10000000;    // License ID of the first vehicle
+constexpr uint32_t BENCH_LOTS = 50;             // Lots the gateway resolves STARTs to
+
+// Events whose encoding is pinned by GOLDEN_FRAME: deltas of both signs, a
+// timestamp going back, the highest license ID and lots of one and two bytes
+static const Request GOLDEN_EVENTS[] = {
+    {ReqType::START, 12345678, 1751371200, 32.0853f, 34.7818f, 7, 0x01020304},
+    {ReqType::STOP, 12345678, 1751374800, 32.0853f, 34.7818f, 0, 0x01020304},
+    {ReqType::START, 12345600, 1751374790, 29.5f, 35.9f, 300, 0x01020304},
+    {ReqType::STOP, 4294967295u, 1751371200, 33.3f, 34.2f, 0, 0x01020304},
+};
+
+// GOLDEN_EVENTS as sequence 1000 onwards. BBG/Src/batch_bench.c checks the
+// gateway's encoder against the same bytes.
+static const uint8_t GOLDEN_FRAME[] = {
+    0xab, 0x36, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x04, 0x00, 0x04, 0x03, 0x02,
+    0x01, 0x05, 0x9c, 0x85, 0xe3, 0x0b, 0x80, 0xb7, 0x9e, 0x86, 0x0d, 0xb2,
+    0xdd, 0x82, 0xa0, 0x08, 0xa0, 0x82, 0xd9, 0xa0, 0x08, 0x07, 0x02, 0x00,
+    0xa0, 0x38, 0x00, 0x00, 0x05, 0x9b, 0x01, 0x13, 0xb1, 0xdd, 0xa2, 0x01,
+    0x94, 0xe4, 0x23, 0xac, 0x02, 0x02, 0x81, 0x84, 0xe3, 0x0b, 0x8b, 0x38,
+    0xe6, 0xcc, 0xc9, 0x01, 0x99, 0xb3, 0x36,
+};
+
+static bool sameRequest(const Request &a, const Request &b)
+{
+    return a.type == b.type && a.license_id == b.license_id && a.timestamp == b.timestamp
+        && a.latitude == b.latitude && a.longitude == b.longitude && a.lot_id == b.lot_id
+        && a.lots_version == b.lots_version;
+}
+
+/**
+ * @brief Checks the frame format: the golden frame both ways, and that damaged frames are rejected
+ *
+ * @return int Number of failed checks
+ */
+static int checkFormat()
+{
+    constexpr size_t GOLDEN_EVENT_COUNT = sizeof(GOLDEN_EVENTS) / sizeof(GOLDEN_EVENTS[0]);
+    constexpr size_t GOLDEN_SIZE = sizeof(GOLDEN_FRAME);
+    int failures = 0;
+
+    std::vector<uint8_t> frame(BATCH_HDR_SIZE + BATCH_MAX_BODY + BATCH_READ_PAD);
+    size_t size = encodeBatch(frame.data(), 1000, 0x01020304, GOLDEN_EVENTS, GOLDEN_EVENT_COUNT);
+    if (size != GOLDEN_SIZE || std::memcmp(frame.data(), GOLDEN_FRAME, GOLDEN_SIZE) != 0)
+    {
+        std::cerr << "Encoded the golden events into a different frame\n";
+        failures++;
+    }
+
+    std::memcpy(frame.data(), GOLDEN_FRAME, GOLDEN_SIZE);
+    uint32_t seq = 0;
+    std::vector<Request> decoded;
+    if (batchFrameSize(frame.data(), GOLDEN_SIZE) != GOLDEN_SIZE
+        || !decodeBatch(frame.data(), GOLDEN_SIZE, seq, decoded) || seq != 1000
+        || decoded.size() != GOLDEN_EVENT_COUNT
+        || !std::equal(decoded.begin(), decoded.end(), GOLDEN_EVENTS, sameRequest))
+    {
+        std::cerr << "Decoded the golden frame into different events\n";
+        failures++;
+    }
+
+    // Cut anywhere, the frame isn't valid
+    for (size_t cut = BATCH_HDR_SIZE; cut < GOLDEN_SIZE; cut++)
+    {
+        if (decodeBatch(frame.data(), cut, seq, decoded))
+        {
+            std::cerr << "Decoded the golden frame cut to " << cut << " bytes\n";
+            failures++;
+        }
+    }
+
+    // Unknown header bits, too many events, a body longer than any valid one
+    frame[BATCH_HDR_SIZE] |= 8;
+    if (decodeBatch(frame.data(), GOLDEN_SIZE, seq, decoded))
+    {
+        std::cerr << "Decoded an event with unknown header bits\n";
+        failures++;
+    }
+    std::memcpy(frame.data(), GOLDEN_FRAME, GOLDEN_SIZE);
+    uint16_t events = BATCH_MAX_EVENTS + 1;
+    std::memcpy(frame.data() + 7, &events, sizeof(events));
+    if (decodeBatch(frame.data(), GOLDEN_SIZE, seq, decoded))
+    {
+        std::cerr << "Decoded a frame of more than " << BATCH_MAX_EVENTS << " events\n";
+        failures++;
+    }
+    uint16_t body = BATCH_MAX_BODY + 1;
+    std::memcpy(frame.data() + 1, &body, sizeof(body));
+    if (batchFrameSize(frame.data(), BATCH_HDR_SIZE) != 0)
+    {
+        std::cerr << "Accepted a body of " << body << " bytes\n";
+        failures++;
+    }
+    return failures;
+}
+
+int main()
+{
+    if (checkFormat() != 0)
+        return 1;
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> spread(-0.05f, 0.05f);
+
+    // START/STOP events of vehicles around one city, a few per second, as a gateway sends them
+    std::vector<Request> events(BENCH_EVENTS);
+    uint32_t now = BENCH_START;
+    for (Request &r : events)
+    {
+        now += rng() % 3 == 0;
+        r.type = rng() % 2 ? ReqType::START : ReqType::STOP;
+        r.license_id = BENCH_LICENSE + rng() % BENCH_VEHICLES;
+        r.timestamp = now;
+        r.latitude = 32.0263f + spread(rng);
+        r.longitude = 34.8257f + spread(rng);
+        r.lot_id = r.type == ReqType::START ? 1 + rng() % BENCH_LOTS : 0;
+        r.lots_version = 0;
+    }
+
+    // Encoded into full batch frames
+    std::vector<uint8_t> stream(BENCH_EVENTS / BATCH_MAX_EVENTS * (BATCH_HDR_SIZE + BATCH_MAX_BODY) + BATCH_READ_PAD);
+    std::vector<std::pair<size_t, size_t>> frames;    // Offset and size of each frame
+    size_t total = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_EVENTS; i += BATCH_MAX_EVENTS)
+    {
+        size_t size = encodeBatch(stream.data() + total, i, 1, &events[i], BATCH_MAX_EVENTS);
+        frames.emplace_back(total, size);
+        total += size;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // The same events as DATA and DATA_LOT frames, for reference
+    size_t plain = 0;
+    for (const Request &r : events)
+    {
+        plain += r.lot_id != 0 ? DATA_LOT_FRAME_SIZE : DATA_FRAME_SIZE;
+    }
+
+    std::vector<Request> decoded;
+    size_t mismatches = 0;
+    for (const auto &f : frames)
+    {
+        uint32_t seq;
+        if (!decodeBatch(stream.data() + f.first, f.second, seq, decoded))
+        {
+            std::cerr << "Frame at " << f.first << " failed to decode\n";
+            return 1;
+        }
+        for (size_t i = 0; i < decoded.size(); i++)
+        {
+            const Request &a = decoded[i], &b = events[seq + i];
+            if (a.type != b.type || a.license_id != b.license_id || a.timestamp != b.timestamp
+                || a.latitude != b.latitude || a.longitude != b.longitude || a.lot_id != b.lot_id)
+                mismatches++;
+        }
+    }
+
+    uint64_t checksum = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (const auto &f : frames)
+        {
+            uint32_t seq;
+            decodeBatch(stream.data() + f.first, f.second, seq, decoded);
+            checksum += decoded.back().license_id;
+        }
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    double encode_sec = std::chrono::duration<double>(t1 - t0).count();
+    double decode_sec = std::chrono::duration<double>(t3 - t2).count();
+    double decoded_events = double(BENCH_EVENTS) * BENCH_ROUNDS;
+
+    std::cout << "Encoded " << BENCH_EVENTS << " events of " << BENCH_VEHICLES << " vehicles into "
+              << frames.size() << " batch frames in " << encode_sec * 1e3 << " ms\n"
+              << "Bytes/event: " << double(total) / BENCH_EVENTS << " batched, "
+              << double(plain) / BENCH_EVENTS << " in DATA/DATA_LOT frames ("
+              << 100.0 * total / plain << "%)\n"
+              << "Decoded " << decoded_events << " events in " << decode_sec << " s: "
+              << decoded_events / decode_sec << " events/sec, "
+              << double(total) * BENCH_ROUNDS / decode_sec / 1e6 << " MB/s ("
+              << decode_sec / decoded_events * 1e9 << " ns/event)\n"
+              << "Round trip mismatches " << mismatches << ", checksum " << checksum << "\n";
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include "batch_codec.hpp"
+#include <cstring>
+
+namespace Parksys
+{
+    static inline uint32_t zigzag(uint32_t delta)
+    {
+        return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+    }
+
+    static inline uint32_t unzigzag(uint32_t z)
+    {
+        return (z >> 1) ^ (0u - (z & 1));
+    }
+
+    static inline uint32_t float_bits(float f)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+
+    static inline uint8_t *write_varint(uint8_t *p, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            *p++ = static_cast<uint8_t>(value) | 0x80;
+            value >>= 7;
+        }
+        *p++ = static_cast<uint8_t>(value);
+        return p;
+    }
+
+    /**
+     * @brief Read a varint without a loop: an 8-byte load, the position of the
+     *        first clear top bit, and a fixed set of shifts to join the 7-bit groups
+     *
+     * The protocol is little-endian, like the hosts the server runs on.
+     */
+    static inline bool read_varint(const uint8_t *&p, const uint8_t *end, uint32_t &value)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+
+        uint64_t stops = ~word & 0x8080808080ull;      // Last byte markers within 5 bytes
+        if (stops == 0)
+            return false;
+
+        unsigned len = (__builtin_ctzll(stops) + 1) / 8;
+        p += len;
+        if (p > end)
+            return false;
+
+        word &= ~0ull >> (64 - 8 * len);
+        value = static_cast<uint32_t>((word & 0x7f) | (word >> 1 & 0x3f80) | (word >> 2 & 0x1fc000)
+                                      | (word >> 3 & 0xfe00000) | (word >> 4 & 0x7f0000000ull));
+        return true;
+    }
+
+    size_t encodeBatch(uint8_t *out, uint32_t seq, uint32_t lots_version, const Request *reqs, size_t count)
+    {
+        uint8_t *p = out + BATCH_HDR_SIZE;
+        uint32_t license = 0, timestamp = 0, lat = 0, lon = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const Request &r = reqs[i];
+            *p++ = static_cast<uint8_t>(r.type) | (r.lot_id != 0 ? 4 : 0);
+            p = write_varint(p, zigzag(r.license_id - license));
+            p = write_varint(p, zigzag(r.timestamp - timestamp));
+            p = write_varint(p, zigzag(float_bits(r.latitude) - lat));
+            p = write_varint(p, zigzag(float_bits(r.longitude) - lon));
+            if (r.lot_id != 0)
+                p = write_varint(p, r.lot_id);
+
+            license = r.license_id;
+            timestamp = r.timestamp;
+            lat = float_bits(r.latitude);
+            lon = float_bits(r.longitude);
+        }
+
+        uint16_t body = static_cast<uint16_t>(p - out - BATCH_HDR_SIZE);
+        uint16_t events = static_cast<uint16_t>(count);
+        out[0] = static_cast<uint8_t>(FrameType::BATCH);
+        std::memcpy(out + 1, &body, sizeof(body));
+        std::memcpy(out + 3, &seq, sizeof(seq));
+        std::memcpy(out + 7, &events, sizeof(events));
+        std::memcpy(out + 9, &lots_version, sizeof(lots_version));
+        return p - out;
+    }
+
+    size_t batchFrameSize(const uint8_t *frame, size_t avail)
+    {
+        if (avail < 1 + sizeof(uint16_t))
+            return BATCH_HDR_SIZE;
+
+        uint16_t body;
+        std::memcpy(&body, frame + 1, sizeof(body));
+        return body <= BATCH_MAX_BODY ? BATCH_HDR_SIZE + body : 0;
+    }
+
+    bool decodeBatch(const uint8_t *frame, size_t size, uint32_t &seq, std::vector<Request> &reqs)
+    {
+        uint16_t events;
+        uint32_t lots_version;
+        std::memcpy(&seq, frame + 3, sizeof(seq));
+        std::memcpy(&events, frame + 7, sizeof(events));
+        std::memcpy(&lots_version, frame + 9, sizeof(lots_version));
+        if (events > BATCH_MAX_EVENTS)
+            return false;
+
+        const uint8_t *p = frame + BATCH_HDR_SIZE;
+        const uint8_t *end = frame + size;
+        uint32_t license = 0, timestamp = 0, lat = 0, lon = 0;
+
+        reqs.resize(events);
+        for (Request &r : reqs)
+        {
+            if (p >= end)
+                return false;
+            uint8_t hdr = *p++;
+            if ((hdr & ~7u) != 0 || (hdr & 3) > static_cast<uint8_t>(ReqType::STOP))
+                return false;
+
+            uint32_t d_license, d_timestamp, d_lat, d_lon;
+            if (!read_varint(p, end, d_license) || !read_varint(p, end, d_timestamp)
+                || !read_varint(p, end, d_lat) || !read_varint(p, end, d_lon))
+                return false;
+
+            license += unzigzag(d_license);
+            timestamp += unzigzag(d_timestamp);
+            lat += unzigzag(d_lat);
+            lon += unzigzag(d_lon);
+
+            r.type = static_cast<ReqType>(hdr & 3);
+            r.license_id = license;
+            r.timestamp = timestamp;
+            std::memcpy(&r.latitude, &lat, sizeof(lat));
+            std::memcpy(&r.longitude, &lon, sizeof(lon));
+            r.lot_id = 0;
+            r.lots_version = lots_version;
+            if ((hdr & 4) && !read_varint(p, end, r.lot_id))
+                return false;
+        }
+        return p == end;
+    }
+}
@@ -1,16 +1,19 @@
 #include "db.hpp"
 #include "conf.hpp"
 #include <iostream>
+#include <algorithm>
 #include <limits>
 
 namespace Parksys
 {
     static bool backup(sqlite3 *src, sqlite3 *dest);
+    static bool has_column(sqlite3 *db, const std::string &table, const std::string &column);
 
     Database::Database(const std::string &path)
     : runtime_db(nullptr), disk_db(nullptr), disk_ok(false),
     log(std::string(std::getenv("HOME")) + "/" + LOG_PATH), 
-    err(std::string(std::getenv("HOME")) + "/" + ERR_PATH)
+    err(std::string(std::getenv("HOME")) + "/" + ERR_PATH),
+    depth(0), flushed_changes(0), tariff_version(-1), tariff_checked(false)
     {
         // Open runtime database
         if (sqlite3_open(SHM_PATH, &runtime_db) != SQLITE_OK)
@@ -46,9 +49,21 @@ namespace Parksys
                 "is_hourly INTEGER NOT NULL, "
                 "price REAL NOT NULL, "
                 "max_daily_price REAL NOT NULL, "
+                "capacity INTEGER NOT NULL DEFAULT 0, "
+                "grace_sec INTEGER NOT NULL DEFAULT 0, "
                 "FOREIGN KEY(city_id) REFERENCES City(city_id) "
             ");"
             " "
+            "CREATE TABLE IF NOT EXISTS TariffBand ( "
+                "band_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "lot_id INTEGER NOT NULL, "
+                "days INTEGER NOT NULL, "
+                "start_hour INTEGER NOT NULL, "
+                "end_hour INTEGER NOT NULL, "
+                "rate REAL NOT NULL, "
+                "FOREIGN KEY(lot_id) REFERENCES Lot(lot_id) "
+            ");"
+            " "
             "CREATE TABLE IF NOT EXISTS Log ( "
                 "log_id INTEGER PRIMARY KEY AUTOINCREMENT, "
                 "lot_id INTEGER NOT NULL, "
@@ -58,16 +73,105 @@ namespace Parksys
                 "duration_sec INTEGER, "
                 "total_price REAL, "
                 "FOREIGN KEY(lot_id) REFERENCES Lot(lot_id) "
+            ");"
+            " "
+            "CREATE TABLE IF NOT EXISTS TariffVersion ( "
+                "version_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "lot_id INTEGER NOT NULL, "
+                "changed_at INTEGER NOT NULL, "
+                "description TEXT NOT NULL, "
+                "open_sessions INTEGER NOT NULL, "
+                "projected_before REAL NOT NULL, "
+                "projected_after REAL NOT NULL "
+            ");"
+            " "
+            "CREATE TABLE IF NOT EXISTS Gateway ( "
+                "gateway_id INTEGER PRIMARY KEY, "
+                "epoch INTEGER NOT NULL, "
+                "next_seq INTEGER NOT NULL "
+            ");"
+            " "
+            "CREATE TABLE IF NOT EXISTS LotRollup ( "
+                "lot_id INTEGER NOT NULL, "
+                "period INTEGER NOT NULL, "
+                "bucket INTEGER NOT NULL, "
+                "starts INTEGER NOT NULL DEFAULT 0, "
+                "stops INTEGER NOT NULL DEFAULT 0, "
+                "revenue REAL NOT NULL DEFAULT 0, "
+                "PRIMARY KEY(lot_id, period, bucket) "
+            ");"
+            " "
+            "CREATE TABLE IF NOT EXISTS CityRollup ( "
+                "city_id INTEGER NOT NULL, "
+                "period INTEGER NOT NULL, "
+                "bucket INTEGER NOT NULL, "
+                "starts INTEGER NOT NULL DEFAULT 0, "
+                "stops INTEGER NOT NULL DEFAULT 0, "
+                "revenue REAL NOT NULL DEFAULT 0, "
+                "PRIMARY KEY(city_id, period, bucket) "
             ");";
 
+            // Rollups added to a database that already has sessions start from them:
+            // STARTs count in the bucket of start_time, STOPs and revenue in that of end_time
+            const char *sql_backfill_lot_rollup =
+            "INSERT INTO LotRollup(lot_id, period, bucket, starts, stops, revenue) "
+            "SELECT lot_id, period, bucket, SUM(starts), SUM(stops), SUM(revenue) FROM ( "
+                "SELECT Log.lot_id, p.period, start_time - start_time % p.period AS bucket, "
+                "1 AS starts, 0 AS stops, 0.0 AS revenue "
+                "FROM Log, (SELECT 3600 AS period UNION ALL SELECT 86400) p "
+                "UNION ALL "
+                "SELECT Log.lot_id, p.period, end_time - end_time % p.period, 0, 1, IFNULL(total_price, 0) "
+                "FROM Log, (SELECT 3600 AS period UNION ALL SELECT 86400) p WHERE end_time IS NOT NULL "
+            ") GROUP BY lot_id, period, bucket;";
+
+            const char *sql_backfill_city_rollup =
+            "INSERT INTO CityRollup(city_id, period, bucket, starts, stops, revenue) "
+            "SELECT Lot.city_id, period, bucket, SUM(starts), SUM(stops), SUM(revenue) FROM ( "
+                "SELECT Log.lot_id, p.period, start_time - start_time % p.period AS bucket, "
+                "1 AS starts, 0 AS stops, 0.0 AS revenue "
+                "FROM Log, (SELECT 3600 AS period UNION ALL SELECT 86400) p "
+                "UNION ALL "
+                "SELECT Log.lot_id, p.period, end_time - end_time % p.period, 0, 1, IFNULL(total_price, 0) "
+                "FROM Log, (SELECT 3600 AS period UNION ALL SELECT 86400) p WHERE end_time IS NOT NULL "
+            ") e JOIN Lot ON Lot.lot_id = e.lot_id GROUP BY Lot.city_id, period, bucket;";
+
+            // Creating the rollups and filling them happen in one transaction, so a
+            // failure can't leave them created but empty
+            std::string sql = std::string("BEGIN; ") + sql_create_tables;
+            if (!has_column(runtime_db, "LotRollup", "lot_id"))
+                sql += sql_backfill_lot_rollup;
+            if (!has_column(runtime_db, "CityRollup", "city_id"))
+                sql += sql_backfill_city_rollup;
+            sql += " COMMIT;";
+
             char *errmsg = nullptr;
-            if (sqlite3_exec(runtime_db, sql_create_tables, nullptr, nullptr, &errmsg) != SQLITE_OK)
+            if (sqlite3_exec(runtime_db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK)
             {
                 std::string errs = errmsg ? errmsg : "Unknown error";
                 sqlite3_free(errmsg);
+                sqlite3_exec(runtime_db, "ROLLBACK;", nullptr, nullptr, nullptr);
                 err.threadsafe_log("[DB] Failed to create tables: " + errs);
                 throw std::runtime_error("Failed to create tables: " + errs);
             }
+
+            // Columns added to existing tables, for databases created before them
+            const char *added_columns[][3] = {
+                {"Lot", "capacity", "INTEGER NOT NULL DEFAULT 0"},
+                {"Lot", "grace_sec", "INTEGER NOT NULL DEFAULT 0"}
+            };
+
+            for (const auto &col : added_columns)
+            {
+                if (has_column(runtime_db, col[0], col[1])) continue;
+
+                std::string sql = std::string("ALTER TABLE ") + col[0] + " ADD COLUMN " + col[1] + " " + col[2] + ";";
+                if (sqlite3_exec(runtime_db, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+                {
+                    std::string name = std::string(col[0]) + "." + col[1];
+                    err.threadsafe_log("[DB] Failed to add " + name + ": " + std::string(sqlite3_errmsg(runtime_db)));
+                    throw std::runtime_error("Failed to add " + name);
+                }
+            }
         }
         else
         {
@@ -102,17 +206,79 @@ namespace Parksys
         return pdbStatus::PDB_OK;
     }
 
+    pdbStatus Database::begin()
+    {
+        write_m.lock();
+        if (depth == 0)
+            tariff_checked = false;
+
+        // Savepoints nest, and the outermost one starts a transaction
+        if (exec("SAVEPOINT tx" + std::to_string(depth) + ";") != pdbStatus::PDB_OK)
+        {
+            write_m.unlock();
+            return pdbStatus::PDB_ERR;
+        }
+        depth++;
+        return pdbStatus::PDB_OK;
+    }
+
+    pdbStatus Database::commit()
+    {
+        std::string name = "tx" + std::to_string(--depth);
+        pdbStatus status = exec("RELEASE " + name + ";");
+        if (status != pdbStatus::PDB_OK)
+        {
+            exec("ROLLBACK TO " + name + "; RELEASE " + name + ";");
+        }
+        else if (depth == 0 && disk_ok && sqlite3_total_changes(runtime_db) != flushed_changes)
+        {
+            // Also retried by the next commit if it fails
+            status = flushToDisk();
+            if (status == pdbStatus::PDB_OK)
+                flushed_changes = sqlite3_total_changes(runtime_db);
+        }
+
+        write_m.unlock();
+        return status;
+    }
+
+    void Database::rollback()
+    {
+        std::string name = "tx" + std::to_string(--depth);
+        exec("ROLLBACK TO " + name + "; RELEASE " + name + ";");
+        write_m.unlock();
+    }
+
+    pdbStatus Database::exec(const std::string &sql)
+    {
+        char *errmsg = nullptr;
+        if (sqlite3_exec(runtime_db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to run " + sql + " " + std::string(errmsg ? errmsg : "Unknown error"));
+            sqlite3_free(errmsg);
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
+    }
+
     pdbStatus Database::startParking(uint32_t lot_id, uint32_t customer_id, uint32_t timestamp)
     {
         const char *sql =
             "INSERT INTO Log(lot_id, customer_id, start_time) "
             "VALUES(?, ?, ?);";
         
+        // The Log entry and the rollups change together or not at all
+        if (begin() != pdbStatus::PDB_OK)
+        {
+            return pdbStatus::PDB_ERR;
+        }
+
         sqlite3_stmt *stmt = nullptr;
         if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
         {
             err.threadsafe_log("[DB] Failed to prepare startParking: "
                                + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
             return pdbStatus::PDB_ERR;
         }
         
@@ -123,17 +289,22 @@ namespace Parksys
         int rc = sqlite3_step(stmt);
         sqlite3_finalize(stmt);
 
-        if (rc == SQLITE_DONE)
+        if (rc != SQLITE_DONE)
         {
-            flushToDisk();
-            return pdbStatus::PDB_OK;
+            err.threadsafe_log("[DB] Failed to step startParking: " + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
+            return pdbStatus::PDB_ERR;
         }
 
-        err.threadsafe_log("[DB] Failed to step startParking: " + std::string(sqlite3_errmsg(runtime_db)));
-        return pdbStatus::PDB_ERR;
+        if (updateRollups(lot_id, timestamp, 1, 0, 0.0) != pdbStatus::PDB_OK)
+        {
+            rollback();
+            return pdbStatus::PDB_ERR;
+        }
+        return commit();
     }
 
-    pdbStatus Database::endParking(uint32_t customer_id, uint32_t end_time)
+    pdbStatus Database::endParking(uint32_t customer_id, uint32_t end_time, uint32_t &session_lot)
     {
         // Find last log_id with this customer_id that has no end_time
         const char *find_sql =
@@ -141,21 +312,35 @@ namespace Parksys
             "WHERE customer_id = ? AND end_time IS NULL "
             "ORDER BY log_id DESC LIMIT 1;";
         
+        // The Log entry and the rollups change together or not at all
+        if (begin() != pdbStatus::PDB_OK)
+        {
+            return pdbStatus::PDB_ERR;
+        }
+
         sqlite3_stmt *find = nullptr;
         if (sqlite3_prepare_v2(runtime_db, find_sql, -1, &find, nullptr) != SQLITE_OK)
         {
             err.threadsafe_log("[DB] Failed to prepare endParking find: " + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
             return pdbStatus::PDB_ERR;
         }
         
         sqlite3_bind_int(find, 1, customer_id);
 
         int rc = sqlite3_step(find);
+        if (rc == SQLITE_DONE)
+        {
+            sqlite3_finalize(find);
+            rollback();
+            return pdbStatus::PDB_NOT_FOUND;
+        }
         if (rc != SQLITE_ROW)
         {
             sqlite3_finalize(find);
             err.threadsafe_log("[DB] Failed to step stopParking find: " 
                                + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
             return pdbStatus::PDB_ERR;
         }
 
@@ -163,10 +348,11 @@ namespace Parksys
         int start_time = sqlite3_column_int(find, 1);
         int lot_id = sqlite3_column_int(find, 2);
         sqlite3_finalize(find);
+        session_lot = lot_id;
 
         // calculate duration and price
         int duration = int(end_time) - start_time;
-        double total = calculatePrice(duration, lot_id); 
+        double total = calculatePrice(lot_id, start_time, end_time);
 
         // Update the same record
         const char *upd_sql =
@@ -178,6 +364,7 @@ namespace Parksys
         {
             err.threadsafe_log("[DB] Failed to prepare endParking write: " 
                                + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
             return pdbStatus::PDB_ERR;
         }
         
@@ -189,52 +376,330 @@ namespace Parksys
         rc = sqlite3_step(upd);
         sqlite3_finalize(upd);
 
-        if (rc == SQLITE_DONE)
+        if (rc != SQLITE_DONE)
         {
-            flushToDisk();
-            return pdbStatus::PDB_OK;
+            err.threadsafe_log("[DB] Failed to step stopParking write: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            rollback();
+            return pdbStatus::PDB_ERR;
         }
 
-        err.threadsafe_log("[DB] Failed to step stopParking write: " 
-                           + std::string(sqlite3_errmsg(runtime_db)));
-        return pdbStatus::PDB_ERR;
+        if (updateRollups(lot_id, end_time, 0, 1, total) != pdbStatus::PDB_OK)
+        {
+            rollback();
+            return pdbStatus::PDB_ERR;
+        }
+        return commit();
     }
 
-    double Database::calculatePrice(int duration_sec, uint32_t lot_id)
+    pdbStatus Database::countOpenSessions(std::vector<std::pair<uint32_t, uint32_t>> &counts)
     {
-        const char *sql = "SELECT is_hourly, price, max_daily_price "
-                          "FROM Lot WHERE lot_id = ?;";
+        const char *sql = "SELECT lot_id, COUNT(*) FROM Log "
+                          "WHERE end_time IS NULL GROUP BY lot_id;";
 
         sqlite3_stmt *stmt = nullptr;
         if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
         {
-            err.threadsafe_log("[DB] Failed to prepare calculatePrice: " 
+            err.threadsafe_log("[DB] Failed to prepare countOpenSessions: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        counts.clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            counts.emplace_back(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step countOpenSessions: "
                                + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
+    }
+
+    double Database::calculatePrice(uint32_t lot_id, uint32_t start_time, uint32_t end_time)
+    {
+        double total = 0.0;
+        if (!tariffEngine()->price(lot_id, start_time, end_time, total))
+        {
+            err.threadsafe_log("[DB] No such lot_id: " + std::to_string(lot_id) + " for price calculation");
             return 0.0;
         }
+        return total;
+    }
+
+    std::shared_ptr<const TariffEngine> Database::tariffEngine()
+    {
+        std::lock_guard<std::recursive_mutex> tx(write_m);
+        std::lock_guard<std::mutex> lock(tariff_m);
+
+        // Changes made by other connections (e.g. parksys-price-updater),
+        // checked once per transaction and on every call outside of one
+        if (tariffs && depth > 0 && tariff_checked)
+            return tariffs;
+
+        int64_t version = dataVersion();
+        tariff_checked = true;
+        if (tariffs && version == tariff_version)
+            return tariffs;
+
+        std::vector<TariffRules> rules;
+        if (getTariffRules(rules) != pdbStatus::PDB_OK)
+        {
+            if (!tariffs)
+                tariffs = std::make_shared<const TariffEngine>();
+            return tariffs;
+        }
+
+        tariffs = std::make_shared<const TariffEngine>(rules);
+        tariff_version = version;
+        return tariffs;
+    }
+
+    void Database::invalidateTariffs()
+    {
+        std::lock_guard<std::mutex> lock(tariff_m);
+        tariffs.reset();
+    }
+
+    pdbStatus Database::getOpenSessions(std::vector<OpenSession> &sessions)
+    {
+        const char *sql = "SELECT log_id, lot_id, start_time FROM Log WHERE end_time IS NULL;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getOpenSessions: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sessions.clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            OpenSession session;
+            session.log_id = sqlite3_column_int(stmt, 0);
+            session.lot_id = sqlite3_column_int(stmt, 1);
+            session.start_time = sqlite3_column_int64(stmt, 2);
+            sessions.push_back(session);
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step getOpenSessions: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
+    }
+
+    pdbStatus Database::recordTariffVersion(uint32_t lot_id, uint32_t timestamp,
+                                            const std::string &description, const RepriceImpact &impact)
+    {
+        const char *sql =
+        "INSERT INTO TariffVersion(lot_id, changed_at, description, open_sessions, projected_before, projected_after) "
+        "VALUES(?, ?, ?, ?, ?, ?);";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare recordTariffVersion: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
 
         sqlite3_bind_int(stmt, 1, lot_id);
+        sqlite3_bind_int64(stmt, 2, timestamp);
+        sqlite3_bind_text(stmt, 3, description.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 4, impact.sessions);
+        sqlite3_bind_double(stmt, 5, impact.before);
+        sqlite3_bind_double(stmt, 6, impact.after);
 
         int rc = sqlite3_step(stmt);
-        if (rc != SQLITE_ROW)
+        sqlite3_finalize(stmt);
+
+        if (rc == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
-            err.threadsafe_log("[DB] No such lot_id: " + std::to_string(lot_id) + " for price calculation");
-            return 0.0;
+            flushToDisk();
+            return pdbStatus::PDB_OK;
         }
 
-        int is_hourly = sqlite3_column_int(stmt, 0);
-        double price = sqlite3_column_double(stmt, 1);
-        double max_daily = sqlite3_column_double(stmt, 2);
+        return pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::getTariffRules(std::vector<TariffRules> &rules)
+    {
+        const char *lots_sql = "SELECT lot_id, is_hourly, price, max_daily_price, grace_sec "
+                               "FROM Lot ORDER BY lot_id;";
+        const char *bands_sql = "SELECT lot_id, days, start_hour, end_hour, rate "
+                                "FROM TariffBand ORDER BY band_id;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, lots_sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getTariffRules: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
 
+        rules.clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            TariffRules r;
+            r.lot_id = sqlite3_column_int(stmt, 0);
+            r.is_hourly = sqlite3_column_int(stmt, 1) != 0;
+            r.price = sqlite3_column_double(stmt, 2);
+            r.max_daily = sqlite3_column_double(stmt, 3);
+            r.grace_sec = sqlite3_column_int(stmt, 4);
+            rules.push_back(r);
+        }
         sqlite3_finalize(stmt);
 
-        if (!is_hourly)
-            return price;
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step getTariffRules: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        if (sqlite3_prepare_v2(runtime_db, bands_sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getTariffRules bands: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            uint32_t lot_id = sqlite3_column_int(stmt, 0);
+            auto it = std::lower_bound(rules.begin(), rules.end(), lot_id,
+                                       [](const TariffRules &r, uint32_t id) { return r.lot_id < id; });
+            if (it == rules.end() || it->lot_id != lot_id)
+                continue; // Band of a removed lot
+
+            TariffBand b;
+            b.days = sqlite3_column_int(stmt, 1);
+            b.start_hour = sqlite3_column_int(stmt, 2);
+            b.end_hour = sqlite3_column_int(stmt, 3);
+            b.rate = sqlite3_column_double(stmt, 4);
+            it->bands.push_back(b);
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step getTariffRules bands: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
+    }
+
+    pdbStatus Database::updateRollups(uint32_t lot_id, uint32_t timestamp,
+                                      int starts, int stops, double revenue)
+    {
+        // Each event touches exactly one hourly and one daily bucket per table,
+        // so the cost doesn't depend on the size of Log
+        const char *sqls[] = {
+            "INSERT INTO LotRollup(lot_id, period, bucket, starts, stops, revenue) "
+            "SELECT ?1, p.period, ?2 - ?2 % p.period, ?3, ?4, ?5 "
+            "FROM (SELECT 3600 AS period UNION ALL SELECT 86400) p WHERE 1 "
+            "ON CONFLICT(lot_id, period, bucket) DO UPDATE SET "
+            "starts = starts + excluded.starts, stops = stops + excluded.stops, "
+            "revenue = revenue + excluded.revenue;",
+
+            "INSERT INTO CityRollup(city_id, period, bucket, starts, stops, revenue) "
+            "SELECT Lot.city_id, p.period, ?2 - ?2 % p.period, ?3, ?4, ?5 "
+            "FROM Lot, (SELECT 3600 AS period UNION ALL SELECT 86400) p WHERE Lot.lot_id = ?1 "
+            "ON CONFLICT(city_id, period, bucket) DO UPDATE SET "
+            "starts = starts + excluded.starts, stops = stops + excluded.stops, "
+            "revenue = revenue + excluded.revenue;"
+        };
+
+        pdbStatus status = pdbStatus::PDB_OK;
+        for (const char *sql : sqls)
+        {
+            sqlite3_stmt *stmt = nullptr;
+            if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                err.threadsafe_log("[DB] Failed to prepare updateRollups: "
+                                   + std::string(sqlite3_errmsg(runtime_db)));
+                return pdbStatus::PDB_ERR;
+            }
+
+            sqlite3_bind_int(stmt, 1, lot_id);
+            sqlite3_bind_int64(stmt, 2, timestamp);
+            sqlite3_bind_int(stmt, 3, starts);
+            sqlite3_bind_int(stmt, 4, stops);
+            sqlite3_bind_double(stmt, 5, revenue);
+
+            if (sqlite3_step(stmt) != SQLITE_DONE)
+            {
+                err.threadsafe_log("[DB] Failed to step updateRollups: "
+                                   + std::string(sqlite3_errmsg(runtime_db)));
+                status = pdbStatus::PDB_ERR;
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        return status;
+    }
+
+    pdbStatus Database::getRollup(RollupScope scope, uint32_t id, uint32_t period,
+                                  uint32_t from, uint32_t to, std::vector<RollupRow> &rows)
+    {
+        const char *sql_lot =
+            "SELECT bucket, starts, stops, revenue FROM LotRollup "
+            "WHERE lot_id = ? AND period = ? AND bucket BETWEEN ? AND ? "
+            "ORDER BY bucket;";
+        const char *sql_city =
+            "SELECT bucket, starts, stops, revenue FROM CityRollup "
+            "WHERE city_id = ? AND period = ? AND bucket BETWEEN ? AND ? "
+            "ORDER BY bucket;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, scope == RollupScope::LOT ? sql_lot : sql_city,
+                               -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getRollup: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        // Include the bucket that contains 'from'
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int(stmt, 2, period);
+        sqlite3_bind_int64(stmt, 3, from - from % period);
+        sqlite3_bind_int64(stmt, 4, to);
+
+        rows.clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            RollupRow row;
+            row.bucket = sqlite3_column_int64(stmt, 0);
+            row.starts = sqlite3_column_int(stmt, 1);
+            row.stops = sqlite3_column_int(stmt, 2);
+            row.revenue = sqlite3_column_double(stmt, 3);
+            rows.push_back(row);
+        }
+        sqlite3_finalize(stmt);
 
-        int duration_hours = (std::max(duration_sec, 0) + 3599) / 3600;  // rounded up
-        double total = duration_hours * price;
-        return std::min(total, max_daily);
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step getRollup: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
     }
 
     pdbStatus Database::addCity(const std::string &name)
@@ -292,6 +757,7 @@ namespace Parksys
 
         if (rc == SQLITE_DONE)
         {
+            invalidateTariffs();
             flushToDisk();
             return pdbStatus::PDB_OK;
         }
@@ -301,11 +767,12 @@ namespace Parksys
 
     pdbStatus Database::addLot(const std::string &name, uint32_t city_id,
                                float latitude, float longitude,
-                               bool is_hourly, double price, double max_daily)
+                               bool is_hourly, double price, double max_daily,
+                               uint32_t capacity)
     {
         const char *sql =
-        "INSERT INTO Lot(city_id, lot_name, latitude, longitude, is_hourly, price, max_daily_price) "
-        "VALUES(?, ?, ?, ?, ?, ?, ?);";
+        "INSERT INTO Lot(city_id, lot_name, latitude, longitude, is_hourly, price, max_daily_price, capacity) "
+        "VALUES(?, ?, ?, ?, ?, ?, ?, ?);";
 
         sqlite3_stmt *stmt = nullptr;
         if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
@@ -322,12 +789,14 @@ namespace Parksys
         sqlite3_bind_int(stmt, 5, is_hourly ? 1 : 0);
         sqlite3_bind_double(stmt, 6, price);
         sqlite3_bind_double(stmt, 7, max_daily);
+        sqlite3_bind_int(stmt, 8, capacity);
 
         int rc = sqlite3_step(stmt);
         sqlite3_finalize(stmt);
 
         if (rc == SQLITE_DONE)
         {
+            invalidateTariffs();
             flushToDisk();
             return pdbStatus::PDB_OK;
         }
@@ -354,6 +823,7 @@ namespace Parksys
 
         if (rc == SQLITE_DONE)
         {
+            invalidateTariffs();
             flushToDisk();
             return pdbStatus::PDB_OK;
         }
@@ -399,6 +869,7 @@ namespace Parksys
 
         if (rc == SQLITE_DONE)
         {
+            invalidateTariffs();
             flushToDisk();
             return pdbStatus::PDB_OK;
         }
@@ -428,6 +899,94 @@ namespace Parksys
 
         if (rc == SQLITE_DONE)
         {
+            invalidateTariffs();
+            flushToDisk();
+            return pdbStatus::PDB_OK;
+        }
+
+        return pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::setLotCapacity(uint32_t lot_id, uint32_t capacity)
+    {
+        const char *sql = "UPDATE Lot SET capacity = ? WHERE lot_id = ?;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare setLotCapacity: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int(stmt, 1, capacity);
+        sqlite3_bind_int(stmt, 2, lot_id);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc == SQLITE_DONE)
+        {
+            flushToDisk();
+            return pdbStatus::PDB_OK;
+        }
+
+        return pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::setLotGrace(uint32_t lot_id, uint32_t grace_sec)
+    {
+        const char *sql = "UPDATE Lot SET grace_sec = ? WHERE lot_id = ?;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare setLotGrace: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int(stmt, 1, grace_sec);
+        sqlite3_bind_int(stmt, 2, lot_id);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc == SQLITE_DONE)
+        {
+            invalidateTariffs();
+            flushToDisk();
+            return pdbStatus::PDB_OK;
+        }
+
+        return pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::addTariffBand(uint32_t lot_id, const TariffBand &band)
+    {
+        const char *sql = "INSERT INTO TariffBand(lot_id, days, start_hour, end_hour, rate) "
+                          "VALUES(?, ?, ?, ?, ?);";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare addTariffBand: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int(stmt, 1, lot_id);
+        sqlite3_bind_int(stmt, 2, band.days);
+        sqlite3_bind_int(stmt, 3, band.start_hour);
+        sqlite3_bind_int(stmt, 4, band.end_hour);
+        sqlite3_bind_double(stmt, 5, band.rate);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc == SQLITE_DONE)
+        {
+            invalidateTariffs();
             flushToDisk();
             return pdbStatus::PDB_OK;
         }
@@ -435,6 +994,166 @@ namespace Parksys
         return pdbStatus::PDB_ERR;
     }
 
+    pdbStatus Database::removeTariffBand(uint32_t band_id)
+    {
+        const char *sql = "DELETE FROM TariffBand WHERE band_id = ?;";
+
+        // No other thread's write between the delete and counting its changes
+        std::lock_guard<std::recursive_mutex> lock(write_m);
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare removeTariffBand: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int(stmt, 1, band_id);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step removeTariffBand: "
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        if (sqlite3_changes(runtime_db) == 0)
+        {
+            err.threadsafe_log("[DB] No such band_id: " + std::to_string(band_id));
+            return pdbStatus::PDB_ERR;
+        }
+
+        invalidateTariffs();
+        flushToDisk();
+        return pdbStatus::PDB_OK;
+    }
+
+    pdbStatus Database::getGateway(uint32_t gateway_id, uint32_t &epoch, uint32_t &next_seq)
+    {
+        const char *sql = "SELECT epoch, next_seq FROM Gateway WHERE gateway_id = ?;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getGateway: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int64(stmt, 1, gateway_id);
+
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            epoch = static_cast<uint32_t>(sqlite3_column_int64(stmt, 0));
+            next_seq = static_cast<uint32_t>(sqlite3_column_int64(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+
+        return rc == SQLITE_ROW ? pdbStatus::PDB_OK : pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::setGateway(uint32_t gateway_id, uint32_t epoch, uint32_t next_seq)
+    {
+        const char *sql =
+            "INSERT INTO Gateway(gateway_id, epoch, next_seq) VALUES(?, ?, ?) "
+            "ON CONFLICT(gateway_id) DO UPDATE SET epoch = excluded.epoch, next_seq = excluded.next_seq;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare setGateway: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        sqlite3_bind_int64(stmt, 1, gateway_id);
+        sqlite3_bind_int64(stmt, 2, epoch);
+        sqlite3_bind_int64(stmt, 3, next_seq);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc == SQLITE_DONE)
+            return pdbStatus::PDB_OK;
+
+        err.threadsafe_log("[DB] Failed to step setGateway: " + std::string(sqlite3_errmsg(runtime_db)));
+        return pdbStatus::PDB_ERR;
+    }
+
+    pdbStatus Database::getLots(std::vector<LotInfo> &lots)
+    {
+        const char *sql = "SELECT lot_id, latitude, longitude, capacity FROM Lot;";
+
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            err.threadsafe_log("[DB] Failed to prepare getLots: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+
+        lots.clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            LotInfo lot;
+            lot.lot_id = sqlite3_column_int(stmt, 0);
+            lot.latitude = sqlite3_column_double(stmt, 1);
+            lot.longitude = sqlite3_column_double(stmt, 2);
+            lot.capacity = sqlite3_column_int(stmt, 3);
+            lots.push_back(lot);
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            err.threadsafe_log("[DB] Failed to step getLots: " 
+                               + std::string(sqlite3_errmsg(runtime_db)));
+            return pdbStatus::PDB_ERR;
+        }
+        return pdbStatus::PDB_OK;
+    }
+
+    int64_t Database::dataVersion()
+    {
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(runtime_db, "PRAGMA data_version;", -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return -1;
+        }
+
+        int64_t version = -1;
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            version = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return version;
+    }
+
+    static bool has_column(sqlite3 *db, const std::string &table, const std::string &column)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        std::string sql = "PRAGMA table_info(" + table + ");";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return false;
+        }
+
+        bool found = false;
+        while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const unsigned char *name = sqlite3_column_text(stmt, 1);
+            found = name && column == reinterpret_cast<const char*>(name);
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+
     static bool backup(sqlite3 *src, sqlite3 *dest)
     {
         sqlite3_backup *b = sqlite3_backup_init(dest, "main", src, "main");
@@ -0,0 +1,167 @@
+#include "lot_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace Parksys
+{
+    LotIndex::LotIndex(const std::vector<LotInfo> &lots, const Occupancy &occ)
+    : parent(lots.size(), -1),
+    avail(new std::atomic<uint32_t>[lots.size()]),
+    is_free(new std::atomic<bool>[lots.size()]),
+    occ(occ)
+    {
+        uint32_t max_id = 0;
+        nodes.reserve(lots.size());
+        for (const LotInfo &lot : lots)
+        {
+            nodes.push_back({lot.latitude, lot.longitude, lot.lot_id, lot.capacity});
+            max_id = std::max(max_id, lot.lot_id);
+        }
+
+        position.assign(lots.empty() ? 0 : max_id + 1, -1);
+        build(0, nodes.size(), 0, -1);
+        build_table(lots);
+    }
+
+    void LotIndex::build_table(const std::vector<LotInfo> &lots)
+    {
+        // Sorted by ID, so the version only changes with the lots themselves
+        std::vector<LotInfo> sorted(lots);
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const LotInfo &a, const LotInfo &b) { return a.lot_id < b.lot_id; });
+
+        const uint32_t count = sorted.size();
+        lot_table.resize(2 * sizeof(uint32_t) + count * 3 * sizeof(uint32_t));
+        uint8_t *lat = lot_table.data() + 2 * sizeof(uint32_t);
+        uint8_t *lon = lat + count * sizeof(float);
+        uint8_t *ids = lon + count * sizeof(float);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            std::memcpy(lat + i * sizeof(float), &sorted[i].latitude, sizeof(float));
+            std::memcpy(lon + i * sizeof(float), &sorted[i].longitude, sizeof(float));
+            std::memcpy(ids + i * sizeof(uint32_t), &sorted[i].lot_id, sizeof(uint32_t));
+        }
+
+        // FNV-1a of the arrays; 0 stands for no table on the gateway
+        uint32_t hash = 2166136261u;
+        for (size_t i = 2 * sizeof(uint32_t); i < lot_table.size(); i++)
+        {
+            hash = (hash ^ lot_table[i]) * 16777619u;
+        }
+        table_version = hash != 0 ? hash : 1;
+
+        std::memcpy(lot_table.data(), &table_version, sizeof(table_version));
+        std::memcpy(lot_table.data() + sizeof(uint32_t), &count, sizeof(count));
+    }
+
+    int32_t LotIndex::build(size_t lo, size_t hi, unsigned depth, int32_t up)
+    {
+        if (lo >= hi) return -1;
+
+        size_t mid = (lo + hi) / 2;
+        bool by_lat = (depth % 2 == 0);
+        std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi,
+                         [by_lat](const Node &a, const Node &b)
+                         {
+                             return by_lat ? a.latitude < b.latitude : a.longitude < b.longitude;
+                         });
+
+        parent[mid] = up;
+        position[nodes[mid].lot_id] = mid;
+
+        build(lo, mid, depth + 1, mid);
+        build(mid + 1, hi, depth + 1, mid);
+
+        // Children are built, so their summaries are ready
+        bool free_now = has_room(mid);
+        is_free[mid].store(free_now, std::memory_order_relaxed);
+
+        uint32_t count = free_now ? 1 : 0;
+        if (lo < mid) count += avail[(lo + mid) / 2].load(std::memory_order_relaxed);
+        if (mid + 1 < hi) count += avail[(mid + 1 + hi) / 2].load(std::memory_order_relaxed);
+        avail[mid].store(count, std::memory_order_relaxed);
+
+        return mid;
+    }
+
+    bool LotIndex::has_room(size_t pos) const
+    {
+        const Node &n = nodes[pos];
+        // A limited lot whose occupancy isn't counted can't be shown to have room
+        return n.capacity == 0 || (occ.tracks(n.lot_id) && occ.get(n.lot_id) < n.capacity);
+    }
+
+    bool LotIndex::nearest(float latitude, float longitude, bool available_only, uint32_t &lot_id) const
+    {
+        float best_dist = std::numeric_limits<float>::max();
+        int32_t best = -1;
+
+        search(0, nodes.size(), 0, latitude, longitude, available_only, best_dist, best);
+
+        if (best < 0) return false;
+        lot_id = nodes[best].lot_id;
+        return true;
+    }
+
+    void LotIndex::search(size_t lo, size_t hi, unsigned depth, float latitude, float longitude,
+                          bool available_only, float &best_dist, int32_t &best) const
+    {
+        if (lo >= hi) return;
+
+        size_t mid = (lo + hi) / 2;
+        if (available_only && avail[mid].load(std::memory_order_relaxed) == 0)
+            return; // Whole subtree is full
+
+        const Node &n = nodes[mid];
+        float dx = n.latitude - latitude;
+        float dy = n.longitude - longitude;
+        float dist = dx * dx + dy * dy;
+
+        if (dist < best_dist && (!available_only || is_free[mid].load(std::memory_order_relaxed)))
+        {
+            best_dist = dist;
+            best = mid;
+        }
+
+        float diff = (depth % 2 == 0) ? latitude - n.latitude : longitude - n.longitude;
+        size_t near_lo = diff < 0 ? lo : mid + 1;
+        size_t near_hi = diff < 0 ? mid : hi;
+        size_t far_lo  = diff < 0 ? mid + 1 : lo;
+        size_t far_hi  = diff < 0 ? hi : mid;
+
+        search(near_lo, near_hi, depth + 1, latitude, longitude, available_only, best_dist, best);
+        if (diff * diff < best_dist)
+            search(far_lo, far_hi, depth + 1, latitude, longitude, available_only, best_dist, best);
+    }
+
+    void LotIndex::update(uint32_t lot_id)
+    {
+        if (!contains(lot_id)) return;
+
+        std::lock_guard<std::mutex> lock(update_m);
+
+        int32_t pos = position[lot_id];
+        bool free_now = has_room(pos);
+        if (is_free[pos].exchange(free_now, std::memory_order_relaxed) == free_now)
+            return; // No transition between full and free
+
+        for (int32_t p = pos; p >= 0; p = parent[p])
+        {
+            if (free_now)
+                avail[p].fetch_add(1, std::memory_order_relaxed);
+            else
+                avail[p].fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool LotIndex::contains(uint32_t lot_id) const
+    {
+        return lot_id < position.size() && position[lot_id] >= 0;
+    }
+
+    bool LotIndex::available(uint32_t lot_id) const
+    {
+        return contains(lot_id) && is_free[position[lot_id]].load(std::memory_order_relaxed);
+    }
+}
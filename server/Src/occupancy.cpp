@@ -0,0 +1,157 @@
+#include "occupancy.hpp"
+#include "conf.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <stdexcept>
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "occupancy counters must be lock-free");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "occupancy counters must be plain 32-bit integers in shared memory");
+
+namespace Parksys
+{
+    Occupancy::Occupancy(bool owner)
+    : counters(nullptr), mapped(0), owner(owner)
+    {
+        int fd = owner ? open(OCC_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644)
+                       : open(OCC_PATH, O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to open " OCC_PATH);
+        }
+
+        // The owner starts small, a reader maps as much as the owner has grown it to
+        size_t size = OCC_INITIAL_LOTS * sizeof(std::atomic<uint32_t>);
+        if (owner && ftruncate(fd, size) < 0)
+        {
+            close(fd);
+            throw std::runtime_error("Failed to resize " OCC_PATH);
+        }
+        if (!owner)
+        {
+            struct stat st;
+            if (fstat(fd, &st) < 0 || st.st_size <= 0)
+            {
+                close(fd);
+                throw std::runtime_error("Failed to stat " OCC_PATH);
+            }
+            size = static_cast<size_t>(st.st_size) / sizeof(std::atomic<uint32_t>) * sizeof(std::atomic<uint32_t>);
+        }
+
+        void *p = mmap(nullptr, size, owner ? PROT_READ | PROT_WRITE : PROT_READ,
+                       MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map " OCC_PATH);
+        }
+
+        counters.store(static_cast<std::atomic<uint32_t>*>(p), std::memory_order_relaxed);
+        mapped.store(size / sizeof(std::atomic<uint32_t>), std::memory_order_relaxed);
+    }
+
+    Occupancy::~Occupancy()
+    {
+        munmap(counters.load(), size() * sizeof(std::atomic<uint32_t>));
+        for (const auto &m : retired)
+        {
+            munmap(m.first, m.second);
+        }
+        if (owner)
+        {
+            std::remove(OCC_PATH);
+        }
+    }
+
+    bool Occupancy::reserve(uint32_t lot_id)
+    {
+        uint32_t cur = mapped.load(std::memory_order_relaxed);
+        if (lot_id < cur) return true;
+        if (!owner) return false;
+
+        // Double until the lot fits, so a growing deployment remaps rarely
+        uint64_t n = cur;
+        while (n <= lot_id) n *= 2;
+        if (n > UINT32_MAX) n = UINT32_MAX;
+        if (lot_id >= n) return false;
+
+        int fd = open(OCC_PATH, O_RDWR);
+        if (fd < 0) return false;
+        size_t size = n * sizeof(std::atomic<uint32_t>);
+        void *p = ftruncate(fd, size) < 0 ? MAP_FAILED
+                : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+
+        // The new mapping shares the old one's pages, so readers still holding
+        // the old pointer keep seeing every update. It's only unmapped at exit.
+        retired.emplace_back(counters.load(std::memory_order_relaxed), cur * sizeof(std::atomic<uint32_t>));
+        counters.store(static_cast<std::atomic<uint32_t>*>(p), std::memory_order_release);
+        mapped.store(static_cast<uint32_t>(n), std::memory_order_release);
+        return true;
+    }
+
+    bool Occupancy::tracks(uint32_t lot_id) const
+    {
+        return lot_id < size();
+    }
+
+    uint32_t Occupancy::size() const
+    {
+        return mapped.load(std::memory_order_acquire);
+    }
+
+    std::atomic<uint32_t> *Occupancy::counter(uint32_t lot_id) const
+    {
+        // The pointer is published before the count, so it covers any count read first
+        if (lot_id >= mapped.load(std::memory_order_acquire)) return nullptr;
+        return counters.load(std::memory_order_acquire) + lot_id;
+    }
+
+    uint32_t Occupancy::increment(uint32_t lot_id)
+    {
+        std::atomic<uint32_t> *c = counter(lot_id);
+        if (!c) return 0;
+        return c->fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    uint32_t Occupancy::decrement(uint32_t lot_id)
+    {
+        std::atomic<uint32_t> *c = counter(lot_id);
+        if (!c) return 0;
+
+        uint32_t cur = c->load(std::memory_order_relaxed);
+        while (cur > 0 &&
+               !c->compare_exchange_weak(cur, cur - 1, std::memory_order_relaxed))
+        {
+        }
+        return cur > 0 ? cur - 1 : 0;
+    }
+
+    uint32_t Occupancy::get(uint32_t lot_id) const
+    {
+        std::atomic<uint32_t> *c = counter(lot_id);
+        if (!c) return 0;
+        return c->load(std::memory_order_relaxed);
+    }
+
+    void Occupancy::set(uint32_t lot_id, uint32_t count)
+    {
+        std::atomic<uint32_t> *c = counter(lot_id);
+        if (!c) return;
+        c->store(count, std::memory_order_relaxed);
+    }
+
+    void Occupancy::reset()
+    {
+        uint32_t n = size();
+        std::atomic<uint32_t> *c = counters.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            c[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
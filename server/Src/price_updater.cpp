@@ -1,10 +1,15 @@
 #include "db.hpp"
 #include "conf.hpp"
 #include "logs.hpp"
+#include "occupancy.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <memory>
 
 using namespace Parksys;
 
@@ -14,10 +19,106 @@ static void print_usage()
     "Usage:\n"
     "  parksys-price-updater add city \"City Name\"\n"
     "  parksys-price-updater remove city <city_id>\n"
-    "  parksys-price-updater add lot \"Lot Name\" <city_id> <lat> <lon> <h|d> <price> [max_daily]\n"
+    "  parksys-price-updater add lot \"Lot Name\" <city_id> <lat> <lon> <h|d> <price> [max_daily] [capacity]\n"
     "  parksys-price-updater remove lot <lot_id>\n"
     "  parksys-price-updater update lot <lot_id> price <price> [<max_daily>]\n"
-    "  parksys-price-updater update lot <lot_id> type <h|d>\n";
+    "  parksys-price-updater update lot <lot_id> type <h|d>\n"
+    "  parksys-price-updater update lot <lot_id> capacity <spaces>\n"
+    "  parksys-price-updater update lot <lot_id> grace <seconds>\n"
+    "  parksys-price-updater add band <lot_id> <days> <start_hour> <end_hour> <rate>\n"
+    "  parksys-price-updater remove band <band_id>\n"
+    "  parksys-price-updater report <lot|city> <id> <h|d> [from_utc] [to_utc]\n"
+    "  parksys-price-updater occupancy [lot_id]\n"
+    "\n"
+    "  Append --impact to update lot, add band or remove band to record the tariff\n"
+    "  version and project the change on all open sessions.\n";
+}
+
+/**
+ * @brief Parse week days given as digits, 0 = Sunday ... 6 = Saturday
+ * 
+ * @param spec Days string, e.g. "56" for Friday and Saturday
+ * @param days Bitmask to fill
+ * @return true if spec is valid
+ */
+static bool parse_days(const std::string &spec, uint8_t &days)
+{
+    days = 0;
+    for (char c : spec)
+    {
+        if (c < '0' || c > '6') return false;
+        days |= 1 << (c - '0');
+    }
+    return days != 0;
+}
+
+/**
+ * @brief Project a tariff change on all open sessions, print and record it
+ * 
+ * @param db Database after the change
+ * @param before Tariffs before the change
+ * @param lot_id ID of the changed lot
+ * @param description What was changed
+ * @return true if successful
+ */
+static bool report_impact(Database &db, const TariffEngine &before,
+                          uint32_t lot_id, const std::string &description)
+{
+    std::vector<OpenSession> sessions;
+    if (db.getOpenSessions(sessions) != pdbStatus::PDB_OK)
+    {
+        std::cerr << "Failed to read open sessions\n";
+        return false;
+    }
+
+    uint32_t now = std::time(nullptr);
+    std::shared_ptr<const TariffEngine> after = db.tariffEngine();
+    RepriceImpact impact = repriceOpenSessions(before, *after, sessions, now);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Open sessions:          " << impact.sessions << "\n"
+              << "Sessions affected:      " << impact.changed << "\n"
+              << "Projected revenue now:  " << impact.before << " -> " << impact.after
+              << " (" << std::showpos << impact.after - impact.before << std::noshowpos << ")\n";
+
+    if (db.recordTariffVersion(lot_id, now, description, impact) != pdbStatus::PDB_OK)
+    {
+        std::cerr << "Failed to record tariff version\n";
+        return false;
+    }
+    return true;
+}
+
+static void print_report(const std::vector<RollupRow> &rows, uint32_t period)
+{
+    std::cout << std::left << std::setw(22) << (period == ROLLUP_HOUR ? "hour (UTC)" : "day (UTC)")
+              << std::right << std::setw(8) << "starts"
+              << std::setw(8) << "stops"
+              << std::setw(12) << "revenue" << "\n";
+
+    uint32_t starts = 0, stops = 0;
+    double revenue = 0.0;
+    for (const RollupRow &row : rows)
+    {
+        char ts[32];
+        time_t t = row.bucket;
+        std::strftime(ts, sizeof(ts), period == ROLLUP_HOUR ? "%Y-%m-%d %H:00" : "%Y-%m-%d",
+                      std::gmtime(&t));
+
+        std::cout << std::left << std::setw(22) << ts
+                  << std::right << std::setw(8) << row.starts
+                  << std::setw(8) << row.stops
+                  << std::setw(12) << std::fixed << std::setprecision(2) << row.revenue << "\n";
+
+        starts += row.starts;
+        stops += row.stops;
+        revenue += row.revenue;
+    }
+
+    std::cout << std::left << std::setw(22) << "total"
+              << std::right << std::setw(8) << starts
+              << std::setw(8) << stops
+              << std::setw(12) << std::fixed << std::setprecision(2) << revenue << "\n";
 }
 
 int main(int argc, char** argv)
@@ -25,6 +126,52 @@ int main(int argc, char** argv)
     Logfile log(std::string(std::getenv("HOME")) + "/" + LOG_PATH), 
             err(std::string(std::getenv("HOME")) + "/" + ERR_PATH);
 
+    // Occupancy is read from the server's shared memory, not from the database
+    if (argc >= 2 && std::string(argv[1]) == "occupancy")
+    {
+        try
+        {
+            Occupancy occ(false);
+            if (argc == 3)
+            {
+                uint32_t lid = std::stoul(argv[2]);
+                std::cout << "Lot " << lid << ": " << occ.get(lid) << "\n";
+            }
+            else
+            {
+                for (uint32_t lid = 0; lid < occ.size(); lid++)
+                {
+                    if (occ.get(lid) > 0)
+                        std::cout << "Lot " << lid << ": " << occ.get(lid) << "\n";
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Occupancy unavailable, is the server running?\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Optional impact mode, may appear anywhere after the command
+    bool impact = false;
+    std::string description;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--impact")
+        {
+            impact = true;
+            for (int j = i; j < argc - 1; j++) argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else
+        {
+            description += (description.empty() ? "" : " ") + std::string(argv[i]);
+        }
+    }
+
     if (argc < 3)
     {
         print_usage();
@@ -36,6 +183,15 @@ int main(int argc, char** argv)
     std::string command = argv[1];
     std::string object = argv[2];
 
+    // Keep the tariffs from before the change for comparison
+    std::shared_ptr<const TariffEngine> before;
+    if (impact)
+    {
+        before = db.tariffEngine();
+    }
+    bool tariff_changed = false;
+    uint32_t changed_lot = 0;
+
     if (command == "add" && object == "city" && argc == 4)
     {
         std::string name = argv[3];
@@ -72,9 +228,10 @@ int main(int argc, char** argv)
         float lon        = std::stof(argv[6]);
         bool is_hourly   = (argv[7][0]=='h');
         double price     = std::stod(argv[8]);
-        double max_daily = (argc==10 ? std::stod(argv[9]) : 0.0);
+        double max_daily = (argc>=10 ? std::stod(argv[9]) : 0.0);
+        uint32_t capacity = (argc==11 ? std::stoul(argv[10]) : 0);
 
-        if (db.addLot(name, city_id, lat, lon, is_hourly, price, max_daily) == pdbStatus::PDB_OK)
+        if (db.addLot(name, city_id, lat, lon, is_hourly, price, max_daily, capacity) == pdbStatus::PDB_OK)
         {
             std::cout << "Lot added: " << name << std::endl;
             log.threadsafe_log("Lot added: " + name);
@@ -117,19 +274,91 @@ int main(int argc, char** argv)
                 return 1;
             }
 
-            db.updateLotPrice(lid, price, max_daily);
+            tariff_changed = (db.updateLotPrice(lid, price, max_daily) == pdbStatus::PDB_OK);
 
         }
         else if (sub == "type" && argc==6)
         {
             bool is_hourly = (argv[5][0]=='h');
-            db.setLotType(lid, is_hourly);
+            tariff_changed = (db.setLotType(lid, is_hourly) == pdbStatus::PDB_OK);
+        }
+        else if (sub == "capacity" && argc==6)
+        {
+            uint32_t capacity = std::stoul(argv[5]);
+            db.setLotCapacity(lid, capacity);
+        }
+        else if (sub == "grace" && argc==6)
+        {
+            uint32_t grace = std::stoul(argv[5]);
+            tariff_changed = (db.setLotGrace(lid, grace) == pdbStatus::PDB_OK);
         }
         else
         {
             print_usage();
             return 1;
         }
+        changed_lot = lid;
+    }
+    else if (command == "add" && object == "band" && argc == 8)
+    {
+        uint32_t lid = std::stoul(argv[3]);
+        TariffBand band;
+        int start_hour = std::stoi(argv[5]);
+        int end_hour   = std::stoi(argv[6]);
+        band.rate      = std::stod(argv[7]);
+
+        if (!parse_days(argv[4], band.days) || start_hour < 0 || end_hour > 24 || start_hour >= end_hour)
+        {
+            std::cerr << "Invalid band. Days are digits 0-6 (0 = Sunday), hours are 0-24\n";
+            return 1;
+        }
+        band.start_hour = start_hour;
+        band.end_hour = end_hour;
+
+        if (db.addTariffBand(lid, band) == pdbStatus::PDB_OK)
+        {
+            tariff_changed = true;
+            changed_lot = lid;
+            std::cout << "Band added to lot " << lid << std::endl;
+            log.threadsafe_log("Band added to lot " + std::to_string(lid));
+        }
+        else
+        {
+            std::cerr << "Failed to add band\n";
+            return 1;
+        }
+    }
+    else if (command == "remove" && object == "band" && argc == 4)
+    {
+        uint32_t bid = std::stoul(argv[3]);
+        if (db.removeTariffBand(bid) == pdbStatus::PDB_OK)
+        {
+            tariff_changed = true;
+            std::cout << "Band removed.\n";
+            log.threadsafe_log("Band with id=" + std::to_string(bid) + " removed");
+        }
+        else
+        {
+            std::cerr << "Failed to remove band. It may not exist.\n";
+            return 1;
+        }
+    }
+    else if (command == "report" && (object == "lot" || object == "city") && argc >= 5)
+    {
+        RollupScope scope = (object == "lot") ? RollupScope::LOT : RollupScope::CITY;
+        uint32_t id     = std::stoul(argv[3]);
+        uint32_t period = (argv[4][0]=='h') ? ROLLUP_HOUR : ROLLUP_DAY;
+        uint32_t from   = (argc >= 6 ? std::stoul(argv[5]) : 0);
+        uint32_t to     = (argc >= 7 ? std::stoul(argv[6]) : UINT32_MAX);
+
+        std::vector<RollupRow> rows;
+        if (db.getRollup(scope, id, period, from, to, rows) != pdbStatus::PDB_OK)
+        {
+            std::cerr << "Failed to read report\n";
+            return 1;
+        }
+
+        print_report(rows, period);
     }
     else
     {
@@ -137,5 +366,10 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (impact && tariff_changed && !report_impact(db, *before, changed_lot, description))
+    {
+        return 1;
+    }
+
     return 0;
 }
@@ -1,15 +1,20 @@
 #include "server.hpp"
+#include "batch_codec.hpp"
 #include "conf.hpp"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
 #include <thread>
+#include <vector>
 
 Parksys::Server::Server(const std::string &ip, uint16_t port, Parksys::Database *pdb)
 : pdb(pdb),
+occ(true),
 log(std::string(std::getenv("HOME")) + "/" + LOG_PATH),
-err(std::string(std::getenv("HOME")) + "/" + ERR_PATH)
+err(std::string(std::getenv("HOME")) + "/" + ERR_PATH),
+index_version(-1)
 {
     listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd < 0)
@@ -51,6 +56,8 @@ err(std::string(std::getenv("HOME")) + "/" + ERR_PATH)
         throw std::runtime_error("Failed to listen");
     }
 
+    rebuild_occupancy();
+
     log.threadsafe_log("[Server] Listening on TCP " + ip + ":" + std::to_string(port));
 }
 
@@ -62,6 +69,95 @@ Parksys::Server::~Server()
     std::remove(SHM_PATH);
 }
 
+void Parksys::Server::rebuild_occupancy()
+{
+    std::vector<std::pair<uint32_t, uint32_t>> counts;
+    if (pdb->countOpenSessions(counts) != pdbStatus::PDB_OK)
+    {
+        err.threadsafe_log("[Server] Failed to rebuild occupancy");
+        return;
+    }
+
+    occ.reset();
+    for (const auto &c : counts)
+    {
+        if (!reserve_occupancy(c.first))
+            continue;
+        occ.set(c.first, c.second);
+    }
+}
+
+bool Parksys::Server::reserve_occupancy(uint32_t lot_id)
+{
+    if (occ.reserve(lot_id))
+        return true;
+    err.threadsafe_log("[Server] Failed to grow occupancy counters for lot " + std::to_string(lot_id) +
+                       ", its occupancy isn't counted and it's treated as full");
+    return false;
+}
+
+void Parksys::Server::track(uint32_t lot_id, bool parked)
+{
+    std::lock_guard<std::mutex> lock(index_m);
+
+    // A lot added since the last rebuild may be past the counters mapped so far
+    if (!occ.tracks(lot_id) && !reserve_occupancy(lot_id))
+        return;
+
+    if (parked)
+        occ.increment(lot_id);
+    else
+        occ.decrement(lot_id);
+
+    // The current index, not one a caller may still hold from before a rebuild
+    if (index)
+        index->update(lot_id);
+}
+
+void Parksys::Server::resync()
+{
+    std::lock_guard<std::mutex> lock(index_m);
+
+    rebuild_occupancy();
+    index_version = -1;
+    index_check = std::chrono::steady_clock::time_point();
+}
+
+std::shared_ptr<Parksys::LotIndex> Parksys::Server::lot_index()
+{
+    std::lock_guard<std::mutex> lock(index_m);
+
+    auto now = std::chrono::steady_clock::now();
+    if (index && now - index_check < std::chrono::milliseconds(LOT_REFRESH_MS))
+        return index;
+    index_check = now;
+
+    int64_t version = pdb->dataVersion();
+    if (index && version == index_version)
+        return index;
+
+    std::vector<LotInfo> lots;
+    if (pdb->getLots(lots) != pdbStatus::PDB_OK)
+    {
+        err.threadsafe_log("[Server] Failed to load lots, keeping previous lot index");
+        if (!index)
+            index = std::make_shared<LotIndex>(lots, occ);
+        return index;
+    }
+
+    // Grow the counters for new lots before the index reads them
+    uint32_t max_id = 0;
+    for (const auto &l : lots)
+        max_id = std::max(max_id, l.lot_id);
+    if (!lots.empty())
+        reserve_occupancy(max_id);
+
+    index = std::make_shared<LotIndex>(lots, occ);
+    index_version = version;
+    log.threadsafe_log("[Server] Lot index built with " + std::to_string(lots.size()) + " lots");
+    return index;
+}
+
 void Parksys::Server::run()
 {
     while (true)
@@ -86,34 +182,333 @@ void Parksys::Server::run()
 
 void Parksys::Server::handle_client(int client_fd)
 {
-    uint8_t buffer[REQ_SIZE];
+    std::vector<uint8_t> buffer(RECV_BUF_SIZE + BATCH_READ_PAD);
+    std::vector<Request> reqs;          // Requests of the data frame being handled
+    size_t len = 0;
+    std::shared_ptr<GatewayState> gw;   // Set by the hello frame
+    bool first = true;                  // No data frame since the hello
+    bool wants_lots = false;            // The gateway resolves lots itself
+    uint32_t lots_have = 0;             // Version of the gateway's lot table
 
     while (true)
     {
-        if (!recv_request(client_fd, buffer, REQ_SIZE))
+        ssize_t bytes = recv(client_fd, buffer.data() + len, RECV_BUF_SIZE - len, 0);
+        if (bytes <= 0)
         {
             break;
         }
+        len += bytes;
 
-        Request req;
-        if (parse_request(buffer, req))
+        // Handle every complete frame received so far in one transaction, so
+        // they reach the disk in one flush, then acknowledge them at once
+        if (pdb->begin() != pdbStatus::PDB_OK)
         {
-            handle_request(req);
+            err.threadsafe_log("[Server] Failed to start a transaction, dropping client");
+            break;
         }
-        else
+
+        size_t offset = 0, handled = 0, duplicates = 0;
+        bool rejected = false, drop = false;
+        while (offset < len && !rejected && !drop)
         {
-            err.threadsafe_log("[Server] Received invalid message");
+            const uint8_t *frame = buffer.data() + offset;
+            size_t size = frame_size(frame, len - offset);
+            if (size == 0)
+            {
+                // There's no way to find where the next frame starts
+                err.threadsafe_log("[Server] Unknown frame type " + std::to_string(frame[0]) + ", dropping client");
+                drop = true;
+                break;
+            }
+            if (len - offset < size)
+            {
+                break;
+            }
+
+            if (frame[0] == static_cast<uint8_t>(FrameType::HELLO))
+            {
+                gw = handle_hello(frame);
+                first = true;
+            }
+            else if (frame[0] == static_cast<uint8_t>(FrameType::LOTS_REQ))
+            {
+                wants_lots = true;
+                std::memcpy(&lots_have, frame + 1, sizeof(lots_have));
+            }
+            else if (frame[0] == static_cast<uint8_t>(FrameType::DATA)
+                     || frame[0] == static_cast<uint8_t>(FrameType::DATA_LOT)
+                     || frame[0] == static_cast<uint8_t>(FrameType::BATCH))
+            {
+                if (!gw)
+                {
+                    err.threadsafe_log("[Server] Data frame before hello, dropping client");
+                    drop = true;
+                    break;
+                }
+
+                uint32_t seq;
+                bool valid = true;
+                if (frame[0] == static_cast<uint8_t>(FrameType::BATCH))
+                {
+                    if (!decodeBatch(frame, size, seq, reqs))
+                    {
+                        err.threadsafe_log("[Server] Malformed batch frame, dropping client");
+                        drop = true;
+                        break;
+                    }
+                }
+                else
+                {
+                    std::memcpy(&seq, frame + 1, sizeof(seq));
+                    reqs.resize(1);
+                    valid = parse_request(frame + 1 + sizeof(seq), reqs[0]);
+                    if (valid && frame[0] == static_cast<uint8_t>(FrameType::DATA_LOT))
+                    {
+                        const uint8_t *lot = frame + DATA_FRAME_SIZE;
+                        std::memcpy(&reqs[0].lot_id, lot, sizeof(reqs[0].lot_id));
+                        std::memcpy(&reqs[0].lots_version, lot + sizeof(reqs[0].lot_id), sizeof(reqs[0].lots_version));
+                    }
+                }
+
+                for (size_t i = 0; i < reqs.size() && !rejected; i++)
+                {
+                    DataResult result = handle_data(*gw, seq + i, valid ? &reqs[i] : nullptr, first);
+                    first = false;
+                    switch (result)
+                    {
+                    case DataResult::HANDLED:
+                        handled++;
+                        break;
+                    case DataResult::DUPLICATE:
+                        duplicates++;
+                        break;
+                    case DataResult::REJECTED:
+                        rejected = true;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                // Legacy unacknowledged request
+                Request req;
+                if (parse_request(frame, req))
+                {
+                    handle_request(req);
+                }
+                else
+                {
+                    err.threadsafe_log("[Server] Received invalid message");
+                }
+            }
+            offset += size;
+        }
+
+        std::memmove(buffer.data(), buffer.data() + offset, len - offset);
+        len -= offset;
+
+        // Nothing is acknowledged unless it's on disk
+        if (pdb->commit() != pdbStatus::PDB_OK)
+        {
+            err.threadsafe_log("[Server] Failed to store received events, dropping client");
+            if (gw)
+            {
+                // Back to what was stored, which the gateway resends from
+                std::lock_guard<std::mutex> lock(gw->m);
+                if (pdb->getGateway(gw->id, gw->epoch, gw->next_seq) != pdbStatus::PDB_OK)
+                    gw->next_seq = 0;
+            }
+            resync();
+            break;
+        }
+        if (drop)
+        {
+            break;
+        }
+
+        if (duplicates > 0)
+        {
+            log.threadsafe_log("[Server] Gateway " + std::to_string(gw->id) + " resent "
+                               + std::to_string(duplicates) + " handled events, skipped");
+        }
+
+        if ((handled > 0 || duplicates > 0) && !send_ack(client_fd, *gw))
+        {
+            break;
+        }
+
+        // Pushed on the gateway's next batch whenever lots change
+        if (wants_lots && !send_lots(client_fd, lots_have))
+        {
+            break;
+        }
+
+        // Whatever followed was sent on the assumption it would be handled, so
+        // the gateway has to reconnect and resend from the last acknowledgement
+        if (rejected)
+        {
+            err.threadsafe_log("[Server] Gateway " + std::to_string(gw->id) + " frame rejected, dropping client");
+            break;
         }
     }
 }
 
-bool Parksys::Server::recv_request(int fd, void *buf, size_t size)
+size_t Parksys::Server::frame_size(const uint8_t *frame, size_t avail)
+{
+    switch (frame[0])
+    {
+    case static_cast<uint8_t>(FrameType::DATA):
+        return DATA_FRAME_SIZE;
+    case static_cast<uint8_t>(FrameType::HELLO):
+        return HELLO_FRAME_SIZE;
+    case static_cast<uint8_t>(FrameType::DATA_LOT):
+        return DATA_LOT_FRAME_SIZE;
+    case static_cast<uint8_t>(FrameType::LOTS_REQ):
+        return LOTS_REQ_FRAME_SIZE;
+    case static_cast<uint8_t>(FrameType::BATCH):
+        return batchFrameSize(frame, avail);
+    default:
+        return frame[0] <= static_cast<uint8_t>(ReqType::STOP) ? REQ_SIZE : 0;
+    }
+}
+
+std::shared_ptr<Parksys::GatewayState> Parksys::Server::handle_hello(const uint8_t *frame)
+{
+    uint32_t id, epoch;
+    std::memcpy(&id, frame + 1, sizeof(id));
+    std::memcpy(&epoch, frame + 1 + sizeof(id), sizeof(epoch));
+
+    std::shared_ptr<GatewayState> gw;
+    bool known = true;
+    {
+        std::lock_guard<std::mutex> lock(gateways_m);
+        auto &slot = gateways[id];
+        if (!slot)
+        {
+            slot = std::make_shared<GatewayState>();
+            known = false;
+        }
+        gw = slot;
+    }
+
+    std::lock_guard<std::mutex> lock(gw->m);
+    if (!known)
+    {
+        gw->id = id;
+        if (pdb->getGateway(id, gw->epoch, gw->next_seq) != pdbStatus::PDB_OK)
+        {
+            gw->epoch = epoch;
+            gw->next_seq = 0;
+        }
+    }
+
+    if (gw->epoch != epoch)
+    {
+        log.threadsafe_log("[Server] Gateway " + std::to_string(id) + " recreated its spool, restarting its sequence");
+        gw->epoch = epoch;
+        gw->next_seq = 0;
+    }
+
+    log.threadsafe_log("[Server] Gateway " + std::to_string(id) + " connected, next event "
+                       + std::to_string(gw->next_seq));
+    return gw;
+}
+
+Parksys::DataResult Parksys::Server::handle_data(Parksys::GatewayState &gw, uint32_t seq,
+                                                const Parksys::Request *req, bool first)
+{
+    std::lock_guard<std::mutex> lock(gw.m);
+
+    // Resent after a reconnection, already handled (wrap-around safe)
+    if (static_cast<int32_t>(seq - gw.next_seq) < 0)
+    {
+        return DataResult::DUPLICATE;
+    }
+
+    if (seq != gw.next_seq)
+    {
+        // A gap within a connection means an earlier frame was rejected
+        if (!first)
+        {
+            return DataResult::REJECTED;
+        }
+        err.threadsafe_log("[Server] Gateway " + std::to_string(gw.id) + " resumes at " + std::to_string(seq)
+                           + ", " + std::to_string(seq - gw.next_seq) + " events were never received");
+    }
+
+    // The sequence is stored along with the event, or neither is
+    if (pdb->begin() != pdbStatus::PDB_OK)
+    {
+        return DataResult::REJECTED;
+    }
+    if (pdb->setGateway(gw.id, gw.epoch, seq + 1) != pdbStatus::PDB_OK)
+    {
+        pdb->rollback();
+        return DataResult::REJECTED;
+    }
+
+    if (!req)
+    {
+        err.threadsafe_log("[Server] Received invalid message");
+    }
+    else if (!handle_request(*req))
+    {
+        pdb->rollback();
+        return DataResult::REJECTED;
+    }
+
+    if (pdb->commit() != pdbStatus::PDB_OK)
+    {
+        return DataResult::REJECTED;
+    }
+    gw.next_seq = seq + 1;
+    return DataResult::HANDLED;
+}
+
+bool Parksys::Server::send_ack(int fd, Parksys::GatewayState &gw)
+{
+    uint8_t frame[ACK_FRAME_SIZE];
+    frame[0] = static_cast<uint8_t>(FrameType::ACK);
+    {
+        std::lock_guard<std::mutex> lock(gw.m);
+        std::memcpy(frame + 1, &gw.next_seq, sizeof(gw.next_seq));
+    }
+    return send_all(fd, frame, sizeof(frame));
+}
+
+bool Parksys::Server::send_lots(int fd, uint32_t &have)
+{
+    std::shared_ptr<LotIndex> lots = lot_index();
+    if (lots->version() == have)
+    {
+        return true;
+    }
+    have = lots->version();
+
+    const std::vector<uint8_t> &table = lots->table();
+    uint32_t count;
+    std::memcpy(&count, table.data() + sizeof(uint32_t), sizeof(count));
+    if (count > MAX_TABLE_LOTS)
+    {
+        err.threadsafe_log("[Server] " + std::to_string(count) + " lots exceed MAX_TABLE_LOTS, lot table not sent");
+        return true;
+    }
+
+    const uint8_t type = static_cast<uint8_t>(FrameType::LOTS);
+    if (!send_all(fd, &type, sizeof(type)) || !send_all(fd, table.data(), table.size()))
+    {
+        return false;
+    }
+    log.threadsafe_log("[Server] Sent lot table " + std::to_string(have) + " with " + std::to_string(count) + " lots");
+    return true;
+}
+
+bool Parksys::Server::send_all(int fd, const uint8_t *buf, size_t len)
 {
     size_t total = 0;
-    uint8_t* ptr = static_cast<uint8_t*>(buf);
-    while (total < size)
+    while (total < len)
     {
-        ssize_t bytes = recv(fd, ptr + total, size - total, 0);
+        ssize_t bytes = send(fd, buf + total, len - total, MSG_NOSIGNAL);
         if (bytes <= 0)
         {
             return false;
@@ -147,41 +542,84 @@ bool Parksys::Server::parse_request(const uint8_t *buf, Parksys::Request &req)
 
     std::memcpy(&req.longitude, buf + offset, sizeof(req.longitude));
 
+    req.lot_id = 0;
+    req.lots_version = 0;
     return true;
 }
 
-void Parksys::Server::handle_request(const Parksys::Request &req)
+bool Parksys::Server::handle_request(const Parksys::Request &req)
 {
-    uint32_t lot_id = 0;
-    if (!this->pdb->findClosestLot(req.latitude, req.longitude, lot_id))
+    if (pdb->begin() != pdbStatus::PDB_OK)
     {
-        err.threadsafe_log("[Server] No parking lots found in database.");
-        return;
+        err.threadsafe_log("[Server] Failed to start a transaction, request dropped");
+        return false;
     }
 
+    uint32_t lot_id = 0;
+    std::shared_ptr<LotIndex> lots = lot_index();
+
     switch (req.type) {
     case ReqType::START:
+        // The gateway's pick stands when it resolved it against the current lots and the lot has room
+        if (req.lot_id != 0 && req.lots_version == lots->version() && lots->available(req.lot_id))
+        {
+            lot_id = req.lot_id;
+        }
+        else if (!lots->nearest(req.latitude, req.longitude, true, lot_id))
+        {
+            if (!lots->nearest(req.latitude, req.longitude, false, lot_id))
+            {
+                err.threadsafe_log("[Server] No parking lots found in database.");
+                pdb->rollback();
+                return true;
+            }
+            err.threadsafe_log("[Server] All lots are full, assigning closest lot " + std::to_string(lot_id));
+        }
+
         if (this->pdb->startParking(lot_id, req.license_id, req.timestamp) != pdbStatus::PDB_OK)
+        {
             err.threadsafe_log("[Server] Failed to log START");
-        else
-            log.threadsafe_log("[Server] | " + std::to_string(req.timestamp) +
-                  " | START recorded for license " + std::to_string(req.license_id) +
-                  " at (" + std::to_string(req.latitude) + "," + std::to_string(req.longitude) + ") | " +
-                  "Lot " + std::to_string(lot_id));
+            pdb->rollback();
+            return false;
+        }
+        track(lot_id, true);
         break;
 
     case ReqType::STOP:
-        if (this->pdb->endParking(req.license_id, req.timestamp) != pdbStatus::PDB_OK)
+        switch (this->pdb->endParking(req.license_id, req.timestamp, lot_id))
+        {
+        case pdbStatus::PDB_OK:
+            break;
+        case pdbStatus::PDB_NOT_FOUND:
+            err.threadsafe_log("[Server] STOP for license " + std::to_string(req.license_id)
+                               + " without an open session, ignored");
+            pdb->rollback();
+            return true;
+        default:
             err.threadsafe_log("[Server] Failed to log STOP");
-        else
-            log.threadsafe_log("[Server] | " + std::to_string(req.timestamp) +
-                  " | STOP recorded for license " + std::to_string(req.license_id) +
-                  " at (" + std::to_string(req.latitude) + "," + std::to_string(req.longitude) + ") | " +
-                  "Lot " + std::to_string(lot_id));
+            pdb->rollback();
+            return false;
+        }
+        track(lot_id, false);
         break;
 
     default:
         err.threadsafe_log("[Server] Unsupported message type");
-        break;
+        pdb->rollback();
+        return true;
     }
+
+    // Occupancy already counts the event, so it's reloaded if the event is gone
+    if (pdb->commit() != pdbStatus::PDB_OK)
+    {
+        err.threadsafe_log("[Server] Failed to commit " + std::string(req.type == ReqType::START ? "START" : "STOP"));
+        resync();
+        return false;
+    }
+
+    log.threadsafe_log("[Server] | " + std::to_string(req.timestamp) + " | "
+                       + (req.type == ReqType::START ? "START" : "STOP") + " recorded for license "
+                       + std::to_string(req.license_id) + " at (" + std::to_string(req.latitude) + ","
+                       + std::to_string(req.longitude) + ") | Lot " + std::to_string(lot_id));
+    return true;
 }
\ No newline at end of file
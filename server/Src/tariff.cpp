@@ -0,0 +1,172 @@
+#include "tariff.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace Parksys
+{
+    // 1970-01-01 was a Thursday. Shifting epoch hours by 4 days makes
+    // multiples of HOURS_PER_WEEK fall on Sunday 00:00 UTC.
+    constexpr uint64_t EPOCH_HOUR_SHIFT = 4 * HOURS_PER_DAY;
+
+    static inline double capped(double cost, double cap)
+    {
+        return cap > 0 ? std::min(cost, cap) : cost;
+    }
+
+    TariffEngine::TariffEngine(const std::vector<TariffRules> &rules)
+    {
+        uint32_t max_id = 0;
+        for (const TariffRules &r : rules)
+            max_id = std::max(max_id, r.lot_id);
+
+        position.assign(rules.empty() ? 0 : max_id + 1, -1);
+        tariffs.reserve(rules.size());
+        for (const TariffRules &r : rules)
+        {
+            position[r.lot_id] = tariffs.size();
+            tariffs.push_back(compile(r));
+        }
+    }
+
+    TariffEngine::Compiled TariffEngine::compile(const TariffRules &rules)
+    {
+        Compiled t;
+        t.is_hourly = rules.is_hourly;
+        t.grace_sec = rules.grace_sec;
+        t.fixed_price = rules.price;
+        t.cap = rules.max_daily;
+
+        double rate[HOURS_PER_WEEK];
+        std::fill(rate, rate + HOURS_PER_WEEK, rules.price);
+        for (const TariffBand &b : rules.bands)
+        {
+            for (unsigned d = 0; d < DAYS_PER_WEEK; d++)
+            {
+                if (!(b.days & (1u << d))) continue;
+                for (unsigned h = b.start_hour; h < b.end_hour && h < HOURS_PER_DAY; h++)
+                    rate[d * HOURS_PER_DAY + h] = b.rate;
+            }
+        }
+
+        t.hour_prefix[0] = 0.0;
+        for (unsigned h = 0; h < HOURS_PER_WEEK; h++)
+            t.hour_prefix[h + 1] = t.hour_prefix[h] + rate[h];
+
+        t.day_prefix[0] = 0.0;
+        for (unsigned d = 0; d < 2 * DAYS_PER_WEEK; d++)
+        {
+            unsigned first = (d % DAYS_PER_WEEK) * HOURS_PER_DAY;
+            double day = t.hour_prefix[first + HOURS_PER_DAY] - t.hour_prefix[first];
+            t.day_prefix[d + 1] = t.day_prefix[d] + capped(day, t.cap);
+        }
+        t.week_cost = t.day_prefix[DAYS_PER_WEEK];
+
+        return t;
+    }
+
+    double TariffEngine::hourly(const Compiled &t, uint64_t first_hour, uint64_t hours)
+    {
+        if (hours == 0) return 0.0;
+
+        // Hours within one calendar day never cross the end of the week
+        auto span = [&t](uint64_t from, uint64_t count)
+        {
+            uint64_t w = from % HOURS_PER_WEEK;
+            return capped(t.hour_prefix[w + count] - t.hour_prefix[w], t.cap);
+        };
+
+        uint64_t end_hour = first_hour + hours;
+        uint64_t first_day = first_hour / HOURS_PER_DAY;
+        uint64_t last_day = (end_hour - 1) / HOURS_PER_DAY;
+
+        if (first_day == last_day)
+            return span(first_hour, hours);
+
+        double total = span(first_hour, (first_day + 1) * HOURS_PER_DAY - first_hour)
+                     + span(last_day * HOURS_PER_DAY, end_hour - last_day * HOURS_PER_DAY);
+
+        // Whole days in between: full weeks, then the remaining days of the week
+        uint64_t full_days = last_day - first_day - 1;
+        unsigned dow = (first_day + 1) % DAYS_PER_WEEK;
+        unsigned rest = full_days % DAYS_PER_WEEK;
+        total += (full_days / DAYS_PER_WEEK) * t.week_cost
+               + t.day_prefix[dow + rest] - t.day_prefix[dow];
+
+        return total;
+    }
+
+    bool TariffEngine::price(uint32_t lot_id, uint32_t start_time, uint32_t end_time, double &total) const
+    {
+        if (lot_id >= position.size() || position[lot_id] < 0)
+            return false;
+
+        const Compiled &t = tariffs[position[lot_id]];
+        uint32_t duration = end_time > start_time ? end_time - start_time : 0;
+
+        if (t.grace_sec > 0 && duration <= t.grace_sec)
+        {
+            total = 0.0;
+        }
+        else if (!t.is_hourly)
+        {
+            uint32_t days = std::max(1u, (duration + 86399) / 86400);  // rounded up, at least one
+            total = days * t.fixed_price;
+        }
+        else
+        {
+            uint64_t hours = (uint64_t(duration) + 3599) / 3600;  // rounded up
+            uint64_t first_hour = start_time / 3600 + EPOCH_HOUR_SHIFT;
+            total = hourly(t, first_hour, hours);
+        }
+        return true;
+    }
+
+    RepriceImpact repriceOpenSessions(const TariffEngine &before, const TariffEngine &after,
+                                      const std::vector<OpenSession> &sessions,
+                                      uint32_t now, unsigned threads)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::max<size_t>(1, std::min<size_t>(threads, sessions.size()));
+
+        std::vector<RepriceImpact> partial(threads, RepriceImpact{0, 0, 0.0, 0.0});
+        std::vector<std::thread> workers;
+        size_t chunk = (sessions.size() + threads - 1) / threads;
+
+        for (unsigned t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+            {
+                RepriceImpact acc{0, 0, 0.0, 0.0};  // Local, to avoid sharing cache lines
+                size_t first = t * chunk;
+                size_t last = std::min(sessions.size(), first + chunk);
+
+                for (size_t i = first; i < last; i++)
+                {
+                    const OpenSession &s = sessions[i];
+                    double old_price = 0.0, new_price = 0.0;
+                    before.price(s.lot_id, s.start_time, now, old_price);
+                    after.price(s.lot_id, s.start_time, now, new_price);
+
+                    acc.sessions++;
+                    acc.before += old_price;
+                    acc.after += new_price;
+                    if (old_price != new_price)
+                        acc.changed++;
+                }
+                partial[t] = acc;
+            });
+        }
+
+        RepriceImpact total{0, 0, 0.0, 0.0};
+        for (unsigned t = 0; t < threads; t++)
+        {
+            workers[t].join();
+            total.sessions += partial[t].sessions;
+            total.changed += partial[t].changed;
+            total.before += partial[t].before;
+            total.after += partial[t].after;
+        }
+        return total;
+    }
+}
@@ -0,0 +1,152 @@
+#include "tariff.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace Parksys;
+
+constexpr uint32_t BENCH_LOTS = 1000;          // Lots with compiled tariffs
+constexpr uint32_t BENCH_SESSIONS = 1 << 20;   // Sessions priced per round
+constexpr int BENCH_ROUNDS = 10;               // Pricing rounds
+constexpr uint32_t BENCH_START = 1751371200;   // Tuesday, July 1, 2025 12:00:00 PM
+constexpr uint32_t BENCH_OPEN = 500000;        // Open sessions re-priced after a tariff change
+
+/**
+ * @brief Prices sessions with known charges, to catch pricing regressions before timing anything
+ *
+ * @return int Number of sessions priced wrong
+ */
+static int checkPrices()
+{
+    constexpr uint32_t DAY = BENCH_START - 12 * 3600;   // Tuesday 00:00
+    constexpr uint32_t H = 3600;
+
+    std::vector<TariffRules> rules(6);
+    rules[0] = {1, true, 10, 0, 0, {}};                       // Plain hourly
+    rules[1] = {2, true, 10, 50, 0, {}};                      // Hourly with a daily cap
+    rules[2] = {3, false, 30, 0, 0, {}};                      // Fixed
+    rules[3] = {4, true, 10, 0, 600, {}};                     // Hourly with a grace period
+    rules[4] = {5, false, 30, 0, 600, {}};                    // Fixed with a grace period
+    rules[5] = {6, true, 10, 0, 0, {{0x1f, 7, 10, 15}}};      // Sunday-Thursday morning rush
+    TariffEngine engine(rules);
+
+    struct Case { uint32_t lot_id, start, end; double total; const char *what; };
+    const Case cases[] = {
+        {1, DAY, DAY, 0, "hourly, empty session"},
+        {1, DAY, DAY + 1, 10, "hourly, started hour"},
+        {1, DAY, DAY + H, 10, "hourly, one hour"},
+        {1, DAY, DAY + H + 1, 20, "hourly, second started hour"},
+        {2, DAY, DAY + 24 * H, 50, "capped, one day"},
+        {2, DAY + 20 * H, DAY + 28 * H, 80, "capped, overnight under the cap of each day"},
+        {2, DAY, DAY + 10 * 24 * H, 500, "capped, ten days across a week"},
+        {3, DAY, DAY, 30, "fixed, empty session pays one day"},
+        {3, DAY, DAY + 24 * H, 30, "fixed, one day"},
+        {3, DAY, DAY + 24 * H + 1, 60, "fixed, second started day"},
+        {4, DAY, DAY + 600, 0, "hourly, within grace"},
+        {4, DAY, DAY + 601, 10, "hourly, past grace"},
+        {5, DAY, DAY + 600, 0, "fixed, within grace"},
+        {5, DAY, DAY + 601, 30, "fixed, past grace"},
+        {6, DAY + 6 * H, DAY + 10 * H, 55, "band, one base hour and three rush hours"},
+        {6, DAY + 4 * 24 * H + 6 * H, DAY + 4 * 24 * H + 10 * H, 40, "band, Saturday has no rush"},
+    };
+
+    int failures = 0;
+    for (const Case &c : cases)
+    {
+        double total = -1;
+        if (!engine.price(c.lot_id, c.start, c.end, total) || total != c.total)
+        {
+            std::cerr << "Priced " << c.what << " at " << total << ", expected " << c.total << "\n";
+            failures++;
+        }
+    }
+    double total;
+    if (engine.price(7, DAY, DAY + H, total))
+    {
+        std::cerr << "Priced a lot without a tariff\n";
+        failures++;
+    }
+    return failures;
+}
+
+int main()
+{
+    if (checkPrices() != 0)
+        return 1;
+
+    std::mt19937 rng(0);
+
+    // Lots with a weekend rate and a few time of day bands each
+    std::vector<TariffRules> rules;
+    for (uint32_t id = 1; id <= BENCH_LOTS; id++)
+    {
+        TariffRules r;
+        r.lot_id = id;
+        r.is_hourly = (id % 4 != 0);
+        r.price = 10 + rng() % 20;
+        r.max_daily = (id % 3 == 0) ? 0.0 : r.price * 5;
+        r.grace_sec = (id % 2) * 600;
+        r.bands.push_back({0x60, 0, 24, r.price / 2});               // Friday and Saturday
+        r.bands.push_back({0x1f, 7, 10, r.price * 1.5});             // Weekday morning rush
+        r.bands.push_back({0x7f, 22, 24, r.price / 4});              // Nights
+        rules.push_back(r);
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    TariffEngine engine(rules);
+    auto t1 = std::chrono::steady_clock::now();
+
+    // Durations from seconds up to four weeks
+    struct Session { uint32_t lot_id, start, end; };
+    std::vector<Session> sessions(BENCH_SESSIONS);
+    for (Session &s : sessions)
+    {
+        s.lot_id = 1 + rng() % BENCH_LOTS;
+        s.start = BENCH_START + rng() % (365 * 86400);
+        s.end = s.start + (rng() % 4 == 0 ? rng() % (28 * 86400) : rng() % 36000);
+    }
+
+    double checksum = 0.0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (const Session &s : sessions)
+        {
+            double total;
+            if (engine.price(s.lot_id, s.start, s.end, total))
+                checksum += total;
+        }
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    // Re-price open sessions after doubling the price of every tenth lot
+    std::vector<OpenSession> open(BENCH_OPEN);
+    for (uint32_t i = 0; i < BENCH_OPEN; i++)
+    {
+        open[i].log_id = i;
+        open[i].lot_id = 1 + rng() % BENCH_LOTS;
+        open[i].start_time = BENCH_START + rng() % (28 * 86400);
+    }
+    for (TariffRules &r : rules)
+    {
+        if (r.lot_id % 10 == 0) r.price *= 2;
+    }
+    TariffEngine changed(rules);
+
+    auto t4 = std::chrono::steady_clock::now();
+    RepriceImpact impact = repriceOpenSessions(engine, changed, open, BENCH_START + 28 * 86400);
+    auto t5 = std::chrono::steady_clock::now();
+
+    double compile_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double price_sec = std::chrono::duration<double>(t3 - t2).count();
+    double priced = double(BENCH_SESSIONS) * BENCH_ROUNDS;
+
+    std::cout << "Compiled " << BENCH_LOTS << " tariffs in " << compile_ms << " ms\n"
+              << "Priced " << priced << " sessions in " << price_sec << " s: "
+              << priced / price_sec << " prices/sec (" << price_sec / priced * 1e9 << " ns/price)\n"
+              << "Re-priced " << impact.sessions << " open sessions (" << impact.changed << " changed) in "
+              << std::chrono::duration<double, std::milli>(t5 - t4).count() << " ms\n"
+              << "Checksum " << checksum << "\n";
+    return 0;
+}